@@ -2,38 +2,91 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <math.h>
+#include <float.h>
 #include <string.h>
 #include "aoi.h"
 
 #define INVALID_ID (~0)
 #define PRE_ALLOC 16
+#define MAP_PAGE 256	// ids of a page in dense id mode
+#define SLAB_OBJECT 64	// objects carved from a slab
 //#define PRE_ALLOC 32
 #define MODE_WATCHER 1
 #define MODE_MARKER 2
+#define SKIP_MAX_LEVEL 12
+#define SKIP_WALK 8	// steps walked on level 0 before searching the skip list
+#define AXIS_BUCKET 64	// buckets of each axis to estimate nodes in a view window
+#define GROUP_SPAN 2	// windows of a batch group span at most 2 windows on each axis
+// order of an object and a sentinel at the same position,matches in_view exactly
+#define RANK_LEFT 0	// sentinel at pos-view
+#define RANK_OBJECT 1
+#define RANK_RIGHT 2	// sentinel at pos+view
+// compile with -DAOI_2D for flat maps: z is ignored and has no list
+#if defined AOI_2D
+	#define AOI_DIM 2
+#else
+	#define AOI_DIM 3
+#endif
+#define SENTINEL_NUMBER (2*AOI_DIM)
 
+typedef struct aoi_skip {
+	struct aoi_node *prev;
+	struct aoi_node *next;
+} aoi_skip;
+
+// a node of the sorted list of an axis
+typedef struct aoi_node {
+	struct aoi_node *prev;
+	struct aoi_node *next;
+	aoi_skip *skip;	// skip[k-1]: links of level k
+	float pos;
+	uint8_t level;	// skip list levels above level 0(prev/next)
+	uint8_t rank;
+	struct aoi_object *obj;	// object of the node,or watcher of a sentinel
+} aoi_node;
 
 typedef struct aoi_object {
-	struct aoi_object *x_prev;
-	struct aoi_object *x_next;
-	struct aoi_object *y_prev;
-	struct aoi_object *y_next;
-	struct aoi_object *z_prev;
-	struct aoi_object *z_next;
+	aoi_node node[AOI_DIM];	// node of x,y,z list
 	uint32_t id;
 	int mode;
+	bool custom_view;
 	float pos[3];
+	float view_size[3];
+	int batch_index;	// index in aoi->batch during aoi_move_batch
+	int pending_index;	// index in aoi->pending_ids when move is deferred
+	aoi_node *sentinel;	// view boundaries of a watcher: x left/right,y left/right,z left/right
+	uint32_t *linger;	// markers still seen beyond the view,until they pass the hysteresis
+	int linger_number;
+	int linger_cap;
+	uint32_t stamp;	// last move or set difference which marked this object
+	struct aoi_object *next_free;	// next object of aoi->free_objects
 } aoi_object;
 
+// objects are carved from slabs,left ones wait in aoi->free_objects for the next enter
+typedef struct aoi_slab {
+	struct aoi_slab *next;
+	aoi_object obj[SLAB_OBJECT];
+} aoi_slab;
+
+// open addressing with linear probing,an empty slot has no obj
 typedef struct aoi_map_slot {
 	uint32_t id;
 	aoi_object * obj;
-	int next;
 } aoi_map_slot;
 
+// a page of objects indexed by id in dense id mode
+typedef struct aoi_map_page {
+	int number;
+	aoi_object *obj[MAP_PAGE];
+} aoi_map_page;
+
 typedef struct aoi_map {
 	int size;
-	int lastfree;
+	int number;
 	aoi_map_slot * slot;
+	aoi_map_page **page;	// pages of dense id mode,NULL when ids are hashed
+	int page_number;
+	uint32_t max_id;	// ids of dense id mode are below it,0 means no bound
 } aoi_map;
 
 typedef struct aoi_set {
@@ -42,34 +95,248 @@ typedef struct aoi_set {
 	void **slot;
 } aoi_set;
 
+// ids written to a caller buffer,number counts all matches even past cap
+typedef struct aoi_result {
+	uint32_t *ids;
+	int cap;
+	int number;
+} aoi_result;
+
+
+typedef struct aoi_batch_move {
+	aoi_object *obj;
+	float pos[3];
+} aoi_batch_move;
 
 typedef struct aoi_space {
 	aoi_object *origin;
+	aoi_object *sentinel_origin;	// heads of sentinel lists
 	aoi_map *objects;
 	float map_size[3];
 	float view_size[3];
+	float max_view[3];	// max view size of all objects
+	int custom_view_number;
+	float hysteresis;	// a seen marker leaves only when it is this distance beyond the view
 	aoi_Alloc alloc;
 	void *alloc_ud;
 	enterAOI_Callback cb_enterAOI;
 	leaveAOI_Callback cb_leaveAOI;
 	void *cb_ud;
+	aoi_event *events;	// buffered events when no callback
+	int event_number;
+	int event_cap;
+	bool buffered;	// events go to aoi->events
+	bool defer;	// moves are applied in aoi_update
+	uint32_t *pending_ids;
+	float (*pending_pos)[3];
+	int pending_number;
+	int pending_cap;
 	aoi_set *set1;
 	aoi_set *set2;
 	aoi_set *result_set;
+	aoi_batch_move *batch;
+	int batch_cap;
+	uint32_t seed;	// random seed of skip list levels
+	uint32_t stamp;	// increased by every move and set difference
+	int axis_count[AOI_DIM][AXIS_BUCKET];	// object number of each bucket on x,y,z axis
+	aoi_slab *slab;
+	aoi_object *free_objects;
+	aoi_node *free_sentinels;	// freed sentinel arrays linked by next of the first node
 } aoi_space;
 
+// p = 1/4
+static int
+random_level(aoi_space *aoi) {
+	int level = 0;
+	while (level < SKIP_MAX_LEVEL) {
+		uint32_t x = aoi->seed;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		aoi->seed = x;
+		if ((x & 3) != 0) {
+			break;
+		}
+		level++;
+	}
+	return level;
+}
+
+// levels of nodes share one skip block,skip of the first node is the block
+static void
+skip_alloc(aoi_space *aoi,aoi_node *node,int n,bool head) {
+	int i;
+	int number = 0;
+	for (i=0; i<n; i++) {
+		// heads of lists are on every level
+		node[i].level = head ? SKIP_MAX_LEVEL : random_level(aoi);
+		number += node[i].level;
+	}
+	aoi_skip *skip = NULL;
+	if (number > 0) {
+		skip = aoi->alloc(aoi->alloc_ud,NULL,number * sizeof(aoi_skip));
+		memset(skip,0,number * sizeof(aoi_skip));
+	}
+	for (i=0; i<n; i++) {
+		node[i].skip = skip;
+		skip += node[i].level;
+	}
+}
+
+static void
+skip_free(aoi_space *aoi,aoi_node *node,int n) {
+	int i;
+	int number = 0;
+	for (i=0; i<n; i++) {
+		number += node[i].level;
+	}
+	if (number > 0) {
+		aoi->alloc(aoi->alloc_ud,node[0].skip,number * sizeof(aoi_skip));
+	}
+}
+
+static size_t
+skip_bytes(aoi_node *node,int n) {
+	int i;
+	int number = 0;
+	for (i=0; i<n; i++) {
+		number += node[i].level;
+	}
+	return number * sizeof(aoi_skip);
+}
+
+static aoi_object *
+object_alloc(aoi_space *aoi) {
+	if (aoi->free_objects == NULL) {
+		int i;
+		aoi_slab *slab = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_slab));
+		// nodes of objects never used have no owner and no skip block
+		memset(slab,0,sizeof(aoi_slab));
+		slab->next = aoi->slab;
+		aoi->slab = slab;
+		// objects entering one after another are adjacent
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			slab->obj[i].next_free = aoi->free_objects;
+			aoi->free_objects = &slab->obj[i];
+		}
+	}
+	aoi_object *obj = aoi->free_objects;
+	aoi->free_objects = obj->next_free;
+	return obj;
+}
+
+static void
+object_free(aoi_space *aoi,aoi_object *obj) {
+	obj->next_free = aoi->free_objects;
+	aoi->free_objects = obj;
+}
+
+static void
+slab_delete(aoi_space *aoi) {
+	while (aoi->slab != NULL) {
+		aoi_slab *slab = aoi->slab;
+		aoi->slab = slab->next;
+		aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+	}
+	aoi->free_objects = NULL;
+}
+
+// slabs with all objects free go back to the allocator,free objects are marked by mode -1
+static void
+slab_compact(aoi_space *aoi) {
+	int i;
+	aoi_object *obj;
+	aoi_slab **p = &aoi->slab;
+	for (obj=aoi->free_objects; obj != NULL; obj=obj->next_free) {
+		obj->mode = -1;
+	}
+	aoi->free_objects = NULL;
+	while (*p != NULL) {
+		aoi_slab *slab = *p;
+		int number = 0;
+		for (i=0; i<SLAB_OBJECT; i++) {
+			if (slab->obj[i].mode < 0) {
+				number++;
+			}
+		}
+		if (number == SLAB_OBJECT) {
+			for (i=0; i<SLAB_OBJECT; i++) {
+				skip_free(aoi,slab->obj[i].node,AOI_DIM);
+			}
+			*p = slab->next;
+			aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+			continue;
+		}
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			if (slab->obj[i].mode < 0) {
+				object_free(aoi,&slab->obj[i]);
+			}
+		}
+		p = &slab->next;
+	}
+}
+
 static aoi_object *
 new_object(aoi_space *aoi,uint32_t id) {
-	aoi_object *obj = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*obj));
+	int i;
+	aoi_object *obj = object_alloc(aoi);
+	// a reused object keeps levels and skip block of its nodes
+	bool reuse = obj->node[0].obj != NULL;
+	aoi_node node[AOI_DIM];
+	memcpy(node,obj->node,sizeof(node));
 	memset(obj,0,sizeof(*obj));
 	obj->id = id;
+	obj->batch_index = -1;
+	obj->pending_index = -1;
+	for (i=0; i<AOI_DIM; i++) {
+		obj->node[i].rank = RANK_OBJECT;
+		obj->node[i].obj = obj;
+		obj->node[i].skip = node[i].skip;
+		obj->node[i].level = node[i].level;
+	}
+	if (!reuse) {
+		skip_alloc(aoi,obj->node,AOI_DIM,id == INVALID_ID);
+	}
 	return obj;
 }
 
+// sentinels keep levels and skip block for the next watcher
+static void
+sentinel_free(aoi_space *aoi,aoi_object *obj) {
+	obj->sentinel->next = aoi->free_sentinels;
+	aoi->free_sentinels = obj->sentinel;
+	obj->sentinel = NULL;
+}
+
+static void
+sentinel_pool_delete(aoi_space *aoi) {
+	while (aoi->free_sentinels != NULL) {
+		aoi_node *sentinel = aoi->free_sentinels;
+		aoi->free_sentinels = sentinel->next;
+		skip_free(aoi,sentinel,SENTINEL_NUMBER);
+		aoi->alloc(aoi->alloc_ud,sentinel,SENTINEL_NUMBER * sizeof(aoi_node));
+	}
+}
+
+static void
+pool_delete(aoi_space *aoi) {
+	aoi_object *obj;
+	sentinel_pool_delete(aoi);
+	for (obj=aoi->free_objects; obj != NULL; obj=obj->next_free) {
+		skip_free(aoi,obj->node,AOI_DIM);
+	}
+}
+
 static void
 delete_object(void *ud,aoi_object *obj) {
 	aoi_space *aoi = ud;
-	aoi->alloc(aoi->alloc_ud,obj,sizeof(*obj));
+	if (obj->sentinel != NULL) {
+		sentinel_free(aoi,obj);
+	}
+	if (obj->linger != NULL) {
+		aoi->alloc(aoi->alloc_ud,obj->linger,obj->linger_cap * sizeof(uint32_t));
+	}
+	object_free(aoi,obj);
 }
 
 static aoi_object * map_get(aoi_map *m,uint32_t id);
@@ -79,101 +346,149 @@ get_object(aoi_space *aoi,uint32_t id) {
 	return map_get(aoi->objects,id);
 }
 
-static inline aoi_map_slot *
-mainposition(aoi_map *m , uint32_t id) {
-	uint32_t hash = id & (m->size-1);
-	return &m->slot[hash];
+static inline uint32_t
+map_hash(uint32_t id) {
+	uint32_t h = id * 2654435761u;
+	return h ^ (h >> 16);
 }
 
-static void rehash(aoi_space * aoi, aoi_map *m);
-
 static void
-map_insert(aoi_space * aoi , aoi_map * m, uint32_t id , aoi_object *obj) {
-	aoi_map_slot *s = mainposition(m,id);
-	if (s->id == INVALID_ID) {
-		s->id = id;
-		s->obj = obj;
-		return;
-	}
-	if (mainposition(m, s->id) != s) {
-		aoi_map_slot * last = mainposition(m,s->id);
-		while (last->next != s - m->slot) {
-			assert(last->next >= 0);
-			last = &m->slot[last->next];
-		}
-		uint32_t temp_id = s->id;
-		aoi_object * temp_obj = s->obj;
-		last->next = s->next;
-		s->id = id;
-		s->obj = obj;
-		s->next = -1;
-		if (temp_obj) {
-			map_insert(aoi, m, temp_id, temp_obj);
+map_resize(aoi_space *aoi,aoi_map *m,int size) {
+	aoi_map_slot *old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	for (i=0; i<old_size; i++) {
+		aoi_map_slot *s = &old_slot[i];
+		if (s->obj != NULL) {
+			int mask = m->size - 1;
+			int j = map_hash(s->id) & mask;
+			while (m->slot[j].obj != NULL) {
+				j = (j+1) & mask;
+			}
+			m->slot[j] = *s;
 		}
-		return;
-	} else if(s->obj == NULL) {
-		s->id = id;
-		s->obj = obj;
-		return;
 	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_map_slot));
+}
 
-	while (m->lastfree >= 0) {
-		aoi_map_slot * temp = &m->slot[m->lastfree--];
-		if (temp->id == INVALID_ID) {
-			temp->id = id;
-			temp->obj = obj;
-			temp->next = s->next;
-			s->next = (int)(temp - m->slot);
-			return;
+static void
+page_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	assert(m->max_id == 0 || id < m->max_id);
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number) {
+		int number = m->page_number;
+		while (k >= number) {
+			number *= 2;
 		}
+		aoi_map_page **page = aoi->alloc(aoi->alloc_ud,NULL,number * sizeof(aoi_map_page*));
+		memset(page,0,number * sizeof(aoi_map_page*));
+		memcpy(page,m->page,m->page_number * sizeof(aoi_map_page*));
+		aoi->alloc(aoi->alloc_ud,m->page,m->page_number * sizeof(aoi_map_page*));
+		m->page = page;
+		m->page_number = number;
+	}
+	aoi_map_page *page = m->page[k];
+	if (page == NULL) {
+		page = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_map_page));
+		memset(page,0,sizeof(aoi_map_page));
+		m->page[k] = page;
+	}
+	page->obj[id % MAP_PAGE] = obj;
+	page->number++;
+	m->number++;
+}
+
+static inline aoi_object *
+page_get(aoi_map *m,uint32_t id) {
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number || m->page[k] == NULL) {
+		return NULL;
+	}
+	return m->page[k]->obj[id % MAP_PAGE];
+}
+
+// empty pages are freed
+static aoi_object *
+page_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	aoi_object *obj = page_get(m,id);
+	if (obj == NULL) {
+		return NULL;
 	}
-	rehash(aoi,m);
-	map_insert(aoi, m, id , obj);
+	aoi_map_page *page = m->page[id / MAP_PAGE];
+	page->obj[id % MAP_PAGE] = NULL;
+	m->number--;
+	if (--page->number == 0) {
+		aoi->alloc(aoi->alloc_ud,page,sizeof(aoi_map_page));
+		m->page[id / MAP_PAGE] = NULL;
+	}
+	return obj;
 }
 
+// switch an empty map to pages indexed by id
 static void
-rehash(aoi_space * aoi, aoi_map *m) {
-	aoi_map_slot * old_slot = m->slot;
-	int old_size = m->size;
-	m->size = 2 * old_size;
-	m->lastfree = m->size - 1;
-	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
-	int i;
-	for (i=0;i<m->size;i++) {
-		aoi_map_slot * s = &m->slot[i];
-		s->id = INVALID_ID;
-		s->obj = NULL;
-		s->next = -1;
+map_set_dense(aoi_space *aoi,aoi_map *m,uint32_t max_id) {
+	assert(m->number == 0 && m->page == NULL);
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_map_slot));
+	m->slot = NULL;
+	m->size = 0;
+	m->max_id = max_id;
+	m->page_number = max_id > 0 ? max_id / MAP_PAGE + (max_id % MAP_PAGE != 0) : PRE_ALLOC;
+	m->page = aoi->alloc(aoi->alloc_ud,NULL,m->page_number * sizeof(aoi_map_page*));
+	memset(m->page,0,m->page_number * sizeof(aoi_map_page*));
+}
+
+// id is not in the map
+static void
+map_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	if (m->page != NULL) {
+		page_insert(aoi,m,id,obj);
+		return;
 	}
-	for (i=0;i<old_size;i++) {
-		aoi_map_slot * s = &old_slot[i];
-		if (s->obj) {
-			map_insert(aoi, m, s->id, s->obj);
-		}
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		map_resize(aoi,m,m->size*2);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].obj != NULL) {
+		i = (i+1) & mask;
 	}
-	aoi->alloc(aoi->alloc_ud, old_slot, old_size * sizeof(aoi_map_slot));
+	m->slot[i].id = id;
+	m->slot[i].obj = obj;
+	m->number++;
 }
 
+// ids live in slots,so a probe never touches objects
 static aoi_object *
 map_get(aoi_map *m,uint32_t id) {
-	aoi_map_slot *s = mainposition(m, id);
+	if (m->page != NULL) {
+		return page_get(m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
 	for (;;) {
-		if (s->id == id) {
-			if (s->obj != NULL) {
-				return s->obj;
-			}
+		aoi_map_slot *s = &m->slot[i];
+		if (s->obj == NULL || s->id == id) {
+			return s->obj;
 		}
-		if (s->next < 0) {
-			break;
-		}
-		s=&m->slot[s->next];
+		i = (i+1) & mask;
 	}
-	return NULL;
 }
 
 static void
 map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
-	int i;
+	int i,j;
+	for (i=0; i<m->page_number; i++) {
+		aoi_map_page *page = m->page[i];
+		for (j=0; page != NULL && j<MAP_PAGE; j++) {
+			if (page->obj[j]) {
+				func(ud, page->obj[j]);
+			}
+		}
+	}
 	for (i=0;i<m->size;i++) {
 		if (m->slot[i].obj) {
 			func(ud, m->slot[i].obj);
@@ -181,44 +496,104 @@ map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
 	}
 }
 
+static void
+stamp_clear(void *ud,aoi_object *obj) {
+	obj->stamp = 0;
+}
+
+// a stamp never used before,stamps of all objects are cleared when it wraps
+static void
+stamp_next(aoi_space *aoi) {
+	if (++aoi->stamp == 0) {
+		map_foreach(aoi->objects,stamp_clear,NULL);
+		aoi->stamp = 1;
+	}
+}
+
 static aoi_object *
-map_remove(aoi_map *m, uint32_t id) {
-	aoi_map_slot *s = mainposition(m,id);
+map_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_remove(aoi,m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].id != id || m->slot[i].obj == NULL) {
+		if (m->slot[i].obj == NULL) {
+			return NULL;
+		}
+		i = (i+1) & mask;
+	}
+	aoi_object *obj = m->slot[i].obj;
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
 	for (;;) {
-		if (s->id == id) {
-			aoi_object * obj = s->obj;
-			s->obj = NULL;
-			return obj;
+		j = (j+1) & mask;
+		aoi_map_slot *temp = &m->slot[j];
+		if (temp->obj == NULL) {
+			break;
 		}
-		if (s->next < 0) {
-			return NULL;
+		int k = map_hash(temp->id) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
 		}
-		s=&m->slot[s->next];
+		m->slot[i] = *temp;
+		i = j;
+	}
+	m->slot[i].obj = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		map_resize(aoi,m,m->size/2);
 	}
+	return obj;
 }
 
 static void
 map_delete(aoi_space *aoi, aoi_map * m) {
-	aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	int i;
+	for (i=0; i<m->page_number; i++) {
+		if (m->page[i] != NULL) {
+			aoi->alloc(aoi->alloc_ud, m->page[i], sizeof(aoi_map_page));
+		}
+	}
+	if (m->page != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->page, m->page_number * sizeof(aoi_map_page*));
+	}
+	if (m->slot != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	}
 	aoi->alloc(aoi->alloc_ud, m , sizeof(*m));
 }
 
 static aoi_map *
 map_new(aoi_space *aoi) {
-	int i;
 	aoi_map * m = aoi->alloc(aoi->alloc_ud, NULL, sizeof(*m));
 	m->size = PRE_ALLOC;
-	m->lastfree = PRE_ALLOC - 1;
+	m->number = 0;
 	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
-	for (i=0;i<m->size;i++) {
-		aoi_map_slot * s = &m->slot[i];
-		s->id = INVALID_ID;
-		s->obj = NULL;
-		s->next = -1;
-	}
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	m->page = NULL;
+	m->page_number = 0;
+	m->max_id = 0;
 	return m;
 }
 
+static void
+map_stats(aoi_map *m,aoi_memory *stats) {
+	int i;
+	stats->map_number = m->number;
+	stats->map_cap = m->size;
+	stats->map_bytes = sizeof(*m) + m->size * sizeof(aoi_map_slot);
+	if (m->page != NULL) {
+		stats->map_bytes += m->page_number * sizeof(aoi_map_page*);
+		for (i=0; i<m->page_number; i++) {
+			if (m->page[i] != NULL) {
+				stats->map_cap += MAP_PAGE;
+				stats->map_bytes += sizeof(aoi_map_page);
+			}
+		}
+	}
+}
+
 static aoi_set *
 set_new(aoi_space *aoi) {
 	aoi_set *set = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*set));
@@ -234,6 +609,40 @@ set_delete(aoi_space *aoi,aoi_set *set) {
 	aoi->alloc(aoi->alloc_ud,set,sizeof(*set));
 }
 
+static inline size_t
+set_bytes(aoi_set *set) {
+	return sizeof(*set) + set->cap * sizeof(void*);
+}
+
+static void
+set_stats(aoi_set *set,aoi_memory *stats) {
+	stats->set_used += set->number;
+	stats->set_cap += set->cap;
+	stats->set_bytes += set_bytes(set);
+}
+
+// halve while at most a quarter is used,so at least twice the number is left
+static inline int
+shrink_cap(int number,int cap) {
+	while (cap > PRE_ALLOC && number * 4 <= cap) {
+		cap /= 2;
+	}
+	return cap;
+}
+
+static void
+set_shrink(aoi_space *aoi,aoi_set *set) {
+	int cap = shrink_cap(set->number,set->cap);
+	if (cap == set->cap) {
+		return;
+	}
+	void **slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+	memcpy(slot,set->slot,set->number*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	set->slot = slot;
+	set->cap = cap;
+}
+
 /*
 static bool
 set_find(aoi_set *set,void *elem) {
@@ -265,6 +674,24 @@ set_add(aoi_space *aoi,aoi_set *set,void *elem) {
 	}
 }
 
+static inline void
+result_add(aoi_result *result,uint32_t id) {
+	if (result->number < result->cap) {
+		result->ids[result->number] = id;
+	}
+	result->number++;
+}
+
+// a query writes ids to set,or to result when set is NULL
+static inline void
+query_add(aoi_space *aoi,aoi_set *set,aoi_result *result,uint32_t id) {
+	if (set != NULL) {
+		set_add(aoi,set,(void*)id);
+	} else {
+		result_add(result,id);
+	}
+}
+
 /*
 static void*
 set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
@@ -281,20 +708,20 @@ set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
 }
 */
 
+// objects of set1 not in set2,objects of set2 are marked with a new stamp first
 static void
 set_difference(aoi_space *aoi,aoi_set *set1,aoi_set *set2,aoi_set *result) {
-	int i,j;
-	int number1 = set1->number;
-	int number2 = set2->number;
+	int i;
+	stamp_next(aoi);
+	for (i=0; i<set2->number; i++) {
+		aoi_object *obj = set2->slot[i];
+		obj->stamp = aoi->stamp;
+	}
 	result->number = 0;
-	for (i=0; i<number1; i++) {
-		for (j=0;j<number2;j++) {
-			if (set1->slot[i] == set2->slot[j]) {
-				break;
-			}
-		}
-		if (j == number2) {
-			set_add(aoi,result,set1->slot[i]);
+	for (i=0; i<set1->number; i++) {
+		aoi_object *obj = set1->slot[i];
+		if (obj->stamp != aoi->stamp) {
+			set_add(aoi,result,obj);
 		}
 	}
 }
@@ -320,184 +747,535 @@ set_intersection(aoi_space *aoi,aoi_set *set1,aoi_set *set2,aoi_set *result) {
 */
 
 inline static void 
-copy_position(float des[3], float src[3]) {
+copy_position(float des[3], const float src[3]) {
 	des[0] = src[0];
 	des[1] = src[1];
 	des[2] = src[2];
 }
 
-static void
-link_remove(aoi_space *aoi,char direction,aoi_object *node) {
-	assert(aoi->origin != node);
-	switch(direction) {
-	case 'x':
-		if (node->x_next) {
-			node->x_next->x_prev = node->x_prev;
-		}
-		if (node->x_prev) {
-			node->x_prev->x_next = node->x_next;
-		}
-		break;
-	case 'y':
-		if (node->y_next) {
-			node->y_next->y_prev = node->y_prev;
-		}
-		if (node->y_prev) {
-			node->y_prev->y_next = node->y_next;
-		}
-		break;
-	case 'z':
-		if (node->z_next) {
-			node->z_next->z_prev = node->z_prev;
-		}
-		if (node->z_prev) {
-			node->z_prev->z_next = node->z_next;
-		}
-		break;
-	default:
-		assert(false);
-		break;
+// address of prev/next link of node on level
+static inline aoi_node **
+link_slot(aoi_node *node,int level,bool next) {
+	if (level > 0) {
+		aoi_skip *skip = &node->skip[level-1];
+		return next ? &skip->next : &skip->prev;
 	}
+	return next ? &node->next : &node->prev;
+}
+
+#define LINK_NEXT(node,level) (*link_slot((node),(level),true))
+#define LINK_PREV(node,level) (*link_slot((node),(level),false))
+
+// objects and sentinels are kept in different lists of each axis
+static inline aoi_node *
+list_head(aoi_space *aoi,int i,bool sentinel) {
+	return sentinel ? &aoi->sentinel_origin->node[i] : &aoi->origin->node[i];
 }
 
 static void
-link_insert(aoi_space *aoi,char direction,aoi_object *after,aoi_object *node) {
-	switch(direction) {
-	case 'x':
-		node->x_next = after->x_next;
-		node->x_prev = after;
-		if (after->x_next != NULL) {
-			after->x_next->x_prev = node;
-		}
-		after->x_next = node;
-		break;
-	case 'y':
-		node->y_next = after->y_next;
-		node->y_prev = after;
-		if (after->y_next != NULL) {
-			after->y_next->y_prev = node;
+link_remove(aoi_space *aoi,aoi_node *node) {
+	int k;
+	assert(node->obj != aoi->origin && node->obj != aoi->sentinel_origin);
+	for (k=0; k<=node->level; k++) {
+		aoi_node *prev = LINK_PREV(node,k);
+		aoi_node *next = LINK_NEXT(node,k);
+		if (next) {
+			LINK_PREV(next,k) = prev;
 		}
-		after->y_next = node;
-		break;
-	case 'z':
-		node->z_next = after->z_next;
-		node->z_prev = after;
-		if (after->z_next != NULL) {
-			after->z_next->z_prev = node;
+		if (prev) {
+			LINK_NEXT(prev,k) = next;
 		}
-		after->z_next = node;
-		break;
-	default:
-		assert(false);
-		break;
 	}
 }
 
+// insert node after `after` on level 0,on upper levels after the nearest node before it
+// which is high enough(expected O(1) steps per level)
 static void
-link_insert_by_pos(aoi_space *aoi,aoi_object *obj) {
-	aoi_object *origin = aoi->origin;
-	aoi_object *x_node,*y_node,*z_node;
-	for(x_node=origin; x_node->x_next != NULL; x_node=x_node->x_next) {
-		if (x_node->x_next->pos[0] >= obj->pos[0]) {
-			break;
+link_insert(aoi_space *aoi,aoi_node *after,aoi_node *node) {
+	int k;
+	for (k=0; k<=node->level; k++) {
+		while (after->level < k) {
+			after = LINK_PREV(after,k-1);
 		}
-	}
-	link_insert(aoi,'x',x_node,obj);
-
-	for(y_node=origin; y_node->y_next != NULL; y_node=y_node->y_next) {
-		if (y_node->y_next->pos[1] >= obj->pos[1]) {
-			break;
+		aoi_node *next = LINK_NEXT(after,k);
+		LINK_NEXT(node,k) = next;
+		LINK_PREV(node,k) = after;
+		if (next) {
+			LINK_PREV(next,k) = node;
 		}
+		LINK_NEXT(after,k) = node;
 	}
-	link_insert(aoi,'y',y_node,obj);
+}
 
-	for(z_node=origin; z_node->z_next != NULL; z_node=z_node->z_next) {
-		if (z_node->z_next->pos[2] >= obj->pos[2]) {
-			break;
+// node is ordered before position v of rank
+static inline bool
+node_before(aoi_node *node,float v,int rank) {
+	return node->pos < v || (node->pos == v && node->rank < rank);
+}
+
+// last node of list head ordered before position v of rank(head if none),O(log n)
+static aoi_node *
+link_search(aoi_node *head,float v,int rank) {
+	int k;
+	aoi_node *node = head;
+	for (k=SKIP_MAX_LEVEL; k>=0; k--) {
+		aoi_node *next;
+		while ((next = LINK_NEXT(node,k)) != NULL && node_before(next,v,rank)) {
+			node = next;
 		}
 	}
-	link_insert(aoi,'z',z_node,obj);
+	return node;
 }
 
-
-static inline bool
-in_view(aoi_space *aoi,float pos1[3],float pos2[3],float view_size[3]) {
+static void
+link_insert_by_pos(aoi_space *aoi,aoi_object *obj) {
 	int i;
-	for (i=0; i<3; i++) {
-		if (fabs(pos1[i]-pos2[i]) > view_size[i]) {
-			return false;
-		}
+	for (i=0; i<AOI_DIM; i++) {
+		aoi_node *node = &obj->node[i];
+		node->pos = obj->pos[i];
+		link_insert(aoi,link_search(list_head(aoi,i,false),node->pos,node->rank),node);
 	}
-	return true;
 }
 
+// relink node of list head for new position v,short moves walk level 0,
+// long ones search the skip list
 static void
-get_view(aoi_space *aoi,aoi_object *obj,aoi_set *result,float view_size[3]) {
-	aoi_object *origin = aoi->origin;
-	aoi_object *x_node;
-	result->number = 0;
-	for(x_node=obj->x_prev; x_node != origin; x_node=x_node->x_prev) {
-		if (fabs(x_node->pos[0]-obj->pos[0]) <= view_size[0]) {
-			if (in_view(aoi,x_node->pos,obj->pos,view_size)) {
-				set_add(aoi,result,x_node);
+link_move(aoi_space *aoi,aoi_node *head,aoi_node *node,float v) {
+	int step = 0;
+	aoi_node *after,*next;
+	if (v < node->pos) {
+		for (after=node->prev; after != head; after=after->prev) {
+			if (node_before(after,v,node->rank)) {
+				break;
+			}
+			if (++step > SKIP_WALK) {
+				after = NULL;
+				break;
 			}
-		} else {
-			break;
 		}
-	}
-	for(x_node=obj->x_next; x_node != NULL; x_node=x_node->x_next) {
-		if (fabs(x_node->pos[0]-obj->pos[0]) <= view_size[0]) {
-			if (in_view(aoi,x_node->pos,obj->pos,view_size)) {
-				set_add(aoi,result,x_node);
+	} else if (v > node->pos) {
+		for (after=node; (next=after->next) != NULL; after=next) {
+			if (!node_before(next,v,node->rank)) {
+				break;
 			}
-		} else {
-			break;
+			if (++step > SKIP_WALK) {
+				after = NULL;
+				break;
+			}
+		}
+		if (after == node) {
+			after = node->prev;
 		}
+	} else {
+		return;
 	}
+	node->pos = v;
+	if (after == node->prev) {
+		return;
+	}
+	link_remove(aoi,node);
+	if (after == NULL) {
+		after = link_search(head,v,node->rank);
+	}
+	link_insert(aoi,after,node);
+}
+
+static inline float
+sentinel_pos(aoi_object *obj,int j) {
+	int i = j / 2;
+	return j % 2 == 0 ? obj->pos[i] - obj->view_size[i] : obj->pos[i] + obj->view_size[i];
 }
 
 static void
-enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
-	if (watcher->id == marker->id) {
-		return;
-	}
-	if (watcher->mode & MODE_WATCHER) {
-		aoi->cb_enterAOI(aoi->cb_ud,watcher->id,marker->id);
+sentinel_add(aoi_space *aoi,aoi_object *obj) {
+	int j;
+	aoi_node *sentinel = aoi->free_sentinels;
+	if (sentinel != NULL) {
+		aoi->free_sentinels = sentinel->next;
+	} else {
+		sentinel = aoi->alloc(aoi->alloc_ud,NULL,SENTINEL_NUMBER * sizeof(aoi_node));
+		memset(sentinel,0,SENTINEL_NUMBER * sizeof(aoi_node));
+		skip_alloc(aoi,sentinel,SENTINEL_NUMBER,false);
 	}
-	if (marker->mode & MODE_WATCHER) {
-		aoi->cb_enterAOI(aoi->cb_ud,marker->id,watcher->id);
+	for (j=0; j<SENTINEL_NUMBER; j++) {
+		aoi_node *node = &sentinel[j];
+		node->obj = obj;
+		node->rank = j % 2 == 0 ? RANK_LEFT : RANK_RIGHT;
+		node->pos = sentinel_pos(obj,j);
+		link_insert(aoi,link_search(list_head(aoi,j/2,true),node->pos,node->rank),node);
 	}
+	obj->sentinel = sentinel;
 }
 
 static void
-leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
-	if (watcher->id == marker->id) {
-		return;
+sentinel_remove(aoi_space *aoi,aoi_object *obj) {
+	int j;
+	for (j=0; j<SENTINEL_NUMBER; j++) {
+		link_remove(aoi,&obj->sentinel[j]);
 	}
-	if (watcher->mode & MODE_WATCHER) {
-		aoi->cb_leaveAOI(aoi->cb_ud,watcher->id,marker->id);
+	sentinel_free(aoi,obj);
+}
+
+// relink sentinels after position or view of obj changes
+static void
+sentinel_move(aoi_space *aoi,aoi_object *obj) {
+	int j;
+	for (j=0; j<SENTINEL_NUMBER; j++) {
+		link_move(aoi,list_head(aoi,j/2,true),&obj->sentinel[j],sentinel_pos(obj,j));
 	}
-	if (marker->mode & MODE_WATCHER) {
-		aoi->cb_leaveAOI(aoi->cb_ud,marker->id,watcher->id);
+}
+
+// pos2 is in the view of pos1,compared the same way as sentinels of pos1 are ordered
+static inline bool
+in_view(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		if (pos2[i] < pos1[i] - view_size[i] || pos2[i] > pos1[i] + view_size[i]) {
+			return false;
+		}
 	}
+	return true;
 }
 
+// view window around pos,widened by rounding error of in_view so that
+// it also holds everything whose view of the same size holds pos
+static inline void
+view_window(const float pos[3],const float view_size[3],float lo[3],float hi[3]) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		float slack = 2 * (fabsf(pos[i]) + 2 * view_size[i]) * FLT_EPSILON;
+		lo[i] = pos[i] - view_size[i] - slack;
+		hi[i] = pos[i] + view_size[i] + slack;
+	}
+}
 
-aoi_space *
-aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+static inline bool
+in_window(const float pos[3],const float lo[3],const float hi[3]) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		if (pos[i] < lo[i] || pos[i] > hi[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline int
+axis_bucket(aoi_space *aoi,int i,float v) {
+	int b = (int)(v / aoi->map_size[i] * AXIS_BUCKET);
+	return b < 0 ? 0 : (b >= AXIS_BUCKET ? AXIS_BUCKET-1 : b);
+}
+
+static void
+axis_count_move(aoi_space *aoi,const float *old_pos,const float *pos) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		int b1 = old_pos == NULL ? -1 : axis_bucket(aoi,i,old_pos[i]);
+		int b2 = pos == NULL ? -1 : axis_bucket(aoi,i,pos[i]);
+		if (b1 != b2) {
+			if (b1 >= 0) {
+				aoi->axis_count[i][b1]--;
+			}
+			if (b2 >= 0) {
+				aoi->axis_count[i][b2]++;
+			}
+		}
+	}
+}
+
+// estimated object number on axis i within [v1,v2]
+static float
+axis_estimate(aoi_space *aoi,int i,float v1,float v2) {
+	int b;
+	float width = aoi->map_size[i] / AXIS_BUCKET;
+	int b1 = axis_bucket(aoi,i,v1);
+	int b2 = axis_bucket(aoi,i,v2);
+	if (b1 == b2) {
+		return aoi->axis_count[i][b1] * (v2 - v1) / width;
+	}
+	float count = aoi->axis_count[i][b1] * ((b1 + 1) * width - v1) / width;
+	count += aoi->axis_count[i][b2] * (v2 - b2 * width) / width;
+	for (b=b1+1; b<b2; b++) {
+		count += aoi->axis_count[i][b];
+	}
+	return count;
+}
+
+// axis whose view window holds fewest objects,x wins ties
+static int
+view_axis(aoi_space *aoi,float pos[3],float view_size[3]) {
+	int i,b;
+	int best = 0;
+	int best_count = 0;
+	for (i=0; i<AOI_DIM; i++) {
+		int count = 0;
+		int b2 = axis_bucket(aoi,i,pos[i] + view_size[i]);
+		for (b=axis_bucket(aoi,i,pos[i] - view_size[i]); b<=b2; b++) {
+			count += aoi->axis_count[i][b];
+		}
+		if (i == 0 || count < best_count) {
+			best = i;
+			best_count = count;
+		}
+	}
+	return best;
+}
+
+static inline void
+scan_view(aoi_space *aoi,aoi_object *obj,float view_size[3],aoi_set *set,aoi_result *result) {
+	int i = view_axis(aoi,obj->pos,view_size);
+	aoi_node *head = list_head(aoi,i,false);
+	aoi_node *node;
+	float lo[3],hi[3];
+	view_window(obj->pos,view_size,lo,hi);
+	// objects go to set,their ids to result when set is NULL
+	for(node=obj->node[i].prev; node != head && node->pos >= lo[i]; node=node->prev) {
+		if (in_window(node->obj->pos,lo,hi)) {
+			if (set != NULL) {
+				set_add(aoi,set,node->obj);
+			} else {
+				result_add(result,node->obj->id);
+			}
+		}
+	}
+	for(node=obj->node[i].next; node != NULL && node->pos <= hi[i]; node=node->next) {
+		if (in_window(node->obj->pos,lo,hi)) {
+			if (set != NULL) {
+				set_add(aoi,set,node->obj);
+			} else {
+				result_add(result,node->obj->id);
+			}
+		}
+	}
+}
+
+static void
+get_view(aoi_space *aoi,aoi_object *obj,aoi_set *result,float view_size[3]) {
+	result->number = 0;
+	scan_view(aoi,obj,view_size,result,NULL);
+}
+
+static void
+event_grow(aoi_space *aoi) {
+	int cap = aoi->event_cap == 0 ? PRE_ALLOC : aoi->event_cap * 2;
+	aoi_event *events = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(aoi_event));
+	if (aoi->events != NULL) {
+		memcpy(events,aoi->events,aoi->event_number * sizeof(aoi_event));
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	aoi->events = events;
+	aoi->event_cap = cap;
+}
+
+static inline void
+event_push(aoi_space *aoi,uint32_t watcher,uint32_t marker,uint32_t type) {
+	if (aoi->event_number >= aoi->event_cap) {
+		event_grow(aoi);
+	}
+	aoi_event *ev = &aoi->events[aoi->event_number++];
+	ev->watcher = watcher;
+	ev->marker = marker;
+	ev->type = type;
+}
+
+static inline void
+emit_enter(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_ENTER);
+	} else {
+		aoi->cb_enterAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+static inline void
+emit_leave(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_LEAVE);
+	} else {
+		aoi->cb_leaveAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+// each side only sees the other one within its own view
+static void
+enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	if ((watcher->mode & MODE_WATCHER) && in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_enter(aoi,watcher->id,marker->id);
+	}
+	if ((marker->mode & MODE_WATCHER) && in_view(aoi,marker->pos,watcher->pos,marker->view_size)) {
+		emit_enter(aoi,marker->id,watcher->id);
+	}
+}
+
+static int
+linger_find(aoi_object *watcher,uint32_t id) {
+	int i;
+	for (i=0; i<watcher->linger_number; i++) {
+		if (watcher->linger[i] == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void
+linger_add(aoi_space *aoi,aoi_object *watcher,uint32_t id) {
+	if (watcher->linger_number >= watcher->linger_cap) {
+		int cap = watcher->linger_cap == 0 ? 4 : watcher->linger_cap * 2;
+		uint32_t *linger = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+		if (watcher->linger != NULL) {
+			memcpy(linger,watcher->linger,watcher->linger_number * sizeof(uint32_t));
+			aoi->alloc(aoi->alloc_ud,watcher->linger,watcher->linger_cap * sizeof(uint32_t));
+		}
+		watcher->linger = linger;
+		watcher->linger_cap = cap;
+	}
+	watcher->linger[watcher->linger_number++] = id;
+}
+
+static inline void
+linger_remove(aoi_object *watcher,int index) {
+	watcher->linger[index] = watcher->linger[--watcher->linger_number];
+}
+
+static void
+linger_stats(void *ud,aoi_object *obj) {
+	aoi_memory *stats = ud;
+	stats->object_bytes += obj->linger_cap * sizeof(uint32_t);
+}
+
+// pos2 is within hysteresis beyond the view of pos1
+static inline bool
+in_margin(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	float margin[3];
+	for (i=0; i<3; i++) {
+		margin[i] = view_size[i] + aoi->hysteresis;
+	}
+	return in_view(aoi,pos1,pos2,margin);
+}
+
+// window holding every object whose seen state may change
+static inline void
+margin_window(aoi_space *aoi,const float view_size[3],float window[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		window[i] = view_size[i] + aoi->hysteresis;
+	}
+}
+
+// one of them leaves the space,a lingering marker is released too
+static void
+leave_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (!(watcher->mode & MODE_WATCHER)) {
+		return;
+	}
+	int index = linger_find(watcher,marker->id);
+	if (index >= 0) {
+		linger_remove(watcher,index);
+		emit_leave(aoi,watcher->id,marker->id);
+	} else if (in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+static void
+leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	leave_notify(aoi,watcher,marker);
+	leave_notify(aoi,marker,watcher);
+}
+
+// marker at pos2 was within the view of watcher at pos1,or is still seen beyond it
+static inline bool
+view_seen(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	return in_view(aoi,pos1,pos2,view_size) || linger_find(watcher,marker->id) >= 0;
+}
+
+// before tells if watcher saw marker,the view is checked again from pos1 to pos2.
+// a seen marker out of the view is kept until it passes the hysteresis
+static void
+view_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,bool before,const float pos1[3],const float pos2[3]) {
+	bool after = in_view(aoi,pos1,pos2,watcher->view_size);
+	if (before && aoi->hysteresis > 0) {
+		int index = linger_find(watcher,marker->id);
+		if (!after && in_margin(aoi,pos1,pos2,watcher->view_size)) {
+			after = true;
+			if (index < 0) {
+				linger_add(aoi,watcher,marker->id);
+			}
+		} else if (index >= 0) {
+			linger_remove(watcher,index);
+		}
+	}
+	if (!before && after) {
+		emit_enter(aoi,watcher->id,marker->id);
+	} else if (before && !after) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+// obj moved from old_pos,check both directions
+static void
+moveAOI(aoi_space *aoi,aoi_object *obj,aoi_object *other,float old_pos[3]) {
+	if (obj->id == other->id) {
+		return;
+	}
+	if (obj->mode & MODE_WATCHER) {
+		view_notify(aoi,obj,other,
+			view_seen(aoi,obj,other,old_pos,other->pos,obj->view_size),
+			obj->pos,other->pos);
+	}
+	if (other->mode & MODE_WATCHER) {
+		view_notify(aoi,other,obj,
+			view_seen(aoi,other,obj,other->pos,old_pos,other->view_size),
+			other->pos,obj->pos);
+	}
+}
+
+
+aoi_space *
+aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
 	aoi_space *aoi = alloc(alloc_ud,NULL,sizeof(*aoi));
 	aoi->alloc = alloc;
 	aoi->alloc_ud = alloc_ud;
+	aoi->slab = NULL;
+	aoi->free_objects = NULL;
+	aoi->free_sentinels = NULL;
 	memcpy(aoi->map_size,map_size,3*sizeof(float));
 	memcpy(aoi->view_size,view_size,3*sizeof(float));
+	memcpy(aoi->max_view,view_size,3*sizeof(float));
+	aoi->custom_view_number = 0;
+	aoi->hysteresis = 0;
+	aoi->seed = 2463534242u;
+	aoi->stamp = 0;
+	memset(aoi->axis_count,0,sizeof(aoi->axis_count));
 	aoi->origin = new_object(aoi,INVALID_ID);
+	aoi->sentinel_origin = new_object(aoi,INVALID_ID);
 	aoi->objects = map_new(aoi);
 	aoi->set1 = set_new(aoi);
 	aoi->set2 = set_new(aoi);
 	aoi->result_set = set_new(aoi);
+	aoi->batch = NULL;
+	aoi->batch_cap = 0;
 	aoi->cb_enterAOI = cb_enterAOI;
 	aoi->cb_leaveAOI = cb_leaveAOI;
 	aoi->cb_ud = cb_ud;
+	assert((cb_enterAOI == NULL) == (cb_leaveAOI == NULL));
+	aoi->events = NULL;
+	aoi->event_number = 0;
+	aoi->event_cap = 0;
+	aoi->buffered = cb_enterAOI == NULL;
+	aoi->defer = false;
+	aoi->pending_ids = NULL;
+	aoi->pending_pos = NULL;
+	aoi->pending_number = 0;
+	aoi->pending_cap = 0;
 	return aoi;
 }
 
@@ -528,12 +1306,32 @@ aoi_release(aoi_space *aoi) {
 	set_delete(aoi,aoi->set1);
 	set_delete(aoi,aoi->set2);
 	set_delete(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
 	delete_object(aoi,aoi->origin);
+	delete_object(aoi,aoi->sentinel_origin);
 	map_foreach(aoi->objects,delete_object,aoi);
 	map_delete(aoi,aoi->objects);
+	pool_delete(aoi);
+	slab_delete(aoi);
+	if (aoi->events != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	if (aoi->pending_ids != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+	}
 	aoi->alloc(aoi->alloc_ud,aoi,sizeof(*aoi));
 }
 
+aoi_event *
+aoi_poll_events(aoi_space *aoi,int *number) {
+	*number = aoi->event_number;
+	aoi->event_number = 0;
+	return aoi->events;
+}
+
 static bool
 change_mode(aoi_object *obj,const char *modestring) {
 	int i;
@@ -578,8 +1376,31 @@ change_mode(aoi_object *obj,const char *modestring) {
 }
 
 
+static void
+custom_view_remove(aoi_space *aoi) {
+	aoi->custom_view_number--;
+	if (aoi->custom_view_number == 0) {
+		// max view only shrinks when all custom views are gone
+		copy_position(aoi->max_view,aoi->view_size);
+	}
+}
+
+void
+aoi_set_dense_id(aoi_space *aoi,uint32_t max_id) {
+	map_set_dense(aoi,aoi->objects,max_id);
+}
+
+void
+aoi_set_hysteresis(aoi_space *aoi,float margin) {
+	assert(margin >= 0);
+	aoi->hysteresis = margin;
+}
+
 void
 aoi_enter(aoi_space *aoi,uint32_t id,float pos[3],const char *modestring) {
+	if (aoi->objects->max_id != 0 && id >= aoi->objects->max_id) {
+		return;
+	}
 	aoi_object *old_obj = get_object(aoi,id);
 	if (old_obj != NULL) {
 		aoi_leave(aoi,id);
@@ -588,126 +1409,463 @@ aoi_enter(aoi_space *aoi,uint32_t id,float pos[3],const char *modestring) {
 	aoi_object *obj = new_object(aoi,id);
 	change_mode(obj,modestring);
 	copy_position(obj->pos,pos);
+	copy_position(obj->view_size,aoi->view_size);
 	map_insert(aoi,aoi->objects,obj->id,obj);
 	link_insert_by_pos(aoi,obj);
-	get_view(aoi,obj,aoi->result_set,aoi->view_size);
+	if (obj->mode & MODE_WATCHER) {
+		sentinel_add(aoi,obj);
+	}
+	axis_count_move(aoi,NULL,obj->pos);
+	get_view(aoi,obj,aoi->result_set,aoi->max_view);
 	for(i=0; i<aoi->result_set->number; i++) {
 		aoi_object *temp = aoi->result_set->slot[i];
 		enterAOI(aoi,obj,temp);
 	}
 }
 
+static void
+pending_add(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	if (obj->pending_index < 0) {
+		if (aoi->pending_number >= aoi->pending_cap) {
+			int cap = aoi->pending_cap == 0 ? PRE_ALLOC : aoi->pending_cap * 2;
+			uint32_t *ids = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+			float (*pos)[3] = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(float[3]));
+			if (aoi->pending_ids != NULL) {
+				memcpy(ids,aoi->pending_ids,aoi->pending_number * sizeof(uint32_t));
+				memcpy(pos,aoi->pending_pos,aoi->pending_number * sizeof(float[3]));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+			}
+			aoi->pending_ids = ids;
+			aoi->pending_pos = pos;
+			aoi->pending_cap = cap;
+		}
+		obj->pending_index = aoi->pending_number++;
+		aoi->pending_ids[obj->pending_index] = obj->id;
+	}
+	copy_position(aoi->pending_pos[obj->pending_index],pos);
+}
+
+static void
+pending_remove(aoi_space *aoi,aoi_object *obj) {
+	int index = obj->pending_index;
+	if (index < 0) {
+		return;
+	}
+	int last = --aoi->pending_number;
+	if (index != last) {
+		aoi->pending_ids[index] = aoi->pending_ids[last];
+		copy_position(aoi->pending_pos[index],aoi->pending_pos[last]);
+		get_object(aoi,aoi->pending_ids[index])->pending_index = index;
+	}
+	obj->pending_index = -1;
+}
+
 void
 aoi_leave(aoi_space *aoi,uint32_t id) {
 	aoi_object *obj = get_object(aoi,id);
 	if (obj == NULL) {
 		return;
 	}
+	pending_remove(aoi,obj);
 	int i;
-	get_view(aoi,obj,aoi->result_set,aoi->view_size);
+	float window[3];
+	margin_window(aoi,aoi->max_view,window);
+	get_view(aoi,obj,aoi->result_set,window);
 	for(i=0; i<aoi->result_set->number; i++) {
 		aoi_object *temp = aoi->result_set->slot[i];
 		leaveAOI(aoi,obj,temp);
 	}
-	link_remove(aoi,'x',obj);
-	link_remove(aoi,'y',obj);
-	link_remove(aoi,'z',obj);
-	map_remove(aoi->objects,id);
+	if (obj->custom_view) {
+		custom_view_remove(aoi);
+	}
+	for (i=0; i<AOI_DIM; i++) {
+		link_remove(aoi,&obj->node[i]);
+	}
+	if (obj->sentinel != NULL) {
+		sentinel_remove(aoi,obj);
+	}
+	axis_count_move(aoi,obj->pos,NULL);
+	map_remove(aoi,aoi->objects,id);
 	delete_object(aoi,obj);
 }
 
-void
-aoi_move(aoi_space *aoi,uint32_t id,float pos[3]) {
-	aoi_object *obj = get_object(aoi,id);
-	if (obj == NULL) {
-		return;
+// node of axis i moves from v1 to v2,nodes of the other list it passes are
+// objects passed by a sentinel or sentinels passed by an object.
+// ranks never tie between the two lists,so these are exactly the nodes whose
+// order with node is changed
+static void
+pass_range(aoi_space *aoi,int i,aoi_node *node,float v1,float v2) {
+	aoi_node *other;
+	if (v1 > v2) {
+		float v = v1;
+		v1 = v2;
+		v2 = v;
+	}
+	other = link_search(list_head(aoi,i,node->rank == RANK_OBJECT),v1,node->rank)->next;
+	for (; other != NULL && node_before(other,v2,node->rank); other=other->next) {
+		aoi_object *obj = other->obj;
+		if (obj->stamp != aoi->stamp) {
+			obj->stamp = aoi->stamp;
+			set_add(aoi,aoi->set1,obj);
+		}
+	}
+}
+
+// move node of axis i to v
+static void
+node_move(aoi_space *aoi,int i,aoi_node *node,float v) {
+	pass_range(aoi,i,node,node->pos,v);
+	link_move(aoi,list_head(aoi,i,node->rank != RANK_OBJECT),node,v);
+}
+
+// walking costs the nodes between old and new position,comparing views
+// costs two sweeps over the view window
+static bool
+move_walk(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	int i;
+	float walk = 0;
+	float sweep = 0;
+	// sentinels only mark the view,a lingering marker leaves beyond them
+	if (aoi->hysteresis > 0) {
+		return false;
+	}
+	for (i=0; i<AOI_DIM; i++) {
+		float window = axis_estimate(aoi,i,obj->pos[i]-aoi->max_view[i],obj->pos[i]+aoi->max_view[i]);
+		walk += axis_estimate(aoi,i,fmin(obj->pos[i],pos[i]),fmax(obj->pos[i],pos[i]));
+		if (i == 0 || window < sweep) {
+			sweep = window;
+		}
+	}
+	// obj passes sentinels of both sides,its sentinels pass objects
+	walk *= obj->sentinel != NULL ? 4 : 2;
+	return walk <= 2 * sweep;
+}
+
+static void
+move_relink(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		link_move(aoi,list_head(aoi,i,false),&obj->node[i],pos[i]);
+	}
+	axis_count_move(aoi,obj->pos,pos);
+	copy_position(obj->pos,pos);
+	if (obj->sentinel != NULL) {
+		sentinel_move(aoi,obj);
+	}
+}
+
+// hull of the windows around old and new position,others may see obj with a bigger view
+static void
+move_window(aoi_space *aoi,const float old_pos[3],const float pos[3],float lo[3],float hi[3]) {
+	int i;
+	float window[3];
+	float lo2[3],hi2[3];
+	margin_window(aoi,aoi->max_view,window);
+	view_window(old_pos,window,lo,hi);
+	view_window(pos,window,lo2,hi2);
+	for (i=0; i<3; i++) {
+		lo[i] = fmin(lo[i],lo2[i]);
+		hi[i] = fmax(hi[i],hi2[i]);
 	}
+}
+
+static void
+move_object(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
 	if (memcmp(obj->pos,pos,3*sizeof(float)) == 0) {
 		return;
 	}
 	int i;
-	aoi_object *prev,*next;
-	get_view(aoi,obj,aoi->set1,aoi->view_size);
-	// x direction
-	if (pos[0] < obj->pos[0]) {
-		for (prev=obj->x_prev; prev != aoi->origin; prev=prev->x_prev) {
-			if (prev->pos[0] < pos[0]) {
-				break;
+	float old_pos[3];
+	float window[3];
+	copy_position(old_pos,obj->pos);
+	if (move_walk(aoi,obj,pos)) {
+		// a view changes only when obj passes a sentinel or its sentinels pass an object
+		stamp_next(aoi);
+		aoi->set1->number = 0;
+		for (i=0; i<AOI_DIM; i++) {
+			if (pos[i] == obj->pos[i]) {
+				continue;
+			}
+			node_move(aoi,i,&obj->node[i],pos[i]);
+			obj->pos[i] = pos[i];
+			if (obj->sentinel != NULL) {
+				node_move(aoi,i,&obj->sentinel[2*i],sentinel_pos(obj,2*i));
+				node_move(aoi,i,&obj->sentinel[2*i+1],sentinel_pos(obj,2*i+1));
 			}
 		}
-		if (prev != obj->x_prev) {
-			link_remove(aoi,'x',obj);
-			link_insert(aoi,'x',prev,obj);
+		copy_position(obj->pos,pos);
+		axis_count_move(aoi,old_pos,obj->pos);
+		for(i=0; i<aoi->set1->number; i++) {
+			aoi_object *temp = aoi->set1->slot[i];
+			moveAOI(aoi,obj,temp,old_pos);
 		}
-	} else if(pos[0] > obj->pos[0]) {
-		for (next=obj; next->x_next != NULL; next=next->x_next) {
-			if (next->x_next->pos[0] >= pos[0]) {
-				break;
-			}
+		return;
+	}
+	// others may see obj with a bigger view
+	margin_window(aoi,aoi->max_view,window);
+	get_view(aoi,obj,aoi->set1,window);
+	move_relink(aoi,obj,pos);
+	get_view(aoi,obj,aoi->set2,window);
+	for(i=0; i<aoi->set2->number; i++) {
+		aoi_object *temp = aoi->set2->slot[i];
+		moveAOI(aoi,obj,temp,old_pos);
+	}
+	// out of the window now
+	set_difference(aoi,aoi->set1,aoi->set2,aoi->result_set);
+	for(i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		moveAOI(aoi,obj,temp,old_pos);
+	}
+}
+
+// objects within [lo,hi] go to set
+static void
+window_scan(aoi_space *aoi,const float lo[3],const float hi[3],aoi_set *set) {
+	int i;
+	float pos[3],size[3];
+	aoi_node *node;
+	for (i=0; i<3; i++) {
+		pos[i] = (lo[i] + hi[i]) / 2;
+		size[i] = (hi[i] - lo[i]) / 2;
+	}
+	i = view_axis(aoi,pos,size);
+	set->number = 0;
+	node = link_search(list_head(aoi,i,false),lo[i],RANK_LEFT)->next;
+	for (; node != NULL && node->pos <= hi[i]; node=node->next) {
+		if (in_window(node->obj->pos,lo,hi)) {
+			set_add(aoi,set,node->obj);
 		}
-		if (next != obj) {
-			link_remove(aoi,'x',obj);
-			link_insert(aoi,'x',next,obj);
+	}
+}
+
+// moves of a group scan their windows,all within [lo,hi]. objects there are
+// scanned once,others moving in the group are found at old or new position
+static void
+move_group(aoi_space *aoi,aoi_batch_move *group,int number,const float lo[3],const float hi[3]) {
+	int i,j;
+	aoi_set *set = aoi->set2;
+	window_scan(aoi,lo,hi,set);
+	for (i=0; i<number; i++) {
+		aoi_object *obj = group[i].obj;
+		float old_pos[3],lo1[3],hi1[3];
+		move_window(aoi,obj->pos,group[i].pos,lo1,hi1);
+		copy_position(old_pos,obj->pos);
+		move_relink(aoi,obj,group[i].pos);
+		for (j=0; j<set->number; j++) {
+			aoi_object *temp = set->slot[j];
+			if (in_window(temp->pos,lo1,hi1)) {
+				moveAOI(aoi,obj,temp,old_pos);
+			}
 		}
 	}
-	// y direction
-	if (pos[1] < obj->pos[1]) {
-		for (prev=obj->y_prev; prev != aoi->origin; prev=prev->y_prev) {
-			if (prev->pos[1] < pos[1]) {
-				break;
+}
+
+void
+aoi_move(aoi_space *aoi,uint32_t id,float pos[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	if (aoi->defer) {
+		pending_add(aoi,obj,pos);
+		return;
+	}
+	move_object(aoi,obj,pos);
+}
+
+static int
+batch_compare(const void *a,const void *b) {
+	const aoi_batch_move *m1 = a;
+	const aoi_batch_move *m2 = b;
+	if (m1->obj->pos[0] != m2->obj->pos[0]) {
+		return m1->obj->pos[0] < m2->obj->pos[0] ? -1 : 1;
+	}
+	return 0;
+}
+
+void
+aoi_move_batch(aoi_space *aoi,const uint32_t *ids,const float (*pos)[3],int n) {
+	int i,j,k;
+	int number = 0;
+	float window[3];
+	float lo[3],hi[3],lo1[3],hi1[3];
+	if (n <= 0) {
+		return;
+	}
+	if (aoi->defer) {
+		for (i=0; i<n; i++) {
+			aoi_object *obj = get_object(aoi,ids[i]);
+			if (obj != NULL) {
+				pending_add(aoi,obj,pos[i]);
 			}
 		}
-		if (prev != obj->y_prev) {
-			link_remove(aoi,'y',obj);
-			link_insert(aoi,'y',prev,obj);
+		return;
+	}
+	if (n > aoi->batch_cap) {
+		if (aoi->batch != NULL) {
+			aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
 		}
-	} else if(pos[1] > obj->pos[1]) {
-		for (next=obj; next->y_next != NULL; next=next->y_next) {
-			if (next->y_next->pos[1] >= pos[1]) {
-				break;
-			}
+		aoi->batch_cap = n;
+		aoi->batch = aoi->alloc(aoi->alloc_ud,NULL,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	// the last position of an object wins
+	for (i=0; i<n; i++) {
+		aoi_object *obj = get_object(aoi,ids[i]);
+		if (obj == NULL) {
+			continue;
 		}
-		if (next != obj) {
-			link_remove(aoi,'y',obj);
-			link_insert(aoi,'y',next,obj);
+		aoi_batch_move *m;
+		if (obj->batch_index >= 0) {
+			m = &aoi->batch[obj->batch_index];
+		} else {
+			obj->batch_index = number;
+			m = &aoi->batch[number++];
+			m->obj = obj;
 		}
+		copy_position(m->pos,pos[i]);
+	}
+	for (i=0; i<number; i++) {
+		aoi->batch[i].obj->batch_index = -1;
 	}
-	// z direction
-	if (pos[2] < obj->pos[2]) {
-		for (prev=obj->z_prev; prev != aoi->origin; prev=prev->z_prev) {
-			if (prev->pos[2] < pos[2]) {
+	// neighbours in x list move one after another,list walks stay in cache
+	qsort(aoi->batch,number,sizeof(aoi_batch_move),batch_compare);
+	margin_window(aoi,aoi->max_view,window);
+	for (i=0; i<number; i=j) {
+		aoi_batch_move *m = &aoi->batch[i];
+		j = i + 1;
+		if (memcmp(m->obj->pos,m->pos,3*sizeof(float)) == 0 || move_walk(aoi,m->obj,m->pos)) {
+			move_object(aoi,m->obj,m->pos);
+			continue;
+		}
+		// following moves scanning their windows nearby join the group
+		move_window(aoi,m->obj->pos,m->pos,lo,hi);
+		for (; j<number; j++) {
+			m = &aoi->batch[j];
+			if (move_walk(aoi,m->obj,m->pos)) {
 				break;
 			}
-		}
-		if (prev != obj->z_prev) {
-			link_remove(aoi,'z',obj);
-			link_insert(aoi,'z',prev,obj);
-		}
-	} else if(pos[2] > obj->pos[2]) {
-		for (next=obj; next->z_next != NULL; next=next->z_next) {
-			if (next->z_next->pos[2] >= pos[2]) {
+			move_window(aoi,m->obj->pos,m->pos,lo1,hi1);
+			for (k=0; k<AOI_DIM; k++) {
+				if (fmax(hi[k],hi1[k]) - fmin(lo[k],lo1[k]) > 2 * GROUP_SPAN * window[k]) {
+					break;
+				}
+			}
+			if (k < AOI_DIM) {
 				break;
 			}
+			for (k=0; k<AOI_DIM; k++) {
+				lo[k] = fmin(lo[k],lo1[k]);
+				hi[k] = fmax(hi[k],hi1[k]);
+			}
 		}
-		if (next != obj) {
-			link_remove(aoi,'z',obj);
-			link_insert(aoi,'z',next,obj);
+		if (j - i == 1) {
+			move_object(aoi,aoi->batch[i].obj,aoi->batch[i].pos);
+		} else {
+			move_group(aoi,&aoi->batch[i],j - i,lo,hi);
 		}
 	}
+}
 
-	copy_position(obj->pos,pos);
-	get_view(aoi,obj,aoi->set2,aoi->view_size);
-	// enter aoi
-	set_difference(aoi,aoi->set2,aoi->set1,aoi->result_set);
-	for(i=0; i<aoi->result_set->number; i++) {
-		aoi_object *temp = aoi->result_set->slot[i];
-		enterAOI(aoi,obj,temp);
+// while coalescing,type holds the production index above the enter bit
+static int
+event_compare(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->watcher != ev2->watcher) {
+		return ev1->watcher < ev2->watcher ? -1 : 1;
 	}
-	// leave aoi
-	set_difference(aoi,aoi->set1,aoi->set2,aoi->result_set);
-	for(i=0; i<aoi->result_set->number; i++) {
-		aoi_object *temp = aoi->result_set->slot[i];
-		leaveAOI(aoi,obj,temp);
+	if (ev1->marker != ev2->marker) {
+		return ev1->marker < ev2->marker ? -1 : 1;
+	}
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+event_order(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+// events of a pair alternate,so only the last one of each pair with a net change is kept,
+// the kept events are put back in production order
+static void
+event_coalesce(aoi_space *aoi,int start) {
+	int i,j;
+	int n = 0;
+	aoi_event *events = aoi->events + start;
+	int number = aoi->event_number - start;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		events[i].type = (uint32_t)i << 1 | (events[i].type == AOI_EVENT_ENTER);
+	}
+	qsort(events,number,sizeof(aoi_event),event_compare);
+	for (i=0; i<number; i=j) {
+		int net = 0;
+		for (j=i; j<number && events[j].watcher == events[i].watcher && events[j].marker == events[i].marker; j++) {
+			net += (events[j].type & 1) ? 1 : -1;
+		}
+		assert(net >= -1 && net <= 1);
+		if (net != 0) {
+			assert((events[j-1].type & 1) == (net > 0));
+			events[n++] = events[j-1];
+		}
+	}
+	if (n > 0) {
+		qsort(events,n,sizeof(aoi_event),event_order);
+	}
+	for (i=0; i<n; i++) {
+		events[i].type = (events[i].type & 1) ? AOI_EVENT_ENTER : AOI_EVENT_LEAVE;
+	}
+	aoi->event_number = start + n;
+}
+
+void
+aoi_set_defer(aoi_space *aoi,int defer) {
+	if (!defer) {
+		aoi_update(aoi);
+	}
+	aoi->defer = defer != 0;
+}
+
+void
+aoi_update(aoi_space *aoi) {
+	int i;
+	int number = aoi->pending_number;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		get_object(aoi,aoi->pending_ids[i])->pending_index = -1;
+	}
+	aoi->pending_number = 0;
+	int start = aoi->event_number;
+	bool buffered = aoi->buffered;
+	aoi->buffered = true;
+	aoi->defer = false;
+	aoi_move_batch(aoi,aoi->pending_ids,(const float (*)[3])aoi->pending_pos,number);
+	aoi->defer = true;
+	aoi->buffered = buffered;
+	event_coalesce(aoi,start);
+	if (!buffered) {
+		for (i=start; i<aoi->event_number; i++) {
+			aoi_event *ev = &aoi->events[i];
+			if (ev->type == AOI_EVENT_ENTER) {
+				aoi->cb_enterAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			} else {
+				aoi->cb_leaveAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			}
+		}
+		aoi->event_number = start;
 	}
 }
 
@@ -722,42 +1880,90 @@ aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring) {
 	bool is_watcher = obj->mode & MODE_WATCHER;
 	if (is_marker && is_watcher) {
 		int i;
-		get_view(aoi,obj,aoi->result_set,aoi->view_size);
+		sentinel_add(aoi,obj);
+		get_view(aoi,obj,aoi->result_set,obj->view_size);
 		for(i=0; i<aoi->result_set->number; i++) {
 			aoi_object *temp = aoi->result_set->slot[i];
 			if (obj->id == temp->id) {
 				continue;
 			}
-			if (obj->mode & MODE_WATCHER) {
-				aoi->cb_enterAOI(aoi->cb_ud,obj->id,temp->id);
+			if (in_view(aoi,obj->pos,temp->pos,obj->view_size)) {
+				emit_enter(aoi,obj->id,temp->id);
 			}
 		}
+	} else if (!is_marker && !is_watcher) {
+		sentinel_remove(aoi,obj);
+		obj->linger_number = 0;
 	}
 }
 
-void **
-aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
-	aoi_object *origin = aoi->origin;
-	aoi_object *x_node;
-	aoi_set *result = aoi->result_set;
-	bool enter_view = false;
+void
+aoi_set_view_range(aoi_space *aoi,uint32_t id,float range[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	int i;
+	float old_view[3];
+	float window[3];
+	copy_position(old_view,obj->view_size);
+	if (range != NULL) {
+		copy_position(obj->view_size,range);
+		if (!obj->custom_view) {
+			obj->custom_view = true;
+			aoi->custom_view_number++;
+		}
+		for (i=0; i<3; i++) {
+			aoi->max_view[i] = fmax(aoi->max_view[i],range[i]);
+		}
+	} else {
+		copy_position(obj->view_size,aoi->view_size);
+		if (obj->custom_view) {
+			obj->custom_view = false;
+			custom_view_remove(aoi);
+		}
+	}
+	if (!(obj->mode & MODE_WATCHER)) {
+		return;
+	}
+	sentinel_move(aoi,obj);
+	// only the view of obj changes,others still see obj with their own view
+	for (i=0; i<3; i++) {
+		window[i] = fmax(old_view[i],obj->view_size[i]) + aoi->hysteresis;
+	}
+	get_view(aoi,obj,aoi->result_set,window);
+	for (i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		if (obj->id != temp->id) {
+			view_notify(aoi,obj,temp,
+				view_seen(aoi,obj,temp,obj->pos,temp->pos,old_view),
+				obj->pos,temp->pos);
+		}
+	}
+}
+
+static void
+query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],aoi_set *set,aoi_result *result) {
+	aoi_node *node;
 	float *view_size = aoi->view_size;
 	if (range != NULL) {
 		view_size = range;
 	}
-	result->number = 0;
-	for(x_node=origin->x_next; x_node != origin; x_node=x_node->x_next) {
-		if (fabs(x_node->pos[0]-pos[0]) <= view_size[0]) {
-			if (in_view(aoi,x_node->pos,pos,view_size)) {
-				set_add(aoi,result,(void*)x_node->id);
-			}
-			enter_view = true;
-		} else {
-			if (enter_view) {
-				break;
-			}
+	// search the skip list of the axis holding fewest objects in the range for its first node,O(log n + k)
+	int i = view_axis(aoi,pos,view_size);
+	node = link_search(list_head(aoi,i,false),pos[i] - view_size[i],RANK_LEFT)->next;
+	for (; node != NULL && node->pos <= pos[i] + view_size[i]; node=node->next) {
+		if (in_view(aoi,pos,node->obj->pos,view_size)) {
+			query_add(aoi,set,result,node->obj->id);
 		}
 	}
+}
+
+void **
+aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
+	aoi_set *result = aoi->result_set;
+	result->number = 0;
+	query_view_by_pos(aoi,pos,range,result,NULL);
 	*number = result->number;
 	return result->slot;
 }
@@ -772,15 +1978,123 @@ aoi_get_view(aoi_space *aoi,uint32_t id,float range[3],int *number) {
 	//return aoi_get_view_by_pos(aoi,obj->pos,range,number);
 	int i;
 	if (range == NULL) {
-		get_view(aoi,obj,aoi->set1,aoi->view_size);
+		get_view(aoi,obj,aoi->set1,obj->view_size);
 	} else {
 		get_view(aoi,obj,aoi->set1,range);
 	}
 	aoi->result_set->number = 0;
 	for (i=0; i<aoi->set1->number; i++) {
-		obj = aoi->set1->slot[i];
-		set_add(aoi,aoi->result_set,(void*)obj->id);
+		aoi_object *temp = aoi->set1->slot[i];
+		set_add(aoi,aoi->result_set,(void*)temp->id);
+	}
+	if (range == NULL) {
+		// markers still seen beyond the view
+		for (i=0; i<obj->linger_number; i++) {
+			set_add(aoi,aoi->result_set,(void*)obj->linger[i]);
+		}
 	}
 	*number = aoi->result_set->number;
 	return aoi->result_set->slot;
 }
+
+int
+aoi_query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],uint32_t *ids,int cap) {
+	aoi_result result = {ids,cap,0};
+	query_view_by_pos(aoi,pos,range,NULL,&result);
+	return result.number;
+}
+
+int
+aoi_query_view(aoi_space *aoi,uint32_t id,float range[3],uint32_t *ids,int cap) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return 0;
+	}
+	int i;
+	aoi_result result = {ids,cap,0};
+	if (range != NULL) {
+		scan_view(aoi,obj,range,NULL,&result);
+		return result.number;
+	}
+	scan_view(aoi,obj,obj->view_size,NULL,&result);
+	for (i=0; i<obj->linger_number; i++) {
+		result_add(&result,obj->linger[i]);
+	}
+	return result.number;
+}
+
+void
+aoi_memory_stats(aoi_space *aoi,aoi_memory *stats) {
+	int i;
+	aoi_slab *slab;
+	aoi_node *sentinel;
+	memset(stats,0,sizeof(*stats));
+	stats->object_number = aoi->objects->number;
+	map_stats(aoi->objects,stats);
+	map_foreach(aoi->objects,linger_stats,stats);
+	// lists of objects and sentinels on each axis
+	stats->index_number = 2 * AOI_DIM;
+	stats->index_used = aoi->objects->number * AOI_DIM;
+	for (slab=aoi->slab; slab != NULL; slab=slab->next) {
+		stats->object_cap += SLAB_OBJECT;
+		stats->object_bytes += sizeof(aoi_slab);
+		for (i=0; i<SLAB_OBJECT; i++) {
+			aoi_object *obj = &slab->obj[i];
+			// a used object keeps its skip block in the free list
+			if (obj->node[0].obj == NULL) {
+				continue;
+			}
+			stats->index_bytes += skip_bytes(obj->node,AOI_DIM);
+			if (obj != aoi->origin && obj != aoi->sentinel_origin) {
+				stats->index_cap += AOI_DIM;
+			}
+			if (obj->sentinel != NULL) {
+				stats->index_used += SENTINEL_NUMBER;
+				stats->index_cap += SENTINEL_NUMBER;
+				stats->index_bytes += SENTINEL_NUMBER * sizeof(aoi_node) + skip_bytes(obj->sentinel,SENTINEL_NUMBER);
+			}
+		}
+	}
+	for (sentinel=aoi->free_sentinels; sentinel != NULL; sentinel=sentinel->next) {
+		stats->index_cap += SENTINEL_NUMBER;
+		stats->index_bytes += SENTINEL_NUMBER * sizeof(aoi_node) + skip_bytes(sentinel,SENTINEL_NUMBER);
+	}
+	set_stats(aoi->set1,stats);
+	set_stats(aoi->set2,stats);
+	set_stats(aoi->result_set,stats);
+	stats->buffer_bytes = aoi->event_cap * sizeof(aoi_event)
+		+ aoi->pending_cap * (sizeof(uint32_t) + sizeof(float[3]))
+		+ aoi->batch_cap * sizeof(aoi_batch_move);
+	stats->total = sizeof(*aoi) + stats->object_bytes + stats->map_bytes + stats->index_bytes
+		+ stats->set_bytes + stats->buffer_bytes;
+}
+
+void
+aoi_compact(aoi_space *aoi) {
+	sentinel_pool_delete(aoi);
+	// scratch sets are only used within a call
+	aoi->set1->number = 0;
+	aoi->set2->number = 0;
+	aoi->result_set->number = 0;
+	set_shrink(aoi,aoi->set1);
+	set_shrink(aoi,aoi->set2);
+	set_shrink(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		aoi->batch = NULL;
+		aoi->batch_cap = 0;
+	}
+	if (aoi->events != NULL && aoi->event_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+		aoi->events = NULL;
+		aoi->event_cap = 0;
+	}
+	if (aoi->pending_ids != NULL && aoi->pending_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+		aoi->pending_ids = NULL;
+		aoi->pending_pos = NULL;
+		aoi->pending_cap = 0;
+	}
+	slab_compact(aoi);
+}
@@ -12,6 +12,34 @@ typedef void * (*aoi_Alloc)(void *ud, void * ptr, size_t sz);
 typedef void (*enterAOI_Callback)(void *ud,uint32_t watcher, uint32_t marker);
 typedef void (*leaveAOI_Callback)(void *ud,uint32_t watcher, uint32_t marker);
 
+#define AOI_EVENT_ENTER 1
+#define AOI_EVENT_LEAVE 2
+
+typedef struct aoi_event {
+	uint32_t watcher;
+	uint32_t marker;
+	uint32_t type;	// AOI_EVENT_ENTER or AOI_EVENT_LEAVE
+} aoi_event;
+
+// bytes are held through aoi_Alloc,total also counts the space itself
+typedef struct aoi_memory {
+	size_t total;
+	int object_number;	// objects in the space
+	int object_cap;	// objects carved from slabs,free ones included
+	size_t object_bytes;
+	int map_number;	// ids in the object map
+	int map_cap;	// slots of the object map,load factor is map_number/map_cap
+	size_t map_bytes;
+	int index_number;	// lists of objects and sentinels,entries are their nodes
+	int index_used;	// entries in the index
+	int index_cap;	// entries the index has room for
+	size_t index_bytes;
+	int set_used;	// elements in scratch sets
+	int set_cap;	// room of scratch sets
+	size_t set_bytes;
+	size_t buffer_bytes;	// events,deferred moves and batch moves
+} aoi_memory;
+
 
 typedef struct aoi_space aoi_space;
 /**
@@ -21,7 +49,7 @@ typedef struct aoi_space aoi_space;
  * @param alloc_ud 内存分配函数的用户数据
  * @param map_size 地图大小(依次对应为x,y,z轴)
  * @param tower_size 九宫格实现:灯塔大小,十字链表实现:视野半径大小(x,y,z轴3个方向)
- * @param cb_enterAOI 进入AOI回调函数
+ * @param cb_enterAOI 进入AOI回调函数,和cb_leaveAOI都为NULL时事件写入内部缓冲区,用aoi_poll_events取出
  * @param cb_leaveAOI 离开AOI回调函数
  * @param cb_ud	进入/离开AOI回调时透传的用户数据
  * @return AOI对象
@@ -32,7 +60,7 @@ aoi_space *aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float tow
  * @function aoi_new
  * @param map_size 地图大小(依次对应为x,y,z轴)
  * @param tower_size 九宫格实现:灯塔大小,十字链表实现:视野半径大小(x,y,z轴3个方向)
- * @param cb_enterAOI 进入AOI回调函数
+ * @param cb_enterAOI 进入AOI回调函数,和cb_leaveAOI都为NULL时事件写入内部缓冲区,用aoi_poll_events取出
  * @param cb_leaveAOI 离开AOI回调函数
  * @param cb_ud	进入/离开AOI回调时透传的用户数据
  * @return AOI对象
@@ -44,6 +72,30 @@ aoi_space *aoi_new(float map_size[3],float tower_size[3],enterAOI_Callback cb_en
  * @param aoi AOI对象
  */
 void aoi_release(aoi_space *aoi);
+/**
+ * 设置滞后距离,实体进入视野时立即触发进入事件,离开视野后超出视野半径该距离才触发离开事件,
+ * 避免在视野边界附近来回移动时反复触发进入/离开事件,这期间aoi_get_view(range为空)仍返回该实体,默认为0
+ * @function aoi_set_hysteresis
+ * @param aoi AOI对象
+ * @param margin 滞后距离
+ */
+void aoi_set_hysteresis(aoi_space *aoi,float margin);
+/**
+ * 实体ID是从回收池分配的较小整数时,改为按ID直接索引的分页数组存放实体,省去哈希查找,
+ * 须在第一个实体进入前调用(内存和最大ID成正比)
+ * @function aoi_set_dense_id
+ * @param aoi AOI对象
+ * @param max_id ID上限(不含),0表示不限制,不小于上限的实体进入时被忽略
+ */
+void aoi_set_dense_id(aoi_space *aoi,uint32_t max_id);
+/**
+ * 取出缓冲的AOI事件(创建时回调函数为NULL才会缓冲),事件按产生顺序排列
+ * @function aoi_poll_events
+ * @param aoi AOI对象
+ * @param number [out] 事件个数
+ * @return 事件数组,取出后缓冲区被清空,数组在下一次修改AOI的调用前有效
+ */
+aoi_event *aoi_poll_events(aoi_space *aoi,int *number);
 /**
  * 增加一个实体
  * @function aoi_enter
@@ -70,6 +122,31 @@ void aoi_leave(aoi_space *aoi,uint32_t id);
  * @param pos 位置
  */
 void aoi_move(aoi_space *aoi,uint32_t id,float pos[3]);
+/**
+ * 批量移动实体,最终的可见关系与逐个调用aoi_move一致(同一实体出现多次时只按最后的位置产生事件),
+ * 但会合并查找,并按x坐标顺序依次移动,相邻实体需要扫描视野窗口的移动共用一次扫描
+ * @function aoi_move_batch
+ * @param aoi AOI对象
+ * @param ids 实体ID数组
+ * @param pos 位置数组,与ids一一对应
+ * @param n 数组长度
+ */
+void aoi_move_batch(aoi_space *aoi,const uint32_t *ids,const float (*pos)[3],int n);
+/**
+ * 设置延迟模式,开启后aoi_move/aoi_move_batch只记录实体的新位置,
+ * 由aoi_update统一计算视野变化(关闭时会先调用一次aoi_update)
+ * @function aoi_set_defer
+ * @param aoi AOI对象
+ * @param defer 非0开启,0关闭
+ */
+void aoi_set_defer(aoi_space *aoi,int defer);
+/**
+ * 延迟模式下应用所有记录的移动(一般每帧调用一次),同一对实体间相互抵消的进入/离开事件不会产生,
+ * 调用前查询视野得到的仍是旧位置的结果
+ * @function aoi_update
+ * @param aoi AOI对象
+ */
+void aoi_update(aoi_space *aoi);
 /**
  * 更新实体模式
  * @function aoi_change_mode
@@ -78,6 +155,15 @@ void aoi_move(aoi_space *aoi,uint32_t id,float pos[3]);
  * @param modestring 实体模式:w(atcher)--观察者,m(arker)--被观察者.
  */
 void aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring);
+/**
+ * 设置实体自己的视野范围(只影响该实体作为观察者时看到的范围)
+ * @function aoi_set_view_range
+ * @param aoi AOI对象
+ * @param id 实体ID
+ * @param range 视野半径(x,y,z轴3个方向),为空时恢复默认视野
+ *		(九宫格实现: 按灯塔大小向上取整为灯塔圈数,十字链表实现: 视野半径大小)
+ */
+void aoi_set_view_range(aoi_space *aoi,uint32_t id,float range[3]);
 /**
  * 根据位置获取视野范围内的实体
  * @function aoi_get_view_by_pos
@@ -97,11 +183,50 @@ void **aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *numbe
  * @param id 实体ID
  * @param range 范围
  *		(过滤的空间是以指定实体坐标为中心,range为半径表示的立方体,
- *		range为空时,对于九宫格实现: 表示获取灯塔周围九宫格范围,对于十字链表实现: 则使用默认视野半径大小)
+ *		range为空时,对于九宫格实现: 表示获取灯塔周围实体视野半径内的灯塔范围,对于十字链表实现: 则使用实体的视野半径大小)
  * @param number [out] 返回的实体数量
  * @return 实体ID列表
  */
 void **aoi_get_view(aoi_space *aoi,uint32_t id,float range[3],int *number);
+/**
+ * 根据位置获取视野范围内的实体,结果写入调用者提供的缓冲区,
+ * 不使用AOI内部的结果缓冲区,可以在遍历其他查询结果时或在回调函数中调用
+ * @function aoi_query_view_by_pos
+ * @param aoi AOI对象
+ * @param pos 位置
+ * @param range 范围(同aoi_get_view_by_pos)
+ * @param ids [out] 实体ID缓冲区,最多写入cap个
+ * @param cap 缓冲区大小
+ * @return 范围内的实体总数,大于cap时只写入了前cap个,需要用不小于返回值大小的缓冲区重新查询
+ */
+int aoi_query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],uint32_t *ids,int cap);
+/**
+ * 根据实体所在位置获取视野范围内的实体,结果写入调用者提供的缓冲区(同aoi_query_view_by_pos)
+ * @function aoi_query_view
+ * @param aoi AOI对象
+ * @param id 实体ID
+ * @param range 范围(同aoi_get_view)
+ * @param ids [out] 实体ID缓冲区,最多写入cap个
+ * @param cap 缓冲区大小
+ * @return 范围内的实体总数,实体不存在时返回0
+ */
+int aoi_query_view(aoi_space *aoi,uint32_t id,float range[3],uint32_t *ids,int cap);
+/**
+ * 统计内存占用,包括实体,实体表,空间索引,临时集合和各种缓冲区,
+ * 用于按场景调整参数,或发现人群散去后没有回收的内存
+ * @function aoi_memory_stats
+ * @param aoi AOI对象
+ * @param stats [out] 各部分的字节数,使用数量和容量
+ */
+void aoi_memory_stats(aoi_space *aoi,aoi_memory *stats);
+/**
+ * 回收空闲内存: 按实际数量缩小空间索引和临时集合的容量,释放缓存的空闲节点,
+ * 实体全部空闲的内存块和空闲的缓冲区,适合在人群散去后调用,
+ * 不能在回调函数中调用,调用后之前aoi_poll_events和aoi_get_view等返回的数组失效
+ * @function aoi_compact
+ * @param aoi AOI对象
+ */
+void aoi_compact(aoi_space *aoi);
 
 
 #endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "aoi.h"
+
+#define BENCH_OBJ 10000
+#define BENCH_ROUND 50
+
+static float POS[BENCH_OBJ][3];
+static uint32_t IDS[BENCH_OBJ];
+static uint64_t EVENTS = 0;
+
+static void *
+bench_alloc(void *ud,void *ptr,size_t sz) {
+	if (ptr == NULL) {
+		return malloc(sz);
+	}
+	free(ptr);
+	return NULL;
+}
+
+static void
+bench_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	EVENTS++;
+}
+
+static void
+bench_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	EVENTS++;
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every round all entities walk a step,a squad walks together
+static void
+walk(float map_size[3],float step) {
+	int i,j;
+	float dir[3];
+	for (i=0; i<BENCH_OBJ; i++) {
+		if (i % 8 == 0) {
+			for (j=0; j<3; j++) {
+				dir[j] = step * (2.0f * rand() / RAND_MAX - 1.0f);
+			}
+		}
+		for (j=0; j<3; j++) {
+			float pos = POS[i][j] + dir[j];
+			if (pos < 0 || pos >= map_size[j]) {
+				pos = POS[i][j] - dir[j];
+			}
+			POS[i][j] = pos;
+		}
+	}
+}
+
+static double
+bench(float map_size[3],float view_size[3],float step,bool batch,bool poll) {
+	int i,j;
+	aoi_space *aoi;
+	if (poll) {
+		aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	} else {
+		aoi = aoi_create(bench_alloc,NULL,map_size,view_size,bench_enterAOI,bench_leaveAOI,NULL);
+	}
+	srand(1);
+	// entities spawn in squads of 8
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			if (i % 8 == 0) {
+				POS[i][j] = map_size[j] * rand() / RAND_MAX;
+			} else {
+				POS[i][j] = POS[i-1][j];
+			}
+		}
+		IDS[i] = i;
+		aoi_enter(aoi,i,POS[i],"wm");
+	}
+	if (poll) {
+		int number;
+		aoi_poll_events(aoi,&number);
+	}
+	EVENTS = 0;
+	double t = 0;
+	for (i=0; i<BENCH_ROUND; i++) {
+		walk(map_size,step);
+		double start = now();
+		if (batch) {
+			aoi_move_batch(aoi,IDS,(const float (*)[3])POS,BENCH_OBJ);
+		} else {
+			for (j=0; j<BENCH_OBJ; j++) {
+				aoi_move(aoi,IDS[j],POS[j]);
+			}
+		}
+		if (poll) {
+			int number;
+			aoi_poll_events(aoi,&number);
+			EVENTS += number;
+		}
+		t += now() - start;
+	}
+	aoi_release(aoi);
+	return t;
+}
+
+// mass login: entities enter one after another
+static double
+bench_enter(float map_size[3],float view_size[3]) {
+	int i,j;
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+	}
+	double start = now();
+	for (i=0; i<BENCH_OBJ; i++) {
+		int number;
+		aoi_enter(aoi,i,POS[i],"wm");
+		aoi_poll_events(aoi,&number);
+	}
+	double t = now() - start;
+	aoi_release(aoi);
+	return t;
+}
+
+#define CORRIDOR_OBJ 2000
+
+// a road along y: everyone shares x,so an x sweep visits the whole road
+static double
+bench_corridor(float map_size[3],float view_size[3]) {
+	int i,j;
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<CORRIDOR_OBJ; i++) {
+		POS[i][0] = map_size[0] / 2 + 1.0f * rand() / RAND_MAX;
+		POS[i][1] = map_size[1] * rand() / RAND_MAX;
+		POS[i][2] = map_size[2] / 2;
+		IDS[i] = i;
+		aoi_enter(aoi,i,POS[i],"wm");
+	}
+	int number;
+	aoi_poll_events(aoi,&number);
+	double t = 0;
+	for (i=0; i<BENCH_ROUND; i++) {
+		for (j=0; j<CORRIDOR_OBJ; j++) {
+			float y = POS[j][1] + 0.25f * view_size[1] * (2.0f * rand() / RAND_MAX - 1.0f);
+			if (y >= 0 && y < map_size[1]) {
+				POS[j][1] = y;
+			}
+		}
+		double start = now();
+		for (j=0; j<CORRIDOR_OBJ; j++) {
+			aoi_move(aoi,IDS[j],POS[j]);
+		}
+		aoi_poll_events(aoi,&number);
+		t += now() - start;
+	}
+	aoi_release(aoi);
+	return t;
+}
+
+#define CROWD_OBJ 2000
+
+// a crowd in a square: everyone sees hundreds of others and walks a short step
+static double
+bench_crowd(float view_size[3]) {
+	int i,j;
+	float map_size[3] = {100,100,20};
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<CROWD_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		IDS[i] = i;
+		aoi_enter(aoi,i,POS[i],"wm");
+	}
+	int number;
+	aoi_poll_events(aoi,&number);
+	double t = 0;
+	for (i=0; i<BENCH_ROUND; i++) {
+		for (j=0; j<CROWD_OBJ; j++) {
+			float x = POS[j][0] + (2.0f * rand() / RAND_MAX - 1.0f);
+			float y = POS[j][1] + (2.0f * rand() / RAND_MAX - 1.0f);
+			if (x >= 0 && x < map_size[0]) {
+				POS[j][0] = x;
+			}
+			if (y >= 0 && y < map_size[1]) {
+				POS[j][1] = y;
+			}
+		}
+		double start = now();
+		for (j=0; j<CROWD_OBJ; j++) {
+			aoi_move(aoi,IDS[j],POS[j]);
+		}
+		aoi_poll_events(aoi,&number);
+		t += now() - start;
+	}
+	aoi_release(aoi);
+	return t;
+}
+
+#define QUERY_NUMBER 100000
+
+// skill hit tests: small boxes around random positions
+static double
+bench_query(float map_size[3],float view_size[3]) {
+	int i,j;
+	int found = 0;
+	float range[3] = {5,5,5};
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_enter(aoi,i,POS[i],"m");
+	}
+	double start = now();
+	for (i=0; i<QUERY_NUMBER; i++) {
+		int number;
+		float pos[3];
+		for (j=0; j<3; j++) {
+			pos[j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_get_view_by_pos(aoi,pos,range,&number);
+		found += number;
+	}
+	double t = now() - start;
+	aoi_release(aoi);
+	return found >= 0 ? t : 0;
+}
+
+#define NEIGHBOUR_MOVE 2000
+
+// everyone sees the others and jumps across the view,a jump compares the old and new view
+static double
+bench_neighbour(float view_size[3],int neighbour) {
+	int i,j;
+	float map_size[3] = {100,100,100};
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,view_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<=neighbour; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = view_size[j] * rand() / RAND_MAX;
+		}
+		aoi_enter(aoi,i,POS[i],"wm");
+	}
+	int number;
+	aoi_poll_events(aoi,&number);
+	double start = now();
+	for (i=0; i<NEIGHBOUR_MOVE; i++) {
+		int id = rand() % (neighbour + 1);
+		for (j=0; j<3; j++) {
+			POS[id][j] = view_size[j] * rand() / RAND_MAX;
+		}
+		aoi_move(aoi,id,POS[id]);
+	}
+	double t = now() - start;
+	aoi_release(aoi);
+	return t;
+}
+
+int
+main(int argc,char *argv[]) {
+	int i;
+	float map_size[3] = {1000,1000,100};
+	float view_size[3] = {20,20,20};
+	double t1 = bench(map_size,view_size,view_size[0],false,false);
+	uint64_t events1 = EVENTS;
+	double t2 = bench(map_size,view_size,view_size[0],true,false);
+	uint64_t events2 = EVENTS;
+	double t3 = bench(map_size,view_size,view_size[0],true,true);
+	uint64_t events3 = EVENTS;
+	// a step per tick is much shorter than the view
+	double t5 = bench(map_size,view_size,view_size[0]/10,false,false);
+	uint64_t events5 = EVENTS;
+	printf("objects=%d,round=%d\n",BENCH_OBJ,BENCH_ROUND);
+	double t0 = bench_enter(map_size,view_size);
+	printf("aoi_enter: %.3fs,%.0f enters/s\n",t0,BENCH_OBJ/t0);
+	double t4 = bench_corridor(map_size,view_size);
+	printf("corridor aoi_move: %.3fs,%.0f moves/s\n",t4,CORRIDOR_OBJ*BENCH_ROUND/t4);
+	double t6 = bench_crowd(view_size);
+	printf("crowd aoi_move: %.3fs,%.0f moves/s\n",t6,CROWD_OBJ*BENCH_ROUND/t6);
+	double t7 = bench_query(map_size,view_size);
+	printf("aoi_get_view_by_pos: %.3fs,%.0f queries/s\n",t7,QUERY_NUMBER/t7);
+	int neighbours[] = {100,1000,5000};
+	for (i=0; i<3; i++) {
+		double t = bench_neighbour(view_size,neighbours[i]);
+		printf("neighbours=%d aoi_move: %.3fs,%.0f moves/s\n",neighbours[i],t,NEIGHBOUR_MOVE/t);
+	}
+	printf("aoi_move loop: %.3fs,%.0f moves/s,events=%llu\n",t1,BENCH_OBJ*BENCH_ROUND/t1,(unsigned long long)events1);
+	printf("aoi_move_batch: %.3fs,%.0f moves/s,events=%llu\n",t2,BENCH_OBJ*BENCH_ROUND/t2,(unsigned long long)events2);
+	printf("aoi_move_batch+aoi_poll_events: %.3fs,%.0f moves/s,events=%llu\n",t3,BENCH_OBJ*BENCH_ROUND/t3,(unsigned long long)events3);
+	printf("aoi_move short step: %.3fs,%.0f moves/s,events=%llu\n",t5,BENCH_OBJ*BENCH_ROUND/t5,(unsigned long long)events5);
+	return 0;
+}
@@ -110,6 +110,48 @@ laoi_release(lua_State *L) {
 }
 */
 
+/**
+ * 设置视野半径(灯塔圈数),需要在增加实体前设置
+ * @function aoi:set_radius
+ * @param radius 灯塔圈数
+ */
+static int
+laoi_set_radius(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	int radius = luaL_checkinteger(L,2);
+	aoi_set_radius(laoi->aoi,radius);
+	return 0;
+}
+
+/**
+ * 实体ID是较小整数时,按ID直接索引存放实体,须在第一个实体进入前调用
+ * @function aoi:set_dense_id
+ * @param max_id ID上限(不含),不传或0表示不限制
+ */
+static int
+laoi_set_dense_id(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	uint32_t max_id = luaL_optinteger(L,2,0);
+	aoi_set_dense_id(laoi->aoi,max_id);
+	return 0;
+}
+
+/**
+ * 设置灯塔边界的滞后距离,越过边界超过该距离才算进入新灯塔
+ * @function aoi:set_hysteresis
+ * @param margin 滞后距离
+ */
+static int
+laoi_set_hysteresis(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	float margin = luaL_checknumber(L,2);
+	aoi_set_hysteresis(laoi->aoi,margin);
+	return 0;
+}
+
 /**
  * 增加一个实体
  * @function aoi:enter
@@ -171,6 +213,60 @@ laoi_move(lua_State *L) {
 	return 0;
 }
 
+/**
+ * 批量移动实体
+ * @function aoi:move_batch
+ * @param list 扁平数组{id1,x1,y1,z1,id2,x2,y2,z2,...}
+ */
+static int
+laoi_move_batch(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	luaL_checktype(L,2,LUA_TTABLE);
+	int n = lua_rawlen(L,2) / 4;
+	uint32_t *ids = lua_newuserdata(L,n * (sizeof(uint32_t) + 3 * sizeof(float)));
+	float (*pos)[3] = (float (*)[3])(ids + n);
+	int i,j;
+	for (i=0; i<n; i++) {
+		lua_rawgeti(L,2,i*4+1);
+		ids[i] = luaL_checkinteger(L,-1);
+		lua_pop(L,1);
+		for (j=0; j<3; j++) {
+			lua_rawgeti(L,2,i*4+2+j);
+			pos[i][j] = luaL_checknumber(L,-1);
+			lua_pop(L,1);
+		}
+	}
+	aoi_move_batch(laoi->aoi,ids,(const float (*)[3])pos,n);
+	return 0;
+}
+
+/**
+ * 设置延迟模式,开启后移动只记录位置,由aoi:update统一计算视野变化
+ * @function aoi:set_defer
+ * @param defer true开启,false关闭
+ */
+static int
+laoi_set_defer(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	int defer = lua_toboolean(L,2);
+	aoi_set_defer(laoi->aoi,defer);
+	return 0;
+}
+
+/**
+ * 延迟模式下应用所有记录的移动并触发合并后的事件
+ * @function aoi:update
+ */
+static int
+laoi_update(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	aoi_update(laoi->aoi);
+	return 0;
+}
+
 /**
  * 更新实体模式
  * @function aoi:change_mode
@@ -188,6 +284,33 @@ laoi_change_mode(lua_State *L) {
 	return 0;
 }
 
+/**
+ * 设置实体自己的视野范围
+ * @function aoi:set_view_range
+ * @param id 实体ID
+ * @param range_x 视野x大小
+ * @param range_y 视野y大小
+ * @param range_z 视野z大小
+ *		(范围不传时恢复默认视野)
+ */
+static int
+laoi_set_view_range(lua_State *L) {
+	int i;
+	float range[3];
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	uint32_t id = luaL_checkinteger(L,2);
+	if (lua_gettop(L) > 2) {
+		for (i=0; i<3; i++) {
+			range[i] = luaL_checknumber(L,3+i);
+		}
+		aoi_set_view_range(laoi->aoi,id,range);
+	} else {
+		aoi_set_view_range(laoi->aoi,id,NULL);
+	}
+	return 0;
+}
+
 /**
  * 根据位置获取视野范围内的实体
  * @function aoi:get_view_by_pos
@@ -273,27 +396,89 @@ laoi_get_view(lua_State *L) {
 	return 1;
 }
 
+/**
+ * 统计内存占用
+ * @function aoi:memory_stats
+ * @return 统计表,字段同C接口的aoi_memory(total,object_bytes,map_cap等)
+ */
+static int
+laoi_memory_stats(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	aoi_memory stats;
+	aoi_memory_stats(laoi->aoi,&stats);
+	lua_createtable(L,0,15);
+#define SET_FIELD(name) lua_pushinteger(L,stats.name); lua_setfield(L,-2,#name)
+	SET_FIELD(total);
+	SET_FIELD(object_number);
+	SET_FIELD(object_cap);
+	SET_FIELD(object_bytes);
+	SET_FIELD(map_number);
+	SET_FIELD(map_cap);
+	SET_FIELD(map_bytes);
+	SET_FIELD(index_number);
+	SET_FIELD(index_used);
+	SET_FIELD(index_cap);
+	SET_FIELD(index_bytes);
+	SET_FIELD(set_used);
+	SET_FIELD(set_cap);
+	SET_FIELD(set_bytes);
+	SET_FIELD(buffer_bytes);
+#undef SET_FIELD
+	return 1;
+}
+
+/**
+ * 回收空闲内存,人群散去后调用
+ * @function aoi:compact
+ */
+static int
+laoi_compact(lua_State *L) {
+	lua_aoi_space *laoi = lua_touserdata(L,1);
+	luaL_argcheck(L,laoi != NULL,1,"Need a aoi object");
+	aoi_compact(laoi->aoi);
+	return 0;
+}
+
 LUAMOD_API int
 luaopen_laoi(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg laoi_methods[] = {
+		{"set_radius",laoi_set_radius},
+		{"set_dense_id",laoi_set_dense_id},
+		{"set_hysteresis",laoi_set_hysteresis},
 		{"enter",laoi_enter},
 		{"leave",laoi_leave},
 		{"move",laoi_move},
+		{"move_batch",laoi_move_batch},
+		{"set_defer",laoi_set_defer},
+		{"update",laoi_update},
 		{"change_mode",laoi_change_mode},
+		{"set_view_range",laoi_set_view_range},
 		{"get_view_by_pos",laoi_get_view_by_pos},
 		{"get_view",laoi_get_view},
+		{"memory_stats",laoi_memory_stats},
+		{"compact",laoi_compact},
 		{NULL,NULL},
 	};
 
 	luaL_Reg l[] = {
 		{"new",laoi_new},
+		{"set_radius",laoi_set_radius},
+		{"set_dense_id",laoi_set_dense_id},
+		{"set_hysteresis",laoi_set_hysteresis},
 		{"enter",laoi_enter},
 		{"leave",laoi_leave},
 		{"move",laoi_move},
+		{"move_batch",laoi_move_batch},
+		{"set_defer",laoi_set_defer},
+		{"update",laoi_update},
 		{"change_mode",laoi_change_mode},
+		{"set_view_range",laoi_set_view_range},
 		{"get_view_by_pos",laoi_get_view_by_pos},
 		{"get_view",laoi_get_view},
+		{"memory_stats",laoi_memory_stats},
+		{"compact",laoi_compact},
 		{NULL,NULL},
 	};
 
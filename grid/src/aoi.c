@@ -4,31 +4,74 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <math.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 #include "aoi.h"
 
 
 #define INVALID_ID (~0)
 #define PRE_ALLOC 16
+#define MAP_PAGE 256	// ids of a page in dense id mode
+#define SLAB_OBJECT 64	// objects carved from a slab
 //#define PRE_ALLOC 32
 #define MODE_WATCHER 1
 #define MODE_MARKER 2
+#define MAX_FREE_TOWER 64
+#define MAX_FREE_CAP 64	// towers with more room than this are freed instead of kept for reuse
+#define MAX_RADIUS 16
+#define NOTIFY_ENTER 1
+#define NOTIFY_LEAVE 2
+#define NOTIFY_SELF 4	// only the view of obj itself changes
+// compile with -DAOI_2D for flat maps: z is ignored and neighbourhoods are 3x3
+#if defined AOI_2D
+	#define AOI_DIM 2
+	#define AROUND_Z(r) 0
+	#define TOWER_Z(tower) 0
+#else
+	#define AOI_DIM 3
+	#define AROUND_Z(r) (r)
+	#define TOWER_Z(tower) ((tower)->z)
+#endif
+#define DELTA_INDEX(dx,dy,dz) (((dx)+1)*9 + ((dy)+1)*3 + ((dz)+1))
 
 typedef struct aoi_object {
 	uint32_t id;
 	int mode;
 	float pos[3];
+	struct aoi_tower *tower;	// tower which object is in
+	int tower_index;	// index in tower->objects
+	int radius;	// view radius(tower rings) when object is a watcher
+	int batch_index;	// index in aoi->batch during aoi_move_batch
+	int pending_index;	// index in aoi->pending_ids when move is deferred
+	struct aoi_object *next_free;	// next object of aoi->free_objects
 } aoi_object;
 
+// objects are carved from slabs,left ones wait in aoi->free_objects for the next enter
+typedef struct aoi_slab {
+	struct aoi_slab *next;
+	aoi_object obj[SLAB_OBJECT];
+} aoi_slab;
+
+// open addressing with linear probing,an empty slot has no obj
 typedef struct aoi_map_slot {
 	uint32_t id;
 	aoi_object * obj;
-	int next;
 } aoi_map_slot;
 
+// a page of objects indexed by id in dense id mode
+typedef struct aoi_map_page {
+	int number;
+	aoi_object *obj[MAP_PAGE];
+} aoi_map_page;
+
 typedef struct aoi_map {
 	int size;
-	int lastfree;
+	int number;
 	aoi_map_slot * slot;
+	aoi_map_page **page;	// pages of dense id mode,NULL when ids are hashed
+	int page_number;
+	uint32_t max_id;	// ids of dense id mode are below it,0 means no bound
 } aoi_map;
 
 typedef struct aoi_set {
@@ -37,42 +80,179 @@ typedef struct aoi_set {
 	void **slot;
 } aoi_set;
 
+// ids written to a caller buffer,number counts all matches even past cap
+typedef struct aoi_result {
+	uint32_t *ids;
+	int cap;
+	int number;
+} aoi_result;
+
 typedef struct aoi_tower {
 	aoi_set *objects;
-	int x,y,z;
+	// positions and ids of objects in the same order,so range filters run over contiguous floats
+	float *pos[AOI_DIM];
+	uint32_t *ids;
+	int cap;	// capacity of pos and ids
+	uint32_t key;
+	int x,y;
+#if !defined AOI_2D
+	int z;
+#endif
+	struct aoi_tower *next_free;
 } aoi_tower;
 
+typedef struct aoi_box {
+	int x,y,z;
+	int r;
+} aoi_box;
+
+typedef struct aoi_batch_move {
+	aoi_object *obj;
+	int old_x,old_y,old_z;
+	int x,y,z;
+	uint32_t old_key;
+	uint32_t key;
+} aoi_batch_move;
+
+typedef struct aoi_offset {
+	int8_t x,y,z;
+} aoi_offset;
+
+// towers to notify when moving to a neighbour tower:
+// offsets[0,enter_number) are relative to the new tower,
+// offsets[enter_number,enter_number+leave_number) are relative to the old tower
+typedef struct aoi_delta {
+	int enter_number;
+	int leave_number;
+	aoi_offset *offsets;
+} aoi_delta;
+
+// only occupied towers live here,keyed by tower index
+typedef struct aoi_tower_map {
+	int size;
+	int number;
+	aoi_tower **slot;
+} aoi_tower_map;
+
 typedef struct aoi_space {
 	float map_size[3];
 	float tower_size[3];
 	int tower_x_limit;
 	int tower_y_limit;
 	int tower_z_limit;
-	aoi_tower *towers;
+	int radius;
+	int radius_count[MAX_RADIUS+1];	// watcher number of each view radius
+	float hysteresis;	// distance to move past a tower edge before changing tower
+	aoi_tower_map *towers;
+	aoi_tower *free_towers;
+	int free_tower_number;
 	aoi_map *objects;
 	aoi_Alloc alloc;
 	void *alloc_ud;
 	enterAOI_Callback cb_enterAOI;
 	leaveAOI_Callback cb_leaveAOI;
 	void *cb_ud;
-	aoi_set *set1;
-	aoi_set *set2;
+	aoi_event *events;	// buffered events when no callback
+	int event_number;
+	int event_cap;
+	bool buffered;	// events go to aoi->events
+	bool defer;	// moves are applied in aoi_update
+	uint32_t *pending_ids;
+	float (*pending_pos)[3];
+	int pending_number;
+	int pending_cap;
+	aoi_delta deltas[27];
 	aoi_set *result_set;
+	aoi_batch_move *batch;
+	int batch_cap;
+	aoi_set *batch_towers;
+	aoi_slab *slab;
+	aoi_object *free_objects;
 } aoi_space;
 
 
+static aoi_object *
+object_alloc(aoi_space *aoi) {
+	if (aoi->free_objects == NULL) {
+		int i;
+		aoi_slab *slab = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_slab));
+		slab->next = aoi->slab;
+		aoi->slab = slab;
+		// objects entering one after another are adjacent
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			slab->obj[i].next_free = aoi->free_objects;
+			aoi->free_objects = &slab->obj[i];
+		}
+	}
+	aoi_object *obj = aoi->free_objects;
+	aoi->free_objects = obj->next_free;
+	return obj;
+}
+
+static void
+object_free(aoi_space *aoi,aoi_object *obj) {
+	obj->next_free = aoi->free_objects;
+	aoi->free_objects = obj;
+}
+
+static void
+slab_delete(aoi_space *aoi) {
+	while (aoi->slab != NULL) {
+		aoi_slab *slab = aoi->slab;
+		aoi->slab = slab->next;
+		aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+	}
+	aoi->free_objects = NULL;
+}
+
+// slabs with all objects free go back to the allocator,free objects are marked by mode -1
+static void
+slab_compact(aoi_space *aoi) {
+	int i;
+	aoi_object *obj;
+	aoi_slab **p = &aoi->slab;
+	for (obj=aoi->free_objects; obj != NULL; obj=obj->next_free) {
+		obj->mode = -1;
+	}
+	aoi->free_objects = NULL;
+	while (*p != NULL) {
+		aoi_slab *slab = *p;
+		int number = 0;
+		for (i=0; i<SLAB_OBJECT; i++) {
+			if (slab->obj[i].mode < 0) {
+				number++;
+			}
+		}
+		if (number == SLAB_OBJECT) {
+			*p = slab->next;
+			aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+			continue;
+		}
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			if (slab->obj[i].mode < 0) {
+				object_free(aoi,&slab->obj[i]);
+			}
+		}
+		p = &slab->next;
+	}
+}
+
 static aoi_object *
 new_object(aoi_space * aoi, uint32_t id) {
-	aoi_object * obj = aoi->alloc(aoi->alloc_ud, NULL, sizeof(*obj));
+	aoi_object * obj = object_alloc(aoi);
 	obj->id = id;
 	obj->mode = 0;
+	obj->tower_index = -1;
+	obj->radius = aoi->radius;
+	obj->batch_index = -1;
+	obj->pending_index = -1;
 	return obj;
 }
 
 static void
 delete_object(void *ud,aoi_object *obj) {
 	aoi_space *aoi = ud;
-	aoi->alloc(aoi->alloc_ud,obj,sizeof(*obj));
+	object_free(aoi,obj);
 }
 
 static aoi_object * map_get(aoi_map *m,uint32_t id);
@@ -82,101 +262,149 @@ get_object(aoi_space *aoi,uint32_t id) {
 	return map_get(aoi->objects,id);
 }
 
-static inline aoi_map_slot *
-mainposition(aoi_map *m , uint32_t id) {
-	uint32_t hash = id & (m->size-1);
-	return &m->slot[hash];
+static inline uint32_t
+map_hash(uint32_t id) {
+	uint32_t h = id * 2654435761u;
+	return h ^ (h >> 16);
 }
 
-static void rehash(aoi_space * aoi, aoi_map *m);
-
 static void
-map_insert(aoi_space * aoi , aoi_map * m, uint32_t id , aoi_object *obj) {
-	aoi_map_slot *s = mainposition(m,id);
-	if (s->id == INVALID_ID) {
-		s->id = id;
-		s->obj = obj;
-		return;
-	}
-	if (mainposition(m, s->id) != s) {
-		aoi_map_slot * last = mainposition(m,s->id);
-		while (last->next != s - m->slot) {
-			assert(last->next >= 0);
-			last = &m->slot[last->next];
-		}
-		uint32_t temp_id = s->id;
-		aoi_object * temp_obj = s->obj;
-		last->next = s->next;
-		s->id = id;
-		s->obj = obj;
-		s->next = -1;
-		if (temp_obj) {
-			map_insert(aoi, m, temp_id, temp_obj);
+map_resize(aoi_space *aoi,aoi_map *m,int size) {
+	aoi_map_slot *old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	for (i=0; i<old_size; i++) {
+		aoi_map_slot *s = &old_slot[i];
+		if (s->obj != NULL) {
+			int mask = m->size - 1;
+			int j = map_hash(s->id) & mask;
+			while (m->slot[j].obj != NULL) {
+				j = (j+1) & mask;
+			}
+			m->slot[j] = *s;
 		}
-		return;
-	} else if(s->obj == NULL) {
-		s->id = id;
-		s->obj = obj;
-		return;
 	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_map_slot));
+}
 
-	while (m->lastfree >= 0) {
-		aoi_map_slot * temp = &m->slot[m->lastfree--];
-		if (temp->id == INVALID_ID) {
-			temp->id = id;
-			temp->obj = obj;
-			temp->next = s->next;
-			s->next = (int)(temp - m->slot);
-			return;
+static void
+page_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	assert(m->max_id == 0 || id < m->max_id);
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number) {
+		int number = m->page_number;
+		while (k >= number) {
+			number *= 2;
 		}
+		aoi_map_page **page = aoi->alloc(aoi->alloc_ud,NULL,number * sizeof(aoi_map_page*));
+		memset(page,0,number * sizeof(aoi_map_page*));
+		memcpy(page,m->page,m->page_number * sizeof(aoi_map_page*));
+		aoi->alloc(aoi->alloc_ud,m->page,m->page_number * sizeof(aoi_map_page*));
+		m->page = page;
+		m->page_number = number;
+	}
+	aoi_map_page *page = m->page[k];
+	if (page == NULL) {
+		page = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_map_page));
+		memset(page,0,sizeof(aoi_map_page));
+		m->page[k] = page;
+	}
+	page->obj[id % MAP_PAGE] = obj;
+	page->number++;
+	m->number++;
+}
+
+static inline aoi_object *
+page_get(aoi_map *m,uint32_t id) {
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number || m->page[k] == NULL) {
+		return NULL;
+	}
+	return m->page[k]->obj[id % MAP_PAGE];
+}
+
+// empty pages are freed
+static aoi_object *
+page_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	aoi_object *obj = page_get(m,id);
+	if (obj == NULL) {
+		return NULL;
 	}
-	rehash(aoi,m);
-	map_insert(aoi, m, id , obj);
+	aoi_map_page *page = m->page[id / MAP_PAGE];
+	page->obj[id % MAP_PAGE] = NULL;
+	m->number--;
+	if (--page->number == 0) {
+		aoi->alloc(aoi->alloc_ud,page,sizeof(aoi_map_page));
+		m->page[id / MAP_PAGE] = NULL;
+	}
+	return obj;
 }
 
+// switch an empty map to pages indexed by id
 static void
-rehash(aoi_space * aoi, aoi_map *m) {
-	aoi_map_slot * old_slot = m->slot;
-	int old_size = m->size;
-	m->size = 2 * old_size;
-	m->lastfree = m->size - 1;
-	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
-	int i;
-	for (i=0;i<m->size;i++) {
-		aoi_map_slot * s = &m->slot[i];
-		s->id = INVALID_ID;
-		s->obj = NULL;
-		s->next = -1;
+map_set_dense(aoi_space *aoi,aoi_map *m,uint32_t max_id) {
+	assert(m->number == 0 && m->page == NULL);
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_map_slot));
+	m->slot = NULL;
+	m->size = 0;
+	m->max_id = max_id;
+	m->page_number = max_id > 0 ? max_id / MAP_PAGE + (max_id % MAP_PAGE != 0) : PRE_ALLOC;
+	m->page = aoi->alloc(aoi->alloc_ud,NULL,m->page_number * sizeof(aoi_map_page*));
+	memset(m->page,0,m->page_number * sizeof(aoi_map_page*));
+}
+
+// id is not in the map
+static void
+map_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	if (m->page != NULL) {
+		page_insert(aoi,m,id,obj);
+		return;
 	}
-	for (i=0;i<old_size;i++) {
-		aoi_map_slot * s = &old_slot[i];
-		if (s->obj) {
-			map_insert(aoi, m, s->id, s->obj);
-		}
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		map_resize(aoi,m,m->size*2);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].obj != NULL) {
+		i = (i+1) & mask;
 	}
-	aoi->alloc(aoi->alloc_ud, old_slot, old_size * sizeof(aoi_map_slot));
+	m->slot[i].id = id;
+	m->slot[i].obj = obj;
+	m->number++;
 }
 
+// ids live in slots,so a probe never touches objects
 static aoi_object *
 map_get(aoi_map *m,uint32_t id) {
-	aoi_map_slot *s = mainposition(m, id);
+	if (m->page != NULL) {
+		return page_get(m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
 	for (;;) {
-		if (s->id == id) {
-			if (s->obj != NULL) {
-				return s->obj;
-			}
-		}
-		if (s->next < 0) {
-			break;
+		aoi_map_slot *s = &m->slot[i];
+		if (s->obj == NULL || s->id == id) {
+			return s->obj;
 		}
-		s=&m->slot[s->next];
+		i = (i+1) & mask;
 	}
-	return NULL;
 }
 
 static void
 map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
-	int i;
+	int i,j;
+	for (i=0; i<m->page_number; i++) {
+		aoi_map_page *page = m->page[i];
+		for (j=0; page != NULL && j<MAP_PAGE; j++) {
+			if (page->obj[j]) {
+				func(ud, page->obj[j]);
+			}
+		}
+	}
 	for (i=0;i<m->size;i++) {
 		if (m->slot[i].obj) {
 			func(ud, m->slot[i].obj);
@@ -185,43 +413,89 @@ map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
 }
 
 static aoi_object *
-map_remove(aoi_map *m, uint32_t id) {
-	aoi_map_slot *s = mainposition(m,id);
+map_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_remove(aoi,m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].id != id || m->slot[i].obj == NULL) {
+		if (m->slot[i].obj == NULL) {
+			return NULL;
+		}
+		i = (i+1) & mask;
+	}
+	aoi_object *obj = m->slot[i].obj;
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
 	for (;;) {
-		if (s->id == id) {
-			aoi_object * obj = s->obj;
-			s->obj = NULL;
-			return obj;
+		j = (j+1) & mask;
+		aoi_map_slot *temp = &m->slot[j];
+		if (temp->obj == NULL) {
+			break;
 		}
-		if (s->next < 0) {
-			return NULL;
+		int k = map_hash(temp->id) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
 		}
-		s=&m->slot[s->next];
+		m->slot[i] = *temp;
+		i = j;
 	}
+	m->slot[i].obj = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		map_resize(aoi,m,m->size/2);
+	}
+	return obj;
 }
 
 static void
 map_delete(aoi_space *aoi, aoi_map * m) {
-	aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	int i;
+	for (i=0; i<m->page_number; i++) {
+		if (m->page[i] != NULL) {
+			aoi->alloc(aoi->alloc_ud, m->page[i], sizeof(aoi_map_page));
+		}
+	}
+	if (m->page != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->page, m->page_number * sizeof(aoi_map_page*));
+	}
+	if (m->slot != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	}
 	aoi->alloc(aoi->alloc_ud, m , sizeof(*m));
 }
 
 static aoi_map *
 map_new(aoi_space *aoi) {
-	int i;
 	aoi_map * m = aoi->alloc(aoi->alloc_ud, NULL, sizeof(*m));
 	m->size = PRE_ALLOC;
-	m->lastfree = PRE_ALLOC - 1;
+	m->number = 0;
 	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
-	for (i=0;i<m->size;i++) {
-		aoi_map_slot * s = &m->slot[i];
-		s->id = INVALID_ID;
-		s->obj = NULL;
-		s->next = -1;
-	}
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	m->page = NULL;
+	m->page_number = 0;
+	m->max_id = 0;
 	return m;
 }
 
+static void
+map_stats(aoi_map *m,aoi_memory *stats) {
+	int i;
+	stats->map_number = m->number;
+	stats->map_cap = m->size;
+	stats->map_bytes = sizeof(*m) + m->size * sizeof(aoi_map_slot);
+	if (m->page != NULL) {
+		stats->map_bytes += m->page_number * sizeof(aoi_map_page*);
+		for (i=0; i<m->page_number; i++) {
+			if (m->page[i] != NULL) {
+				stats->map_cap += MAP_PAGE;
+				stats->map_bytes += sizeof(aoi_map_page);
+			}
+		}
+	}
+}
+
 static aoi_set *
 set_new(aoi_space *aoi) {
 	aoi_set *set = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*set));
@@ -237,6 +511,40 @@ set_delete(aoi_space *aoi,aoi_set *set) {
 	aoi->alloc(aoi->alloc_ud,set,sizeof(*set));
 }
 
+static inline size_t
+set_bytes(aoi_set *set) {
+	return sizeof(*set) + set->cap * sizeof(void*);
+}
+
+static void
+set_stats(aoi_set *set,aoi_memory *stats) {
+	stats->set_used += set->number;
+	stats->set_cap += set->cap;
+	stats->set_bytes += set_bytes(set);
+}
+
+// halve while at most a quarter is used,so at least twice the number is left
+static inline int
+shrink_cap(int number,int cap) {
+	while (cap > PRE_ALLOC && number * 4 <= cap) {
+		cap /= 2;
+	}
+	return cap;
+}
+
+static void
+set_shrink(aoi_space *aoi,aoi_set *set) {
+	int cap = shrink_cap(set->number,set->cap);
+	if (cap == set->cap) {
+		return;
+	}
+	void **slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+	memcpy(slot,set->slot,set->number*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	set->slot = slot;
+	set->cap = cap;
+}
+
 /*
 static bool
 set_find(aoi_set *set,void *elem) {
@@ -268,6 +576,25 @@ set_add(aoi_space *aoi,aoi_set *set,void *elem) {
 	}
 }
 
+static inline void
+result_add(aoi_result *result,uint32_t id) {
+	if (result->number < result->cap) {
+		result->ids[result->number] = id;
+	}
+	result->number++;
+}
+
+// a query writes ids to set,or to result when set is NULL
+static inline void
+query_add(aoi_space *aoi,aoi_set *set,aoi_result *result,uint32_t id) {
+	if (set != NULL) {
+		set_add(aoi,set,(void*)id);
+	} else {
+		result_add(result,id);
+	}
+}
+
+/*
 static void*
 set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
 	int i;
@@ -281,7 +608,9 @@ set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
 	}
 	return NULL;
 }
+*/
 
+/*
 static void
 set_difference(aoi_space *aoi,aoi_set *set1,aoi_set *set2,aoi_set *result) {
 	int i,j;
@@ -299,6 +628,7 @@ set_difference(aoi_space *aoi,aoi_set *set1,aoi_set *set2,aoi_set *result) {
 		}
 	}
 }
+*/
 
 /*
 static void
@@ -321,173 +651,664 @@ set_intersection(aoi_space *aoi,aoi_set *set1,aoi_set *set2,aoi_set *result) {
 */
 
 inline static void 
-copy_position(float des[3], float src[3]) {
+copy_position(float des[3], const float src[3]) {
 	des[0] = src[0];
 	des[1] = src[1];
 	des[2] = src[2];
 }
 
 static void
-pos2xyz(aoi_space *aoi,float pos[3],int *x,int *y,int *z) {
+pos2xyz(aoi_space *aoi,const float pos[3],int *x,int *y,int *z) {
 	*x = (int)(pos[0] / aoi->tower_size[0]);
 	*y = (int)(pos[1] / aoi->tower_size[1]);
+#if defined AOI_2D
+	*z = 0;
+#else
 	*z = (int)(pos[2] / aoi->tower_size[2]);
+#endif
+}
+
+static inline void
+object_xyz(aoi_object *obj,int *x,int *y,int *z) {
+	*x = obj->tower->x;
+	*y = obj->tower->y;
+	*z = TOWER_Z(obj->tower);
+}
+
+// keep (x,y,z) of pos as the tower of obj until pos is hysteresis away from it
+static void
+stick_tower(aoi_space *aoi,aoi_object *obj,const float pos[3],int *x,int *y,int *z) {
+	int i;
+	int old[3];
+	object_xyz(obj,&old[0],&old[1],&old[2]);
+	if (aoi->hysteresis <= 0 || (*x == old[0] && *y == old[1] && *z == old[2])) {
+		return;
+	}
+	for (i=0; i<AOI_DIM; i++) {
+		float low = old[i] * aoi->tower_size[i] - aoi->hysteresis;
+		float high = (old[i] + 1) * aoi->tower_size[i] + aoi->hysteresis;
+		if (pos[i] < low || pos[i] >= high) {
+			return;
+		}
+	}
+	*x = old[0];
+	*y = old[1];
+	*z = old[2];
+}
+
+static inline uint32_t
+tower_hash(uint32_t key) {
+	uint32_t h = key * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static aoi_tower_map *
+tower_map_new(aoi_space *aoi,int size) {
+	aoi_tower_map *m = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*m));
+	m->size = size;
+	m->number = 0;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_tower*));
+	memset(m->slot,0,m->size * sizeof(aoi_tower*));
+	return m;
+}
+
+static void
+tower_map_delete(aoi_space *aoi,aoi_tower_map *m) {
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_tower*));
+	aoi->alloc(aoi->alloc_ud,m,sizeof(*m));
 }
 
 static aoi_tower *
-get_tower(aoi_space *aoi,int x,int y,int z) {
-	if ( x < 0 || x >= aoi->tower_x_limit ||
-		 y < 0 || y >= aoi->tower_y_limit ||
-		 z < 0 || z >= aoi->tower_z_limit) {
-		return NULL;
+tower_map_get(aoi_tower_map *m,uint32_t key) {
+	int mask = m->size - 1;
+	int i = tower_hash(key) & mask;
+	for (;;) {
+		aoi_tower *tower = m->slot[i];
+		if (tower == NULL || tower->key == key) {
+			return tower;
+		}
+		i = (i+1) & mask;
 	}
-	int idx = x*aoi->tower_y_limit + y + z*aoi->tower_x_limit*aoi->tower_y_limit;
-	return &aoi->towers[idx];
 }
 
 static void
-around_towers(aoi_space *aoi,aoi_tower *tower,aoi_set *set) {
-	int i,j,k;
-	int x,y,z;
-	x = tower->x;
-	y = tower->y;
-	z = tower->z;
-	set->number = 0;
-	for(i=x-1; i<=x+1; i++) {
-		for (j=y-1; j<=y+1; j++) {
-			for (k=z-1; k<=z+1; k++) {
-				aoi_tower *temp = get_tower(aoi,i,j,k);
-				if (temp == NULL) {
-					continue;
-				}
-				set_add(aoi,set,temp);
+tower_map_resize(aoi_space *aoi,aoi_tower_map *m,int size) {
+	aoi_tower **old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_tower*));
+	memset(m->slot,0,m->size * sizeof(aoi_tower*));
+	for (i=0; i<old_size; i++) {
+		aoi_tower *tower = old_slot[i];
+		if (tower != NULL) {
+			int mask = m->size - 1;
+			int j = tower_hash(tower->key) & mask;
+			while (m->slot[j] != NULL) {
+				j = (j+1) & mask;
 			}
+			m->slot[j] = tower;
 		}
 	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_tower*));
 }
 
 static void
-enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
-	if (watcher->id == marker->id) {
-		return;
+tower_map_insert(aoi_space *aoi,aoi_tower_map *m,aoi_tower *tower) {
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		tower_map_resize(aoi,m,m->size*2);
 	}
-	if (watcher->mode & MODE_WATCHER) {
-		aoi->cb_enterAOI(aoi->cb_ud,watcher->id,marker->id);
-	}
-	if (marker->mode & MODE_WATCHER) {
-		aoi->cb_enterAOI(aoi->cb_ud,marker->id,watcher->id);
+	int mask = m->size - 1;
+	int i = tower_hash(tower->key) & mask;
+	while (m->slot[i] != NULL) {
+		i = (i+1) & mask;
 	}
+	m->slot[i] = tower;
+	m->number++;
 }
 
 static void
-leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
-	if (watcher->id == marker->id) {
-		return;
+tower_map_remove(aoi_space *aoi,aoi_tower_map *m,aoi_tower *tower) {
+	int mask = m->size - 1;
+	int i = tower_hash(tower->key) & mask;
+	while (m->slot[i] != tower) {
+		assert(m->slot[i] != NULL);
+		i = (i+1) & mask;
 	}
-	if (watcher->mode & MODE_WATCHER) {
-		aoi->cb_leaveAOI(aoi->cb_ud,watcher->id,marker->id);
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
+	for (;;) {
+		j = (j+1) & mask;
+		aoi_tower *temp = m->slot[j];
+		if (temp == NULL) {
+			break;
+		}
+		int k = tower_hash(temp->key) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		m->slot[i] = temp;
+		i = j;
 	}
-	if (marker->mode & MODE_WATCHER) {
-		aoi->cb_leaveAOI(aoi->cb_ud,marker->id,watcher->id);
+	m->slot[i] = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		tower_map_resize(aoi,m,m->size/2);
 	}
 }
 
+static inline bool
+in_map(aoi_space *aoi,int x,int y,int z) {
+	return x >= 0 && x < aoi->tower_x_limit &&
+		y >= 0 && y < aoi->tower_y_limit &&
+		z >= 0 && z < aoi->tower_z_limit;
+}
 
-aoi_space *
-aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float tower_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
-	int size;
-	int x,y,z;
-	aoi_space *aoi = alloc(alloc_ud,NULL,sizeof(*aoi));
-	aoi->alloc = alloc;
-	aoi->alloc_ud = alloc_ud;
-	memcpy(aoi->map_size,map_size,3*sizeof(float));
-	memcpy(aoi->tower_size,tower_size,3*sizeof(float));
-	aoi->tower_x_limit = (int)ceil(map_size[0] / tower_size[0]);
-	aoi->tower_y_limit = (int)ceil(map_size[1] / tower_size[1]);
-	aoi->tower_z_limit = (int)ceil(map_size[2] / tower_size[2]);
-	size = aoi->tower_x_limit*aoi->tower_y_limit*aoi->tower_z_limit;
-	aoi->towers = aoi->alloc(aoi->alloc_ud,NULL,size*sizeof(aoi_tower));
-	for (x=0; x<aoi->tower_x_limit; x++) {
-		for (y=0; y<aoi->tower_y_limit; y++) {
-			for (z=0; z<aoi->tower_z_limit; z++) {
-				aoi_tower *tower = get_tower(aoi,x,y,z);
-				tower->x = x;
-				tower->y = y;
-				tower->z = z;
-				tower->objects = set_new(aoi);
-			}
-		}
+static inline uint32_t
+tower_key(aoi_space *aoi,int x,int y,int z) {
+	return (uint32_t)x*aoi->tower_y_limit + y + (uint32_t)z*aoi->tower_x_limit*aoi->tower_y_limit;
+}
+
+// return NULL if tower is out of map or has no object
+static aoi_tower *
+get_tower(aoi_space *aoi,int x,int y,int z) {
+	if (!in_map(aoi,x,y,z)) {
+		return NULL;
 	}
-	aoi->objects = map_new(aoi);
-	aoi->set1 = set_new(aoi);
-	aoi->set2 = set_new(aoi);
-	aoi->result_set = set_new(aoi);
-	aoi->cb_enterAOI = cb_enterAOI;
-	aoi->cb_leaveAOI = cb_leaveAOI;
-	aoi->cb_ud = cb_ud;
-	return aoi;
+	return tower_map_get(aoi->towers,tower_key(aoi,x,y,z));
 }
 
-#if defined USE_IN_SKYNET
-	#define MALLOC(sz) skynet_malloc((sz))
-	#define FREE(ptr) skynet_free((ptr))
-#else
-	#define MALLOC(sz) malloc((sz))
-	#define FREE(ptr) free((ptr))
+static aoi_tower *
+touch_tower(aoi_space *aoi,int x,int y,int z) {
+	assert(in_map(aoi,x,y,z));
+	uint32_t key = tower_key(aoi,x,y,z);
+	aoi_tower *tower = tower_map_get(aoi->towers,key);
+	if (tower != NULL) {
+		return tower;
+	}
+	if (aoi->free_towers != NULL) {
+		tower = aoi->free_towers;
+		aoi->free_towers = tower->next_free;
+		aoi->free_tower_number--;
+	} else {
+		int i;
+		tower = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*tower));
+		tower->objects = set_new(aoi);
+		for (i=0; i<AOI_DIM; i++) {
+			tower->pos[i] = NULL;
+		}
+		tower->ids = NULL;
+		tower->cap = 0;
+	}
+	tower->key = key;
+	tower->x = x;
+	tower->y = y;
+#if !defined AOI_2D
+	tower->z = z;
 #endif
+	tower->next_free = NULL;
+	tower_map_insert(aoi,aoi->towers,tower);
+	return tower;
+}
 
-static void *
-default_alloc(void *ud,void *ptr,size_t sz) {
-	if (ptr == NULL) {
-		return MALLOC(sz);
+static void
+delete_tower(aoi_space *aoi,aoi_tower *tower) {
+	int i;
+	set_delete(aoi,tower->objects);
+	if (tower->cap > 0) {
+		for (i=0; i<AOI_DIM; i++) {
+			aoi->alloc(aoi->alloc_ud,tower->pos[i],tower->cap * sizeof(float));
+		}
+		aoi->alloc(aoi->alloc_ud,tower->ids,tower->cap * sizeof(uint32_t));
 	}
-	FREE(ptr);
-	return NULL;
+	aoi->alloc(aoi->alloc_ud,tower,sizeof(*tower));
 }
 
-aoi_space *
-aoi_new(float map_size[3],float tower_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
-	return aoi_create(default_alloc,NULL,map_size,tower_size,cb_enterAOI,cb_leaveAOI,cb_ud);
+static size_t
+tower_bytes(aoi_tower *tower) {
+	return sizeof(*tower) + set_bytes(tower->objects) + tower->cap * (AOI_DIM * sizeof(float) + sizeof(uint32_t));
 }
 
-void
-aoi_release(aoi_space *aoi) {
-	int i,size;
-	set_delete(aoi,aoi->set1);
-	set_delete(aoi,aoi->set2);
-	set_delete(aoi,aoi->result_set);
-	size = aoi->tower_x_limit*aoi->tower_y_limit*aoi->tower_z_limit;
-	for(i=0; i<size; i++) {
-		aoi_tower *tower = &aoi->towers[i];
-		set_delete(aoi,tower->objects);
+static void
+reclaim_tower(aoi_space *aoi,aoi_tower *tower) {
+	assert(tower->objects->number == 0);
+	tower_map_remove(aoi,aoi->towers,tower);
+	if (aoi->free_tower_number < MAX_FREE_TOWER && tower->objects->cap <= MAX_FREE_CAP) {
+		tower->next_free = aoi->free_towers;
+		aoi->free_towers = tower;
+		aoi->free_tower_number++;
+	} else {
+		delete_tower(aoi,tower);
 	}
-	aoi->alloc(aoi->alloc_ud,aoi->towers,size*sizeof(aoi_tower));
-	map_foreach(aoi->objects,delete_object,aoi);
-	map_delete(aoi,aoi->objects);
-	aoi->alloc(aoi->alloc_ud,aoi,sizeof(*aoi));
 }
 
-static bool
-change_mode(aoi_object *obj,const char *modestring) {
+static void
+tower_resize(aoi_space *aoi,aoi_tower *tower,int cap) {
 	int i;
-	bool change = false;
-	bool set_watcher = false;
-	bool set_marker = false;
-	for(i=0; modestring[i]; i++) {
-		switch(modestring[i]) {
-			case 'w':
-				set_watcher = true;
-				break;
-			case 'm':
-				set_marker = true;
-				break;
-			default:
-				break;
+	int number = tower->objects->number;
+	for (i=0; i<AOI_DIM; i++) {
+		float *pos = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(float));
+		if (tower->pos[i] != NULL) {
+			memcpy(pos,tower->pos[i],number * sizeof(float));
+			aoi->alloc(aoi->alloc_ud,tower->pos[i],tower->cap * sizeof(float));
 		}
+		tower->pos[i] = pos;
 	}
-	if (set_watcher) {
-		if (!(obj->mode & MODE_WATCHER)) {
-			obj->mode |= MODE_WATCHER;
+	uint32_t *ids = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+	if (tower->ids != NULL) {
+		memcpy(ids,tower->ids,number * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,tower->ids,tower->cap * sizeof(uint32_t));
+	}
+	tower->ids = ids;
+	tower->cap = cap;
+}
+
+static inline void
+tower_set(aoi_tower *tower,int k,aoi_object *obj) {
+	int i;
+	for (i=0; i<AOI_DIM; i++) {
+		tower->pos[i][k] = obj->pos[i];
+	}
+	tower->ids[k] = obj->id;
+}
+
+static void
+tower_add(aoi_space *aoi,aoi_tower *tower,aoi_object *obj) {
+	if (tower->objects->number >= tower->cap) {
+		tower_resize(aoi,tower,tower->cap == 0 ? PRE_ALLOC : tower->cap * 2);
+	}
+	obj->tower = tower;
+	obj->tower_index = tower->objects->number;
+	tower_set(tower,obj->tower_index,obj);
+	set_add(aoi,tower->objects,obj);
+}
+
+// O(1): move the last object into the hole
+static void
+tower_remove(aoi_space *aoi,aoi_tower *tower,aoi_object *obj) {
+	aoi_set *set = tower->objects;
+	int i = obj->tower_index;
+	assert(i >= 0 && i < set->number && set->slot[i] == obj);
+	aoi_object *last = set->slot[--set->number];
+	set->slot[i] = last;
+	last->tower_index = i;
+	tower_set(tower,i,last);
+	obj->tower = NULL;
+	obj->tower_index = -1;
+	if (set->number == 0) {
+		reclaim_tower(aoi,tower);
+	}
+}
+
+// obj stays in its tower,which also keeps the position
+static inline void
+set_position(aoi_object *obj,const float pos[3]) {
+	copy_position(obj->pos,pos);
+	tower_set(obj->tower,obj->tower_index,obj);
+}
+
+static inline bool
+out_of_around(aoi_space *aoi,int x,int y,int z) {
+	int r = aoi->radius;
+	return abs(x) > r || abs(y) > r || abs(z) > r;
+}
+
+// offsets of towers around (0,0,0) which are not around (dx,dy,dz),return number of offsets
+static int
+delta_offsets(aoi_space *aoi,int dx,int dy,int dz,aoi_offset *offsets) {
+	int x,y,z;
+	int r = aoi->radius;
+	int n = 0;
+	for (x=-r; x<=r; x++) {
+		for (y=-r; y<=r; y++) {
+			for (z=-AROUND_Z(r); z<=AROUND_Z(r); z++) {
+				if (out_of_around(aoi,x-dx,y-dy,z-dz)) {
+					if (offsets != NULL) {
+						aoi_offset *o = &offsets[n];
+						o->x = x; o->y = y; o->z = z;
+					}
+					n++;
+				}
+			}
+		}
+	}
+	return n;
+}
+
+static void
+build_deltas(aoi_space *aoi) {
+	int dx,dy,dz;
+	for (dx=-1; dx<=1; dx++) {
+		for (dy=-1; dy<=1; dy++) {
+			for (dz=-1; dz<=1; dz++) {
+				aoi_delta *delta = &aoi->deltas[DELTA_INDEX(dx,dy,dz)];
+				delta->enter_number = 0;
+				delta->leave_number = 0;
+				delta->offsets = NULL;
+				if ((dx == 0 && dy == 0 && dz == 0) || abs(dz) > AROUND_Z(1)) {
+					continue;
+				}
+				// enter towers are relative to the new tower(old tower is at -delta),
+				// leave towers are relative to the old tower(new tower is at +delta)
+				delta->enter_number = delta_offsets(aoi,-dx,-dy,-dz,NULL);
+				delta->leave_number = delta_offsets(aoi,dx,dy,dz,NULL);
+				size_t sz = (delta->enter_number + delta->leave_number) * sizeof(aoi_offset);
+				delta->offsets = aoi->alloc(aoi->alloc_ud,NULL,sz);
+				delta_offsets(aoi,-dx,-dy,-dz,delta->offsets);
+				delta_offsets(aoi,dx,dy,dz,delta->offsets + delta->enter_number);
+			}
+		}
+	}
+}
+
+static void
+delete_deltas(aoi_space *aoi) {
+	int i;
+	for (i=0; i<27; i++) {
+		aoi_delta *delta = &aoi->deltas[i];
+		if (delta->offsets != NULL) {
+			aoi->alloc(aoi->alloc_ud,delta->offsets,(delta->enter_number + delta->leave_number) * sizeof(aoi_offset));
+			delta->offsets = NULL;
+		}
+	}
+}
+
+static void
+event_grow(aoi_space *aoi) {
+	int cap = aoi->event_cap == 0 ? PRE_ALLOC : aoi->event_cap * 2;
+	aoi_event *events = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(aoi_event));
+	if (aoi->events != NULL) {
+		memcpy(events,aoi->events,aoi->event_number * sizeof(aoi_event));
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	aoi->events = events;
+	aoi->event_cap = cap;
+}
+
+static inline void
+event_push(aoi_space *aoi,uint32_t watcher,uint32_t marker,uint32_t type) {
+	if (aoi->event_number >= aoi->event_cap) {
+		event_grow(aoi);
+	}
+	aoi_event *ev = &aoi->events[aoi->event_number++];
+	ev->watcher = watcher;
+	ev->marker = marker;
+	ev->type = type;
+}
+
+static inline void
+emit_enter(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_ENTER);
+	} else {
+		aoi->cb_enterAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+static inline void
+emit_leave(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_LEAVE);
+	} else {
+		aoi->cb_leaveAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+// watchers are notified only when their view radius is radius
+static void
+enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,int radius) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	if ((watcher->mode & MODE_WATCHER) && watcher->radius == radius) {
+		emit_enter(aoi,watcher->id,marker->id);
+	}
+	if ((marker->mode & MODE_WATCHER) && marker->radius == radius) {
+		emit_enter(aoi,marker->id,watcher->id);
+	}
+}
+
+static void
+leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,int radius) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	if ((watcher->mode & MODE_WATCHER) && watcher->radius == radius) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+	if ((marker->mode & MODE_WATCHER) && marker->radius == radius) {
+		emit_leave(aoi,marker->id,watcher->id);
+	}
+}
+
+static void
+tower_notify(aoi_space *aoi,aoi_object *obj,int x,int y,int z,int radius,int flag) {
+	int i;
+	aoi_tower *tower = get_tower(aoi,x,y,z);
+	if (tower == NULL) {
+		return;
+	}
+	for (i=0; i<tower->objects->number; i++) {
+		aoi_object *temp = tower->objects->slot[i];
+		if (flag & NOTIFY_SELF) {
+			if (obj->id == temp->id || !(obj->mode & MODE_WATCHER)) {
+				continue;
+			}
+			if (flag & NOTIFY_ENTER) {
+				emit_enter(aoi,obj->id,temp->id);
+			} else {
+				emit_leave(aoi,obj->id,temp->id);
+			}
+		} else if (flag & NOTIFY_ENTER) {
+			enterAOI(aoi,obj,temp,radius);
+		} else {
+			leaveAOI(aoi,obj,temp,radius);
+		}
+	}
+}
+
+// notify towers in box which are not in except(may be NULL),
+// only towers in the difference of two boxes are visited
+static void
+around_notify(aoi_space *aoi,aoi_object *obj,aoi_box *box,aoi_box *except,int flag) {
+	int i,j,k;
+	int r = box->r;
+	int rz = AROUND_Z(r);
+	for (i=box->x-r; i<=box->x+r; i++) {
+		bool share_x = except != NULL && abs(i-except->x) <= except->r;
+		for (j=box->y-r; j<=box->y+r; j++) {
+			bool share_xy = share_x && abs(j-except->y) <= except->r;
+			for (k=box->z-rz; k<=box->z+rz; k++) {
+				if (share_xy && abs(k-except->z) <= AROUND_Z(except->r)) {
+					// jump over the shared part of this line
+					k = except->z + AROUND_Z(except->r);
+					continue;
+				}
+				tower_notify(aoi,obj,i,j,k,r,flag);
+			}
+		}
+	}
+}
+
+// notify around (x,y,z) for every view radius in use
+static void
+view_notify(aoi_space *aoi,aoi_object *obj,int x,int y,int z,int flag) {
+	int r;
+	for (r=0; r<=MAX_RADIUS; r++) {
+		if (aoi->radius_count[r] > 0) {
+			aoi_box box = {x,y,z,r};
+			around_notify(aoi,obj,&box,NULL,flag);
+		}
+	}
+}
+
+static void
+watcher_count(aoi_space *aoi,aoi_object *obj,int n) {
+	if (obj->mode & MODE_WATCHER) {
+		aoi->radius_count[obj->radius] += n;
+		assert(aoi->radius_count[obj->radius] >= 0);
+	}
+}
+
+aoi_space *
+aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float tower_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	aoi_space *aoi = alloc(alloc_ud,NULL,sizeof(*aoi));
+	aoi->alloc = alloc;
+	aoi->alloc_ud = alloc_ud;
+	aoi->slab = NULL;
+	aoi->free_objects = NULL;
+	memcpy(aoi->map_size,map_size,3*sizeof(float));
+	memcpy(aoi->tower_size,tower_size,3*sizeof(float));
+	aoi->tower_x_limit = (int)ceil(map_size[0] / tower_size[0]);
+	aoi->tower_y_limit = (int)ceil(map_size[1] / tower_size[1]);
+#if defined AOI_2D
+	aoi->tower_z_limit = 1;
+#else
+	aoi->tower_z_limit = (int)ceil(map_size[2] / tower_size[2]);
+#endif
+	assert((double)aoi->tower_x_limit*aoi->tower_y_limit*aoi->tower_z_limit <= (double)UINT32_MAX);
+	// towers are allocated on first use,so memory only depends on occupied towers
+	aoi->towers = tower_map_new(aoi,PRE_ALLOC);
+	aoi->free_towers = NULL;
+	aoi->free_tower_number = 0;
+	aoi->radius = 1;
+	aoi->hysteresis = 0;
+	memset(aoi->radius_count,0,sizeof(aoi->radius_count));
+	aoi->objects = map_new(aoi);
+	build_deltas(aoi);
+	aoi->result_set = set_new(aoi);
+	aoi->batch = NULL;
+	aoi->batch_cap = 0;
+	aoi->batch_towers = set_new(aoi);
+	aoi->cb_enterAOI = cb_enterAOI;
+	aoi->cb_leaveAOI = cb_leaveAOI;
+	aoi->cb_ud = cb_ud;
+	assert((cb_enterAOI == NULL) == (cb_leaveAOI == NULL));
+	aoi->events = NULL;
+	aoi->event_number = 0;
+	aoi->event_cap = 0;
+	aoi->buffered = cb_enterAOI == NULL;
+	aoi->defer = false;
+	aoi->pending_ids = NULL;
+	aoi->pending_pos = NULL;
+	aoi->pending_number = 0;
+	aoi->pending_cap = 0;
+	return aoi;
+}
+
+#if defined USE_IN_SKYNET
+	#define MALLOC(sz) skynet_malloc((sz))
+	#define FREE(ptr) skynet_free((ptr))
+#else
+	#define MALLOC(sz) malloc((sz))
+	#define FREE(ptr) free((ptr))
+#endif
+
+static void *
+default_alloc(void *ud,void *ptr,size_t sz) {
+	if (ptr == NULL) {
+		return MALLOC(sz);
+	}
+	FREE(ptr);
+	return NULL;
+}
+
+aoi_space *
+aoi_new(float map_size[3],float tower_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	return aoi_create(default_alloc,NULL,map_size,tower_size,cb_enterAOI,cb_leaveAOI,cb_ud);
+}
+
+void
+aoi_release(aoi_space *aoi) {
+	int i;
+	delete_deltas(aoi);
+	set_delete(aoi,aoi->result_set);
+	set_delete(aoi,aoi->batch_towers);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	for(i=0; i<aoi->towers->size; i++) {
+		aoi_tower *tower = aoi->towers->slot[i];
+		if (tower != NULL) {
+			delete_tower(aoi,tower);
+		}
+	}
+	tower_map_delete(aoi,aoi->towers);
+	while (aoi->free_towers != NULL) {
+		aoi_tower *tower = aoi->free_towers;
+		aoi->free_towers = tower->next_free;
+		delete_tower(aoi,tower);
+	}
+	map_foreach(aoi->objects,delete_object,aoi);
+	map_delete(aoi,aoi->objects);
+	slab_delete(aoi);
+	if (aoi->events != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	if (aoi->pending_ids != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+	}
+	aoi->alloc(aoi->alloc_ud,aoi,sizeof(*aoi));
+}
+
+aoi_event *
+aoi_poll_events(aoi_space *aoi,int *number) {
+	*number = aoi->event_number;
+	aoi->event_number = 0;
+	return aoi->events;
+}
+
+void
+aoi_set_radius(aoi_space *aoi,int radius) {
+	// neighbourhoods can only be changed in an empty space
+	assert(aoi->towers->number == 0);
+	if (radius < 1 || radius > MAX_RADIUS || radius == aoi->radius) {
+		return;
+	}
+	delete_deltas(aoi);
+	aoi->radius = radius;
+	build_deltas(aoi);
+}
+
+void
+aoi_set_dense_id(aoi_space *aoi,uint32_t max_id) {
+	map_set_dense(aoi,aoi->objects,max_id);
+}
+
+void
+aoi_set_hysteresis(aoi_space *aoi,float margin) {
+	int i;
+	assert(margin >= 0);
+	for (i=0; i<AOI_DIM; i++) {
+		// an object never sticks to a tower beyond its neighbours
+		assert(margin < aoi->tower_size[i]);
+	}
+	aoi->hysteresis = margin;
+}
+
+static bool
+change_mode(aoi_object *obj,const char *modestring) {
+	int i;
+	bool change = false;
+	bool set_watcher = false;
+	bool set_marker = false;
+	for(i=0; modestring[i]; i++) {
+		switch(modestring[i]) {
+			case 'w':
+				set_watcher = true;
+				break;
+			case 'm':
+				set_marker = true;
+				break;
+			default:
+				break;
+		}
+	}
+	if (set_watcher) {
+		if (!(obj->mode & MODE_WATCHER)) {
+			obj->mode |= MODE_WATCHER;
 			change = true;
 		}
 	} else {
@@ -512,52 +1333,128 @@ change_mode(aoi_object *obj,const char *modestring) {
 
 void
 aoi_enter(aoi_space *aoi,uint32_t id,float pos[3],const char *modestring) {
+	if (aoi->objects->max_id != 0 && id >= aoi->objects->max_id) {
+		return;
+	}
 	aoi_object *old_obj = get_object(aoi,id);
 	if (old_obj != NULL) {
 		aoi_leave(aoi,id);
 	}
-	int i,j;
 	int x,y,z;
 	pos2xyz(aoi,pos,&x,&y,&z);
-	aoi_tower *tower = get_tower(aoi,x,y,z);
-	if (tower == NULL) {
+	if (!in_map(aoi,x,y,z)) {
 		return;
 	}
+	aoi_tower *tower = touch_tower(aoi,x,y,z);
 	aoi_object *obj = new_object(aoi,id);
 	change_mode(obj,modestring);
 	copy_position(obj->pos,pos);
 	map_insert(aoi,aoi->objects,id,obj);
-	set_add(aoi,tower->objects,obj);
-	around_towers(aoi,tower,aoi->result_set);
-	for (i=0; i<aoi->result_set->number; i++) {
-		tower = (aoi_tower*)aoi->result_set->slot[i];
-		for (j=0; j<tower->objects->number; j++) {
-			enterAOI(aoi,obj,tower->objects->slot[j]);
+	tower_add(aoi,tower,obj);
+	watcher_count(aoi,obj,1);
+	view_notify(aoi,obj,x,y,z,NOTIFY_ENTER);
+}
+static void
+pending_add(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	if (obj->pending_index < 0) {
+		if (aoi->pending_number >= aoi->pending_cap) {
+			int cap = aoi->pending_cap == 0 ? PRE_ALLOC : aoi->pending_cap * 2;
+			uint32_t *ids = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+			float (*pos)[3] = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(float[3]));
+			if (aoi->pending_ids != NULL) {
+				memcpy(ids,aoi->pending_ids,aoi->pending_number * sizeof(uint32_t));
+				memcpy(pos,aoi->pending_pos,aoi->pending_number * sizeof(float[3]));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+			}
+			aoi->pending_ids = ids;
+			aoi->pending_pos = pos;
+			aoi->pending_cap = cap;
 		}
+		obj->pending_index = aoi->pending_number++;
+		aoi->pending_ids[obj->pending_index] = obj->id;
 	}
+	copy_position(aoi->pending_pos[obj->pending_index],pos);
 }
+
+static void
+pending_remove(aoi_space *aoi,aoi_object *obj) {
+	int index = obj->pending_index;
+	if (index < 0) {
+		return;
+	}
+	int last = --aoi->pending_number;
+	if (index != last) {
+		aoi->pending_ids[index] = aoi->pending_ids[last];
+		copy_position(aoi->pending_pos[index],aoi->pending_pos[last]);
+		get_object(aoi,aoi->pending_ids[index])->pending_index = index;
+	}
+	obj->pending_index = -1;
+}
+
 void
 aoi_leave(aoi_space *aoi,uint32_t id) {
 	aoi_object *obj = get_object(aoi,id);
 	if (obj == NULL) {
 		return;
 	}
-	int i,j;
+	pending_remove(aoi,obj);
 	int x,y,z;
-	pos2xyz(aoi,obj->pos,&x,&y,&z);
-	aoi_tower *tower = get_tower(aoi,x,y,z);
-	assert(tower != NULL);
-	aoi_object *tmp = map_remove(aoi->objects,id);
+	aoi_tower *tower = obj->tower;
+	object_xyz(obj,&x,&y,&z);
+	aoi_object *tmp = map_remove(aoi,aoi->objects,id);
 	assert(tmp == obj);
-	set_remove(aoi,tower->objects,obj);
-	around_towers(aoi,tower,aoi->result_set);
-	for (i=0; i<aoi->result_set->number; i++) {
-		tower = (aoi_tower*)aoi->result_set->slot[i];
-		for (j=0; j<tower->objects->number; j++) {
-			leaveAOI(aoi,obj,tower->objects->slot[j]);
+	tower_remove(aoi,tower,obj);
+	view_notify(aoi,obj,x,y,z,NOTIFY_LEAVE);
+	watcher_count(aoi,obj,-1);
+	delete_object(aoi,obj);
+}
+
+static inline bool
+is_neighbour(int dx,int dy,int dz) {
+	return abs(dx) <= 1 && abs(dy) <= 1 && abs(dz) <= 1;
+}
+
+static void
+move_tower(aoi_space *aoi,aoi_object *obj,int old_x,int old_y,int old_z,int x,int y,int z) {
+	aoi_tower *old_tower = obj->tower;
+	assert(old_tower != NULL && old_tower == get_tower(aoi,old_x,old_y,old_z));
+	tower_remove(aoi,old_tower,obj);
+	aoi_tower *new_tower = touch_tower(aoi,x,y,z);
+	tower_add(aoi,new_tower,obj);
+}
+
+// notify towers entering/leaving the neighbourhood of every view radius in use,
+// skip_radius(if >= 0) is already handled by caller
+static void
+move_notify(aoi_space *aoi,aoi_object *obj,int old_x,int old_y,int old_z,int x,int y,int z,int skip_radius) {
+	int i,r;
+	int dx = x - old_x;
+	int dy = y - old_y;
+	int dz = z - old_z;
+	bool neighbour = is_neighbour(dx,dy,dz);
+	for (r=0; r<=MAX_RADIUS; r++) {
+		if (aoi->radius_count[r] == 0 || r == skip_radius) {
+			continue;
+		}
+		if (r == aoi->radius && neighbour) {
+			aoi_delta *delta = &aoi->deltas[DELTA_INDEX(dx,dy,dz)];
+			aoi_offset *o = delta->offsets;
+			// enter aoi
+			for (i=0; i<delta->enter_number; i++,o++) {
+				tower_notify(aoi,obj,x+o->x,y+o->y,z+o->z,r,NOTIFY_ENTER);
+			}
+			// leave aoi
+			for (i=0; i<delta->leave_number; i++,o++) {
+				tower_notify(aoi,obj,old_x+o->x,old_y+o->y,old_z+o->z,r,NOTIFY_LEAVE);
+			}
+		} else {
+			aoi_box old_box = {old_x,old_y,old_z,r};
+			aoi_box new_box = {x,y,z,r};
+			around_notify(aoi,obj,&new_box,&old_box,NOTIFY_ENTER);
+			around_notify(aoi,obj,&old_box,&new_box,NOTIFY_LEAVE);
 		}
 	}
-	delete_object(aoi,obj);
 }
 
 void
@@ -566,42 +1463,274 @@ aoi_move(aoi_space *aoi,uint32_t id,float pos[3]) {
 	if (obj == NULL) {
 		return;
 	}
-	int i,j;
+	if (aoi->defer) {
+		pending_add(aoi,obj,pos);
+		return;
+	}
 	int old_x,old_y,old_z;
 	int x,y,z;
-	pos2xyz(aoi,obj->pos,&old_x,&old_y,&old_z);
+	object_xyz(obj,&old_x,&old_y,&old_z);
 	pos2xyz(aoi,pos,&x,&y,&z);
-	aoi_tower *old_tower = get_tower(aoi,old_x,old_y,old_z);
-	aoi_tower *new_tower = get_tower(aoi,x,y,z);
-	assert(old_tower != NULL);
-	if (old_tower == NULL || new_tower == NULL) {
+	if (!in_map(aoi,x,y,z)) {
 		return;
 	}
-	copy_position(obj->pos,pos);
-	if (old_tower != new_tower) {
-		set_remove(aoi,old_tower->objects,obj);
-		set_add(aoi,new_tower->objects,obj);
-		around_towers(aoi,old_tower,aoi->set1);
-		around_towers(aoi,new_tower,aoi->set2);
-		// enter aoi
-		set_difference(aoi,aoi->set2,aoi->set1,aoi->result_set);
-		for (i=0; i<aoi->result_set->number; i++) {
-			aoi_tower *tower = (aoi_tower*)aoi->result_set->slot[i];
-			for (j=0; j<tower->objects->number; j++) {
-				enterAOI(aoi,obj,tower->objects->slot[j]);
+	stick_tower(aoi,obj,pos,&x,&y,&z);
+	set_position(obj,pos);
+	if (old_x == x && old_y == y && old_z == z) {
+		return;
+	}
+	move_tower(aoi,obj,old_x,old_y,old_z,x,y,z);
+	move_notify(aoi,obj,old_x,old_y,old_z,x,y,z,-1);
+}
+
+static int
+batch_compare(const void *a,const void *b) {
+	const aoi_batch_move *m1 = a;
+	const aoi_batch_move *m2 = b;
+	if (m1->old_key != m2->old_key) {
+		return m1->old_key < m2->old_key ? -1 : 1;
+	}
+	if (m1->key != m2->key) {
+		return m1->key < m2->key ? -1 : 1;
+	}
+	return 0;
+}
+
+// resolve towers of a delta once for a group of objects moving between the same two towers
+static void
+batch_towers(aoi_space *aoi,aoi_batch_move *m,aoi_delta *delta) {
+	int i;
+	aoi_offset *o = delta->offsets;
+	aoi_set *set = aoi->batch_towers;
+	set->number = 0;
+	for (i=0; i<delta->enter_number; i++,o++) {
+		set_add(aoi,set,get_tower(aoi,m->x+o->x,m->y+o->y,m->z+o->z));
+	}
+	for (i=0; i<delta->leave_number; i++,o++) {
+		set_add(aoi,set,get_tower(aoi,m->old_x+o->x,m->old_y+o->y,m->old_z+o->z));
+	}
+}
+
+static void
+batch_notify(aoi_space *aoi,aoi_object *obj,aoi_delta *delta) {
+	int i,j;
+	int r = aoi->radius;
+	aoi_set *set = aoi->batch_towers;
+	for (i=0; i<set->number; i++) {
+		aoi_tower *tower = set->slot[i];
+		if (tower == NULL) {
+			continue;
+		}
+		bool enter = i < delta->enter_number;
+		for (j=0; j<tower->objects->number; j++) {
+			if (enter) {
+				enterAOI(aoi,obj,tower->objects->slot[j],r);
+			} else {
+				leaveAOI(aoi,obj,tower->objects->slot[j],r);
 			}
 		}
-		// leave aoi
-		set_difference(aoi,aoi->set1,aoi->set2,aoi->result_set);
-		for (i=0; i<aoi->result_set->number; i++) {
-			aoi_tower *tower = (aoi_tower*)aoi->result_set->slot[i];
-			for (j=0; j<tower->objects->number; j++) {
-				leaveAOI(aoi,obj,tower->objects->slot[j]);
+	}
+}
+
+void
+aoi_move_batch(aoi_space *aoi,const uint32_t *ids,const float (*pos)[3],int n) {
+	int i,j;
+	int number = 0;
+	if (n <= 0) {
+		return;
+	}
+	if (aoi->defer) {
+		for (i=0; i<n; i++) {
+			aoi_object *obj = get_object(aoi,ids[i]);
+			if (obj != NULL) {
+				pending_add(aoi,obj,pos[i]);
+			}
+		}
+		return;
+	}
+	if (n > aoi->batch_cap) {
+		if (aoi->batch != NULL) {
+			aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		}
+		aoi->batch_cap = n;
+		aoi->batch = aoi->alloc(aoi->alloc_ud,NULL,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	// update positions and collect tower crossings,the last position of an object wins
+	for (i=0; i<n; i++) {
+		aoi_object *obj = get_object(aoi,ids[i]);
+		if (obj == NULL) {
+			continue;
+		}
+		int x,y,z;
+		pos2xyz(aoi,pos[i],&x,&y,&z);
+		if (!in_map(aoi,x,y,z)) {
+			continue;
+		}
+		stick_tower(aoi,obj,pos[i],&x,&y,&z);
+		aoi_batch_move *m;
+		if (obj->batch_index >= 0) {
+			m = &aoi->batch[obj->batch_index];
+		} else {
+			int old_x,old_y,old_z;
+			object_xyz(obj,&old_x,&old_y,&old_z);
+			if (old_x == x && old_y == y && old_z == z) {
+				set_position(obj,pos[i]);
+				continue;
 			}
+			obj->batch_index = number;
+			m = &aoi->batch[number++];
+			m->obj = obj;
+			m->old_x = old_x;
+			m->old_y = old_y;
+			m->old_z = old_z;
+			m->old_key = tower_key(aoi,old_x,old_y,old_z);
+		}
+		m->x = x;
+		m->y = y;
+		m->z = z;
+		m->key = tower_key(aoi,x,y,z);
+		set_position(obj,pos[i]);
+	}
+	for (i=0; i<number; i++) {
+		aoi->batch[i].obj->batch_index = -1;
+	}
+	// objects moving between the same two towers share tower lookups
+	qsort(aoi->batch,number,sizeof(aoi_batch_move),batch_compare);
+	for (i=0; i<number; i=j) {
+		aoi_batch_move *m = &aoi->batch[i];
+		for (j=i+1; j<number; j++) {
+			if (batch_compare(m,&aoi->batch[j]) != 0) {
+				break;
+			}
+		}
+		if (m->old_key == m->key) {
+			continue;
+		}
+		int dx = m->x - m->old_x;
+		int dy = m->y - m->old_y;
+		int dz = m->z - m->old_z;
+		if (j - i == 1 || !is_neighbour(dx,dy,dz) || aoi->radius_count[aoi->radius] == 0) {
+			for (; i<j; i++) {
+				m = &aoi->batch[i];
+				move_tower(aoi,m->obj,m->old_x,m->old_y,m->old_z,m->x,m->y,m->z);
+				move_notify(aoi,m->obj,m->old_x,m->old_y,m->old_z,m->x,m->y,m->z,-1);
+			}
+			continue;
+		}
+		aoi_delta *delta = &aoi->deltas[DELTA_INDEX(dx,dy,dz)];
+		// old and new tower are never in the delta,so resolved towers stay valid for the group
+		batch_towers(aoi,m,delta);
+		for (; i<j; i++) {
+			m = &aoi->batch[i];
+			move_tower(aoi,m->obj,m->old_x,m->old_y,m->old_z,m->x,m->y,m->z);
+			batch_notify(aoi,m->obj,delta);
+			move_notify(aoi,m->obj,m->old_x,m->old_y,m->old_z,m->x,m->y,m->z,aoi->radius);
 		}
 	}
 }
 
+// while coalescing,type holds the production index above the enter bit
+static int
+event_compare(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->watcher != ev2->watcher) {
+		return ev1->watcher < ev2->watcher ? -1 : 1;
+	}
+	if (ev1->marker != ev2->marker) {
+		return ev1->marker < ev2->marker ? -1 : 1;
+	}
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+event_order(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+// events of a pair alternate,so only the last one of each pair with a net change is kept,
+// the kept events are put back in production order
+static void
+event_coalesce(aoi_space *aoi,int start) {
+	int i,j;
+	int n = 0;
+	aoi_event *events = aoi->events + start;
+	int number = aoi->event_number - start;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		events[i].type = (uint32_t)i << 1 | (events[i].type == AOI_EVENT_ENTER);
+	}
+	qsort(events,number,sizeof(aoi_event),event_compare);
+	for (i=0; i<number; i=j) {
+		int net = 0;
+		for (j=i; j<number && events[j].watcher == events[i].watcher && events[j].marker == events[i].marker; j++) {
+			net += (events[j].type & 1) ? 1 : -1;
+		}
+		assert(net >= -1 && net <= 1);
+		if (net != 0) {
+			assert((events[j-1].type & 1) == (net > 0));
+			events[n++] = events[j-1];
+		}
+	}
+	if (n > 0) {
+		qsort(events,n,sizeof(aoi_event),event_order);
+	}
+	for (i=0; i<n; i++) {
+		events[i].type = (events[i].type & 1) ? AOI_EVENT_ENTER : AOI_EVENT_LEAVE;
+	}
+	aoi->event_number = start + n;
+}
+
+void
+aoi_set_defer(aoi_space *aoi,int defer) {
+	if (!defer) {
+		aoi_update(aoi);
+	}
+	aoi->defer = defer != 0;
+}
+
+void
+aoi_update(aoi_space *aoi) {
+	int i;
+	int number = aoi->pending_number;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		get_object(aoi,aoi->pending_ids[i])->pending_index = -1;
+	}
+	aoi->pending_number = 0;
+	int start = aoi->event_number;
+	bool buffered = aoi->buffered;
+	aoi->buffered = true;
+	aoi->defer = false;
+	aoi_move_batch(aoi,aoi->pending_ids,(const float (*)[3])aoi->pending_pos,number);
+	aoi->defer = true;
+	aoi->buffered = buffered;
+	event_coalesce(aoi,start);
+	if (!buffered) {
+		for (i=start; i<aoi->event_number; i++) {
+			aoi_event *ev = &aoi->events[i];
+			if (ev->type == AOI_EVENT_ENTER) {
+				aoi->cb_enterAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			} else {
+				aoi->cb_leaveAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			}
+		}
+		aoi->event_number = start;
+	}
+}
+
 void
 aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring) {
 	aoi_object *obj = get_object(aoi,id);
@@ -609,43 +1738,117 @@ aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring) {
 		return;
 	}
 	bool is_marker = !(obj->mode & MODE_WATCHER);
+	watcher_count(aoi,obj,-1);
 	change_mode(obj,modestring);
+	watcher_count(aoi,obj,1);
 	bool is_watcher = obj->mode & MODE_WATCHER;
 	if (is_marker && is_watcher) {
-		int i,j;
 		int x,y,z;
-		pos2xyz(aoi,obj->pos,&x,&y,&z);
-		aoi_tower *tower = get_tower(aoi,x,y,z);
-		around_towers(aoi,tower,aoi->result_set);
-		for (i=0; i<aoi->result_set->number; i++) {
-			tower = (aoi_tower*)aoi->result_set->slot[i];
-			for (j=0; j<tower->objects->number; j++) {
-				aoi_object *temp = tower->objects->slot[j];
-				if (obj->id == temp->id) {
-					continue;
-				}
-				if (obj->mode & MODE_WATCHER) {
-					aoi->cb_enterAOI(aoi->cb_ud,obj->id,temp->id);
-				}
+		object_xyz(obj,&x,&y,&z);
+		aoi_box box = {x,y,z,obj->radius};
+		around_notify(aoi,obj,&box,NULL,NOTIFY_ENTER|NOTIFY_SELF);
+	}
+}
+
+void
+aoi_set_view_range(aoi_space *aoi,uint32_t id,float range[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	int i;
+	int radius = aoi->radius;
+	if (range != NULL) {
+		radius = 0;
+		for (i=0; i<AOI_DIM; i++) {
+			int r = (int)ceil(range[i] / aoi->tower_size[i]);
+			if (r > radius) {
+				radius = r;
 			}
 		}
+		if (radius > MAX_RADIUS) {
+			radius = MAX_RADIUS;
+		}
+	}
+	if (radius == obj->radius) {
+		return;
+	}
+	int x,y,z;
+	object_xyz(obj,&x,&y,&z);
+	aoi_box old_box = {x,y,z,obj->radius};
+	aoi_box new_box = {x,y,z,radius};
+	watcher_count(aoi,obj,-1);
+	obj->radius = radius;
+	watcher_count(aoi,obj,1);
+	// only the view of obj changes,others still see obj with their own radius
+	if (new_box.r > old_box.r) {
+		around_notify(aoi,obj,&new_box,&old_box,NOTIFY_ENTER|NOTIFY_SELF);
+	} else {
+		around_notify(aoi,obj,&old_box,&new_box,NOTIFY_LEAVE|NOTIFY_SELF);
 	}
 }
 
-void **
-aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
-	int i,j;
+static void
+filter_tower(aoi_space *aoi,aoi_tower *tower,float pos[3],float range[3],aoi_set *set,aoi_result *result) {
+	int i = 0;
+	int j;
+	int number = tower->objects->number;
+	if (range == NULL) {
+		for(; i<number; i++) {
+			query_add(aoi,set,result,tower->ids[i]);
+		}
+		return;
+	}
+#if defined(__SSE__)
+	// 4 objects a time,bits of out are objects with |pos-center| > range on some axis
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 center[AOI_DIM];
+	__m128 size[AOI_DIM];
+	for(j=0; j<AOI_DIM; j++) {
+		center[j] = _mm_set1_ps(pos[j]);
+		size[j] = _mm_set1_ps(range[j]);
+	}
+	for(; i+4 <= number; i+=4) {
+		__m128 out = _mm_setzero_ps();
+		for(j=0; j<AOI_DIM; j++) {
+			__m128 d = _mm_andnot_ps(sign,_mm_sub_ps(_mm_loadu_ps(tower->pos[j]+i),center[j]));
+			out = _mm_or_ps(out,_mm_cmpgt_ps(d,size[j]));
+		}
+		int mask = ~_mm_movemask_ps(out) & 0xf;
+		while (mask != 0) {
+			query_add(aoi,set,result,tower->ids[i+__builtin_ctz(mask)]);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for(; i<number; i++) {
+		for(j=0; j<AOI_DIM; j++) {
+			if(fabs(tower->pos[j][i]-pos[j]) > range[j]) {
+				break;
+			}
+		}
+		if (j == AOI_DIM) {
+			query_add(aoi,set,result,tower->ids[i]);
+		}
+	}
+}
+
+// the radius box of a watcher centers on its tower,which may lag behind pos within hysteresis
+static void
+query_view(aoi_space *aoi,float pos[3],float range[3],int radius,aoi_object *watcher,aoi_set *set,aoi_result *result) {
+	int i;
 	int x,y,z;
 	int x2,y2,z2;
 	int x3,y3,z3;
 	float pos2[3];
 	float pos3[3];
-	pos2xyz(aoi,pos,&x,&y,&z);
-	aoi->result_set->number = 0;
-	aoi_tower *tower = get_tower(aoi,x,y,z);
-	if (tower == NULL) {
-		*number = 0;
-		return NULL;
+	if (watcher != NULL) {
+		object_xyz(watcher,&x,&y,&z);
+	} else {
+		pos2xyz(aoi,pos,&x,&y,&z);
+		if (!in_map(aoi,x,y,z)) {
+			return;
+		}
 	}
 	if (range != NULL) {
 		for(i=0; i<3; i++) {
@@ -656,39 +1859,58 @@ aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
 		}
 		pos2xyz(aoi,pos2,&x2,&y2,&z2);
 		pos2xyz(aoi,pos3,&x3,&y3,&z3);
+		if (aoi->hysteresis > 0) {
+			// objects within hysteresis past a tower edge are still in the old tower
+			int rz = AROUND_Z(1);
+			x2 = x2-1 < 0 ? 0 : x2-1;
+			y2 = y2-1 < 0 ? 0 : y2-1;
+			z2 = z2-rz < 0 ? 0 : z2-rz;
+			x3 = x3+1 > aoi->tower_x_limit ? aoi->tower_x_limit : x3+1;
+			y3 = y3+1 > aoi->tower_y_limit ? aoi->tower_y_limit : y3+1;
+			z3 = z3+rz > aoi->tower_z_limit ? aoi->tower_z_limit : z3+rz;
+		}
 	} else {
-		x2 = x-1 < 0 ? 0 : x-1;
-		y2 = y-1 < 0 ? 0 : y-1;
-		z2 = z-1 < 0 ? 0 : z-1;
-		x3 = x+1 > aoi->tower_x_limit ? aoi->tower_x_limit : x+1;
-		y3 = y+1 > aoi->tower_y_limit ? aoi->tower_y_limit : y+1;
-		z3 = z+1 > aoi->tower_z_limit ? aoi->tower_z_limit : z+1;
-	}
-	for(x=x2; x<=x3; x++) {
-		for(y=y2; y<=y3; y++) {
-			for(z=z2; z<=z3; z++) {
-				tower = get_tower(aoi,x,y,z);
-				if (tower == NULL) {
-					continue;
-				}
-				for(i=0; i<tower->objects->number; i++) {
-					aoi_object *obj = tower->objects->slot[i];
-					bool inrange = true;
-					if (range != NULL) {
-						for(j=0; j<3; j++) {
-							if(fabs(obj->pos[j]-pos[j]) > range[j]) {
-								inrange = false;
-								break;
-							}
-						}
-					}
-					if (inrange) {
-						set_add(aoi,aoi->result_set,(void*)obj->id);
+		int r = radius;
+		int rz = AROUND_Z(r);
+		x2 = x-r < 0 ? 0 : x-r;
+		y2 = y-r < 0 ? 0 : y-r;
+		z2 = z-rz < 0 ? 0 : z-rz;
+		x3 = x+r > aoi->tower_x_limit ? aoi->tower_x_limit : x+r;
+		y3 = y+r > aoi->tower_y_limit ? aoi->tower_y_limit : y+r;
+		z3 = z+rz > aoi->tower_z_limit ? aoi->tower_z_limit : z+rz;
+	}
+	double volume = (double)(x3-x2+1)*(y3-y2+1)*(z3-z2+1);
+	if (volume > aoi->towers->number) {
+		// big range on a sparse map: walk occupied towers instead of the whole box
+		for(i=0; i<aoi->towers->size; i++) {
+			aoi_tower *tower = aoi->towers->slot[i];
+			if (tower == NULL ||
+				tower->x < x2 || tower->x > x3 ||
+				tower->y < y2 || tower->y > y3 ||
+				TOWER_Z(tower) < z2 || TOWER_Z(tower) > z3) {
+				continue;
+			}
+			filter_tower(aoi,tower,pos,range,set,result);
+		}
+	} else {
+		for(x=x2; x<=x3; x++) {
+			for(y=y2; y<=y3; y++) {
+				for(z=z2; z<=z3; z++) {
+					aoi_tower *tower = get_tower(aoi,x,y,z);
+					if (tower == NULL) {
+						continue;
 					}
+					filter_tower(aoi,tower,pos,range,set,result);
 				}
 			}
 		}
 	}
+}
+
+void **
+aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
+	aoi->result_set->number = 0;
+	query_view(aoi,pos,range,aoi->radius,NULL,aoi->result_set,NULL);
 	*number = aoi->result_set->number;
 	return aoi->result_set->slot;
 }
@@ -700,5 +1922,110 @@ aoi_get_view(aoi_space *aoi,uint32_t id,float range[3],int *number) {
 		*number = 0;
 		return NULL;
 	}
-	return aoi_get_view_by_pos(aoi,obj->pos,range,number);
+	aoi->result_set->number = 0;
+	query_view(aoi,obj->pos,range,obj->radius,obj,aoi->result_set,NULL);
+	*number = aoi->result_set->number;
+	return aoi->result_set->slot;
+}
+
+int
+aoi_query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],uint32_t *ids,int cap) {
+	aoi_result result = {ids,cap,0};
+	query_view(aoi,pos,range,aoi->radius,NULL,NULL,&result);
+	return result.number;
+}
+
+int
+aoi_query_view(aoi_space *aoi,uint32_t id,float range[3],uint32_t *ids,int cap) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return 0;
+	}
+	aoi_result result = {ids,cap,0};
+	query_view(aoi,obj->pos,range,obj->radius,obj,NULL,&result);
+	return result.number;
+}
+
+void
+aoi_memory_stats(aoi_space *aoi,aoi_memory *stats) {
+	int i;
+	aoi_slab *slab;
+	aoi_tower *tower;
+	memset(stats,0,sizeof(*stats));
+	stats->object_number = aoi->objects->number;
+	for (slab=aoi->slab; slab != NULL; slab=slab->next) {
+		stats->object_cap += SLAB_OBJECT;
+		stats->object_bytes += sizeof(aoi_slab);
+	}
+	map_stats(aoi->objects,stats);
+	stats->index_bytes = sizeof(*aoi->towers) + aoi->towers->size * sizeof(aoi_tower*);
+	for (i=0; i<aoi->towers->size; i++) {
+		tower = aoi->towers->slot[i];
+		if (tower != NULL) {
+			stats->index_number++;
+			stats->index_used += tower->objects->number;
+			stats->index_cap += tower->objects->cap;
+			stats->index_bytes += tower_bytes(tower);
+		}
+	}
+	// free towers keep their sets for reuse
+	for (tower=aoi->free_towers; tower != NULL; tower=tower->next_free) {
+		stats->index_cap += tower->objects->cap;
+		stats->index_bytes += tower_bytes(tower);
+	}
+	set_stats(aoi->result_set,stats);
+	set_stats(aoi->batch_towers,stats);
+	stats->buffer_bytes = aoi->event_cap * sizeof(aoi_event)
+		+ aoi->pending_cap * (sizeof(uint32_t) + sizeof(float[3]))
+		+ aoi->batch_cap * sizeof(aoi_batch_move);
+	stats->total = sizeof(*aoi) + stats->object_bytes + stats->map_bytes + stats->index_bytes
+		+ stats->set_bytes + stats->buffer_bytes;
+	for (i=0; i<27; i++) {
+		aoi_delta *delta = &aoi->deltas[i];
+		stats->total += (delta->enter_number + delta->leave_number) * sizeof(aoi_offset);
+	}
+}
+
+void
+aoi_compact(aoi_space *aoi) {
+	int i;
+	for (i=0; i<aoi->towers->size; i++) {
+		aoi_tower *tower = aoi->towers->slot[i];
+		if (tower != NULL) {
+			set_shrink(aoi,tower->objects);
+			int cap = shrink_cap(tower->objects->number,tower->cap);
+			if (cap != tower->cap) {
+				tower_resize(aoi,tower,cap);
+			}
+		}
+	}
+	while (aoi->free_towers != NULL) {
+		aoi_tower *tower = aoi->free_towers;
+		aoi->free_towers = tower->next_free;
+		delete_tower(aoi,tower);
+	}
+	aoi->free_tower_number = 0;
+	// scratch sets are only used within a call
+	aoi->result_set->number = 0;
+	aoi->batch_towers->number = 0;
+	set_shrink(aoi,aoi->result_set);
+	set_shrink(aoi,aoi->batch_towers);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		aoi->batch = NULL;
+		aoi->batch_cap = 0;
+	}
+	if (aoi->events != NULL && aoi->event_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+		aoi->events = NULL;
+		aoi->event_cap = 0;
+	}
+	if (aoi->pending_ids != NULL && aoi->pending_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+		aoi->pending_ids = NULL;
+		aoi->pending_pos = NULL;
+		aoi->pending_cap = 0;
+	}
+	slab_compact(aoi);
 }
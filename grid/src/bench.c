@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "aoi.h"
+
+#define BENCH_OBJ 10000
+#define BENCH_ROUND 50
+
+static float POS[BENCH_OBJ][3];
+static uint32_t IDS[BENCH_OBJ];
+static uint64_t EVENTS = 0;
+
+static void *
+bench_alloc(void *ud,void *ptr,size_t sz) {
+	if (ptr == NULL) {
+		return malloc(sz);
+	}
+	free(ptr);
+	return NULL;
+}
+
+static void
+bench_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	EVENTS++;
+}
+
+static void
+bench_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	EVENTS++;
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every round all entities walk a step,a squad walks together
+static void
+walk(float map_size[3],float step) {
+	int i,j;
+	float dir[3];
+	for (i=0; i<BENCH_OBJ; i++) {
+		if (i % 8 == 0) {
+			for (j=0; j<3; j++) {
+				dir[j] = step * (2.0f * rand() / RAND_MAX - 1.0f);
+			}
+		}
+		for (j=0; j<3; j++) {
+			float pos = POS[i][j] + dir[j];
+			if (pos < 0 || pos >= map_size[j]) {
+				pos = POS[i][j] - dir[j];
+			}
+			POS[i][j] = pos;
+		}
+	}
+}
+
+static double
+bench(float map_size[3],float tower_size[3],bool batch,bool poll) {
+	int i,j;
+	aoi_space *aoi;
+	if (poll) {
+		aoi = aoi_create(bench_alloc,NULL,map_size,tower_size,NULL,NULL,NULL);
+	} else {
+		aoi = aoi_create(bench_alloc,NULL,map_size,tower_size,bench_enterAOI,bench_leaveAOI,NULL);
+	}
+	srand(1);
+	// entities spawn in squads of 8 sharing a tower
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			if (i % 8 == 0) {
+				POS[i][j] = (int)(map_size[j] * rand() / RAND_MAX / tower_size[j]) * tower_size[j] + tower_size[j] / 2;
+			} else {
+				POS[i][j] = POS[i-1][j];
+			}
+		}
+		IDS[i] = i;
+		aoi_enter(aoi,i,POS[i],"wm");
+	}
+	if (poll) {
+		int number;
+		aoi_poll_events(aoi,&number);
+	}
+	EVENTS = 0;
+	double t = 0;
+	for (i=0; i<BENCH_ROUND; i++) {
+		walk(map_size,tower_size[0]);
+		double start = now();
+		if (batch) {
+			aoi_move_batch(aoi,IDS,(const float (*)[3])POS,BENCH_OBJ);
+		} else {
+			for (j=0; j<BENCH_OBJ; j++) {
+				aoi_move(aoi,IDS[j],POS[j]);
+			}
+		}
+		if (poll) {
+			int number;
+			aoi_poll_events(aoi,&number);
+			EVENTS += number;
+		}
+		t += now() - start;
+	}
+	aoi_release(aoi);
+	return t;
+}
+
+// mass login: entities enter one after another
+static double
+bench_enter(float map_size[3],float tower_size[3]) {
+	int i,j;
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,tower_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+	}
+	double start = now();
+	for (i=0; i<BENCH_OBJ; i++) {
+		int number;
+		aoi_enter(aoi,i,POS[i],"wm");
+		aoi_poll_events(aoi,&number);
+	}
+	double t = now() - start;
+	aoi_release(aoi);
+	return t;
+}
+
+#define QUERY_NUMBER 10000
+
+// area skills in a crowded town: big boxes over towers holding many entities
+static double
+bench_query(float tower_size[3]) {
+	int i,j;
+	int found = 0;
+	float map_size[3] = {200,200,20};
+	float range[3] = {30,30,30};
+	aoi_space *aoi = aoi_create(bench_alloc,NULL,map_size,tower_size,NULL,NULL,NULL);
+	srand(1);
+	for (i=0; i<BENCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			POS[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_enter(aoi,i,POS[i],"m");
+	}
+	double start = now();
+	for (i=0; i<QUERY_NUMBER; i++) {
+		int number;
+		float pos[3];
+		for (j=0; j<3; j++) {
+			pos[j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_get_view_by_pos(aoi,pos,range,&number);
+		found += number;
+	}
+	double t = now() - start;
+	aoi_release(aoi);
+	return found >= 0 ? t : 0;
+}
+
+int
+main(int argc,char *argv[]) {
+	float map_size[3] = {1000,1000,100};
+	float tower_size[3] = {20,20,20};
+	double t1 = bench(map_size,tower_size,false,false);
+	uint64_t events1 = EVENTS;
+	double t2 = bench(map_size,tower_size,true,false);
+	uint64_t events2 = EVENTS;
+	double t3 = bench(map_size,tower_size,true,true);
+	uint64_t events3 = EVENTS;
+	printf("objects=%d,round=%d\n",BENCH_OBJ,BENCH_ROUND);
+	double t0 = bench_enter(map_size,tower_size);
+	printf("aoi_enter: %.3fs,%.0f enters/s\n",t0,BENCH_OBJ/t0);
+	double t4 = bench_query(tower_size);
+	printf("aoi_get_view_by_pos: %.3fs,%.0f queries/s\n",t4,QUERY_NUMBER/t4);
+	printf("aoi_move loop: %.3fs,%.0f moves/s,events=%llu\n",t1,BENCH_OBJ*BENCH_ROUND/t1,(unsigned long long)events1);
+	printf("aoi_move_batch: %.3fs,%.0f moves/s,events=%llu\n",t2,BENCH_OBJ*BENCH_ROUND/t2,(unsigned long long)events2);
+	printf("aoi_move_batch+aoi_poll_events: %.3fs,%.0f moves/s,events=%llu\n",t3,BENCH_OBJ*BENCH_ROUND/t3,(unsigned long long)events3);
+	return 0;
+}
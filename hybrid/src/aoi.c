@@ -0,0 +1,2140 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include "aoi.h"
+
+#define INVALID_ID (~0)
+#define PRE_ALLOC 16
+#define MAP_PAGE 256	// ids of a page in dense id mode
+#define SLAB_OBJECT 64	// objects carved from a slab
+//#define PRE_ALLOC 32
+#define MODE_WATCHER 1
+#define MODE_MARKER 2
+#define CELL_SCALE 2	// cell size is CELL_SCALE times default view size
+#define MAX_FREE_CELL 64
+#define MAX_FREE_CAP 64	// cells with more room than this are freed instead of kept for reuse
+// a cell sorts its entries on the axis they spread most along when it holds more than
+// DENSE_NUMBER objects,and stops keeping them sorted below SPARSE_NUMBER
+#define DENSE_NUMBER 32
+#define SPARSE_NUMBER 8
+#define STRIP_NUMBER 8	// strips a dense cell is cut into along a second axis
+#define GROUP_SPAN 2	// windows of a batch group span at most 2 windows on each axis
+
+typedef struct aoi_object {
+	uint32_t id;
+	int mode;
+	bool custom_view;
+	float pos[3];
+	float view_size[3];
+	struct aoi_cell *cell;	// cell which object is in
+	int batch_index;	// index in aoi->batch during aoi_move_batch
+	int pending_index;	// index in aoi->pending_ids when move is deferred
+	uint32_t *linger;	// markers still seen beyond the view,until they pass the hysteresis
+	int linger_number;
+	int linger_cap;
+	uint32_t stamp;	// last query which found this object
+	struct aoi_object *next_free;	// next object of aoi->free_objects
+} aoi_object;
+
+// objects are carved from slabs,left ones wait in aoi->free_objects for the next enter
+typedef struct aoi_slab {
+	struct aoi_slab *next;
+	aoi_object obj[SLAB_OBJECT];
+} aoi_slab;
+
+// open addressing with linear probing,an empty slot has no obj
+typedef struct aoi_map_slot {
+	uint32_t id;
+	aoi_object * obj;
+} aoi_map_slot;
+
+// a page of objects indexed by id in dense id mode
+typedef struct aoi_map_page {
+	int number;
+	aoi_object *obj[MAP_PAGE];
+} aoi_map_page;
+
+typedef struct aoi_map {
+	int size;
+	int number;
+	aoi_map_slot * slot;
+	aoi_map_page **page;	// pages of dense id mode,NULL when ids are hashed
+	int page_number;
+	uint32_t max_id;	// ids of dense id mode are below it,0 means no bound
+} aoi_map;
+
+typedef struct aoi_set {
+	int cap;
+	int number;
+	void **slot;
+} aoi_set;
+
+// ids written to a caller buffer,number counts all matches even past cap
+typedef struct aoi_result {
+	uint32_t *ids;
+	int cap;
+	int number;
+	uint32_t skip;	// id left out,INVALID_ID for none
+} aoi_result;
+
+// position is kept in the entry,so a cell is filtered without touching objects
+typedef struct aoi_entry {
+	float pos[3];
+	aoi_object *obj;
+} aoi_entry;
+
+// a cell of the coarse grid,sparse cells keep entries unordered,dense ones are cut into
+// strips and sorted within a strip on the axis they spread most along,so a query only
+// scans its range on both,and a move skips the middle of strips inside its old and new views
+typedef struct aoi_cell {
+	int x,y,z;
+	bool dense;
+	int axis;	// axis entries of a dense cell are sorted on
+	int strip_axis;	// axis a dense cell is cut into strips along,-1 for none
+	int strip[STRIP_NUMBER+1];	// entries of strip s are from strip[s] to strip[s+1]-1
+	float lo[3],hi[3];	// bounds of entries since the cell turned dense,they only grow
+	int number;
+	int cap;
+	aoi_entry *entry;
+	struct aoi_cell *next_free;
+} aoi_cell;
+
+// only occupied cells live here,keyed by cell coordinates
+typedef struct aoi_cell_map {
+	int size;
+	int number;
+	aoi_cell **slot;
+} aoi_cell_map;
+
+typedef struct aoi_batch_move {
+	aoi_object *obj;
+	float pos[3];
+	int from[3];	// cell before the move
+	int to[3];	// cell after the move
+	int index;	// order in the batch
+} aoi_batch_move;
+
+typedef struct aoi_space {
+	aoi_map *objects;
+	aoi_cell_map *cells;
+	aoi_cell *free_cells;
+	int free_cell_number;
+	float map_size[3];
+	float view_size[3];
+	float cell_size[3];
+	float max_view[3];	// max view size of all objects
+	int custom_view_number;
+	float hysteresis;	// a seen marker leaves only when it is this distance beyond the view
+	aoi_Alloc alloc;
+	void *alloc_ud;
+	enterAOI_Callback cb_enterAOI;
+	leaveAOI_Callback cb_leaveAOI;
+	void *cb_ud;
+	aoi_event *events;	// buffered events when no callback
+	int event_number;
+	int event_cap;
+	bool buffered;	// events go to aoi->events
+	bool defer;	// moves are applied in aoi_update
+	uint32_t *pending_ids;
+	float (*pending_pos)[3];
+	int pending_number;
+	int pending_cap;
+	aoi_set *set1;
+	aoi_set *set2;
+	aoi_set *result_set;
+	aoi_batch_move *batch;
+	int batch_cap;
+	uint32_t stamp;	// increased by every query
+	aoi_slab *slab;
+	aoi_object *free_objects;
+} aoi_space;
+
+static aoi_object *
+object_alloc(aoi_space *aoi) {
+	if (aoi->free_objects == NULL) {
+		int i;
+		aoi_slab *slab = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_slab));
+		slab->next = aoi->slab;
+		aoi->slab = slab;
+		// objects entering one after another are adjacent
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			slab->obj[i].next_free = aoi->free_objects;
+			aoi->free_objects = &slab->obj[i];
+		}
+	}
+	aoi_object *obj = aoi->free_objects;
+	aoi->free_objects = obj->next_free;
+	return obj;
+}
+
+static void
+object_free(aoi_space *aoi,aoi_object *obj) {
+	obj->next_free = aoi->free_objects;
+	aoi->free_objects = obj;
+}
+
+static void
+slab_delete(aoi_space *aoi) {
+	while (aoi->slab != NULL) {
+		aoi_slab *slab = aoi->slab;
+		aoi->slab = slab->next;
+		aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+	}
+	aoi->free_objects = NULL;
+}
+
+// slabs with all objects free go back to the allocator,free objects are marked by mode -1
+static void
+slab_compact(aoi_space *aoi) {
+	int i;
+	aoi_object *obj;
+	aoi_slab **p = &aoi->slab;
+	for (obj=aoi->free_objects; obj != NULL; obj=obj->next_free) {
+		obj->mode = -1;
+	}
+	aoi->free_objects = NULL;
+	while (*p != NULL) {
+		aoi_slab *slab = *p;
+		int number = 0;
+		for (i=0; i<SLAB_OBJECT; i++) {
+			if (slab->obj[i].mode < 0) {
+				number++;
+			}
+		}
+		if (number == SLAB_OBJECT) {
+			*p = slab->next;
+			aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+			continue;
+		}
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			if (slab->obj[i].mode < 0) {
+				object_free(aoi,&slab->obj[i]);
+			}
+		}
+		p = &slab->next;
+	}
+}
+
+static aoi_object *
+new_object(aoi_space *aoi,uint32_t id) {
+	aoi_object *obj = object_alloc(aoi);
+	memset(obj,0,sizeof(*obj));
+	obj->id = id;
+	obj->batch_index = -1;
+	obj->pending_index = -1;
+	return obj;
+}
+
+static void
+delete_object(void *ud,aoi_object *obj) {
+	aoi_space *aoi = ud;
+	if (obj->linger != NULL) {
+		aoi->alloc(aoi->alloc_ud,obj->linger,obj->linger_cap * sizeof(uint32_t));
+	}
+	object_free(aoi,obj);
+}
+
+static aoi_object * map_get(aoi_map *m,uint32_t id);
+
+static aoi_object *
+get_object(aoi_space *aoi,uint32_t id) {
+	return map_get(aoi->objects,id);
+}
+
+static inline uint32_t
+map_hash(uint32_t id) {
+	uint32_t h = id * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static void
+map_resize(aoi_space *aoi,aoi_map *m,int size) {
+	aoi_map_slot *old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	for (i=0; i<old_size; i++) {
+		aoi_map_slot *s = &old_slot[i];
+		if (s->obj != NULL) {
+			int mask = m->size - 1;
+			int j = map_hash(s->id) & mask;
+			while (m->slot[j].obj != NULL) {
+				j = (j+1) & mask;
+			}
+			m->slot[j] = *s;
+		}
+	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_map_slot));
+}
+
+static void
+page_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	assert(m->max_id == 0 || id < m->max_id);
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number) {
+		int number = m->page_number;
+		while (k >= number) {
+			number *= 2;
+		}
+		aoi_map_page **page = aoi->alloc(aoi->alloc_ud,NULL,number * sizeof(aoi_map_page*));
+		memset(page,0,number * sizeof(aoi_map_page*));
+		memcpy(page,m->page,m->page_number * sizeof(aoi_map_page*));
+		aoi->alloc(aoi->alloc_ud,m->page,m->page_number * sizeof(aoi_map_page*));
+		m->page = page;
+		m->page_number = number;
+	}
+	aoi_map_page *page = m->page[k];
+	if (page == NULL) {
+		page = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_map_page));
+		memset(page,0,sizeof(aoi_map_page));
+		m->page[k] = page;
+	}
+	page->obj[id % MAP_PAGE] = obj;
+	page->number++;
+	m->number++;
+}
+
+static inline aoi_object *
+page_get(aoi_map *m,uint32_t id) {
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number || m->page[k] == NULL) {
+		return NULL;
+	}
+	return m->page[k]->obj[id % MAP_PAGE];
+}
+
+// empty pages are freed
+static aoi_object *
+page_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	aoi_object *obj = page_get(m,id);
+	if (obj == NULL) {
+		return NULL;
+	}
+	aoi_map_page *page = m->page[id / MAP_PAGE];
+	page->obj[id % MAP_PAGE] = NULL;
+	m->number--;
+	if (--page->number == 0) {
+		aoi->alloc(aoi->alloc_ud,page,sizeof(aoi_map_page));
+		m->page[id / MAP_PAGE] = NULL;
+	}
+	return obj;
+}
+
+// switch an empty map to pages indexed by id
+static void
+map_set_dense(aoi_space *aoi,aoi_map *m,uint32_t max_id) {
+	assert(m->number == 0 && m->page == NULL);
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_map_slot));
+	m->slot = NULL;
+	m->size = 0;
+	m->max_id = max_id;
+	m->page_number = max_id > 0 ? max_id / MAP_PAGE + (max_id % MAP_PAGE != 0) : PRE_ALLOC;
+	m->page = aoi->alloc(aoi->alloc_ud,NULL,m->page_number * sizeof(aoi_map_page*));
+	memset(m->page,0,m->page_number * sizeof(aoi_map_page*));
+}
+
+// id is not in the map
+static void
+map_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	if (m->page != NULL) {
+		page_insert(aoi,m,id,obj);
+		return;
+	}
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		map_resize(aoi,m,m->size*2);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].obj != NULL) {
+		i = (i+1) & mask;
+	}
+	m->slot[i].id = id;
+	m->slot[i].obj = obj;
+	m->number++;
+}
+
+// ids live in slots,so a probe never touches objects
+static aoi_object *
+map_get(aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_get(m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	for (;;) {
+		aoi_map_slot *s = &m->slot[i];
+		if (s->obj == NULL || s->id == id) {
+			return s->obj;
+		}
+		i = (i+1) & mask;
+	}
+}
+
+static void
+map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
+	int i,j;
+	for (i=0; i<m->page_number; i++) {
+		aoi_map_page *page = m->page[i];
+		for (j=0; page != NULL && j<MAP_PAGE; j++) {
+			if (page->obj[j]) {
+				func(ud, page->obj[j]);
+			}
+		}
+	}
+	for (i=0;i<m->size;i++) {
+		if (m->slot[i].obj) {
+			func(ud, m->slot[i].obj);
+		}
+	}
+}
+
+static void
+stamp_clear(void *ud,aoi_object *obj) {
+	obj->stamp = 0;
+}
+
+// a stamp never used before,stamps of all objects are cleared when it wraps
+static void
+stamp_next(aoi_space *aoi) {
+	if (++aoi->stamp == 0) {
+		map_foreach(aoi->objects,stamp_clear,NULL);
+		aoi->stamp = 1;
+	}
+}
+
+static aoi_object *
+map_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_remove(aoi,m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].id != id || m->slot[i].obj == NULL) {
+		if (m->slot[i].obj == NULL) {
+			return NULL;
+		}
+		i = (i+1) & mask;
+	}
+	aoi_object *obj = m->slot[i].obj;
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
+	for (;;) {
+		j = (j+1) & mask;
+		aoi_map_slot *temp = &m->slot[j];
+		if (temp->obj == NULL) {
+			break;
+		}
+		int k = map_hash(temp->id) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		m->slot[i] = *temp;
+		i = j;
+	}
+	m->slot[i].obj = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		map_resize(aoi,m,m->size/2);
+	}
+	return obj;
+}
+
+static void
+map_delete(aoi_space *aoi, aoi_map * m) {
+	int i;
+	for (i=0; i<m->page_number; i++) {
+		if (m->page[i] != NULL) {
+			aoi->alloc(aoi->alloc_ud, m->page[i], sizeof(aoi_map_page));
+		}
+	}
+	if (m->page != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->page, m->page_number * sizeof(aoi_map_page*));
+	}
+	if (m->slot != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	}
+	aoi->alloc(aoi->alloc_ud, m , sizeof(*m));
+}
+
+static aoi_map *
+map_new(aoi_space *aoi) {
+	aoi_map * m = aoi->alloc(aoi->alloc_ud, NULL, sizeof(*m));
+	m->size = PRE_ALLOC;
+	m->number = 0;
+	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	m->page = NULL;
+	m->page_number = 0;
+	m->max_id = 0;
+	return m;
+}
+
+static void
+map_stats(aoi_map *m,aoi_memory *stats) {
+	int i;
+	stats->map_number = m->number;
+	stats->map_cap = m->size;
+	stats->map_bytes = sizeof(*m) + m->size * sizeof(aoi_map_slot);
+	if (m->page != NULL) {
+		stats->map_bytes += m->page_number * sizeof(aoi_map_page*);
+		for (i=0; i<m->page_number; i++) {
+			if (m->page[i] != NULL) {
+				stats->map_cap += MAP_PAGE;
+				stats->map_bytes += sizeof(aoi_map_page);
+			}
+		}
+	}
+}
+
+static aoi_set *
+set_new(aoi_space *aoi) {
+	aoi_set *set = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*set));
+	set->cap = PRE_ALLOC;
+	set->number = 0;
+	set->slot = aoi->alloc(aoi->alloc_ud,NULL,set->cap * sizeof(void*));
+	return set;
+}
+
+static void
+set_delete(aoi_space *aoi,aoi_set *set) {
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set,sizeof(*set));
+}
+
+static inline size_t
+set_bytes(aoi_set *set) {
+	return sizeof(*set) + set->cap * sizeof(void*);
+}
+
+static void
+set_stats(aoi_set *set,aoi_memory *stats) {
+	stats->set_used += set->number;
+	stats->set_cap += set->cap;
+	stats->set_bytes += set_bytes(set);
+}
+
+// halve while at most a quarter is used,so at least twice the number is left
+static inline int
+shrink_cap(int number,int cap) {
+	while (cap > PRE_ALLOC && number * 4 <= cap) {
+		cap /= 2;
+	}
+	return cap;
+}
+
+static void
+set_shrink(aoi_space *aoi,aoi_set *set) {
+	int cap = shrink_cap(set->number,set->cap);
+	if (cap == set->cap) {
+		return;
+	}
+	void **slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+	memcpy(slot,set->slot,set->number*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	set->slot = slot;
+	set->cap = cap;
+}
+
+/*
+static bool
+set_find(aoi_set *set,void *elem) {
+	int i;
+	for (i=0; i<set->number; i++) {
+		if (set->slot[i] == elem) {
+			break;
+		}
+	}
+	return i != set->number;
+}
+*/
+
+static void
+set_add(aoi_space *aoi,aoi_set *set,void *elem) {
+	// no need to check the same,because all element is difference!
+	// bool found = set_find(set,elem);
+	bool found = false;
+	if (!found) {
+		if (set->number >= set->cap) {
+			int cap = set->cap * 2;
+			void *tmp = set->slot;
+			set->slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+			memcpy(set->slot,tmp,set->cap*sizeof(void*));
+			aoi->alloc(aoi->alloc_ud,tmp,set->cap*sizeof(void*));
+			set->cap = cap;
+		}
+		set->slot[set->number++] = elem;
+	}
+}
+
+static inline void
+result_add(aoi_result *result,uint32_t id) {
+	if (id == result->skip) {
+		return;
+	}
+	if (result->number < result->cap) {
+		result->ids[result->number] = id;
+	}
+	result->number++;
+}
+
+/*
+static void*
+set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
+	int i;
+	for (i=0; i<set->number; i++) {
+		if (set->slot[i] == elem) {
+			int nelem = set->number - i - 1;
+			memcpy(set->slot+i,set->slot+i+1,nelem * sizeof(void*));
+			set->number--;
+			return elem;
+		}
+	}
+	return NULL;
+}
+*/
+
+inline static void 
+copy_position(float des[3], const float src[3]) {
+	des[0] = src[0];
+	des[1] = src[1];
+	des[2] = src[2];
+}
+
+
+static inline uint32_t
+cell_hash(int x,int y,int z) {
+	uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+	return h ^ (h >> 16);
+}
+
+static aoi_cell_map *
+cell_map_new(aoi_space *aoi,int size) {
+	aoi_cell_map *m = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*m));
+	m->size = size;
+	m->number = 0;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_cell*));
+	memset(m->slot,0,m->size * sizeof(aoi_cell*));
+	return m;
+}
+
+static void
+cell_map_delete(aoi_space *aoi,aoi_cell_map *m) {
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_cell*));
+	aoi->alloc(aoi->alloc_ud,m,sizeof(*m));
+}
+
+static aoi_cell *
+cell_map_get(aoi_cell_map *m,int x,int y,int z) {
+	int mask = m->size - 1;
+	int i = cell_hash(x,y,z) & mask;
+	for (;;) {
+		aoi_cell *cell = m->slot[i];
+		if (cell == NULL || (cell->x == x && cell->y == y && cell->z == z)) {
+			return cell;
+		}
+		i = (i+1) & mask;
+	}
+}
+
+static void
+cell_map_resize(aoi_space *aoi,aoi_cell_map *m,int size) {
+	aoi_cell **old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_cell*));
+	memset(m->slot,0,m->size * sizeof(aoi_cell*));
+	for (i=0; i<old_size; i++) {
+		aoi_cell *cell = old_slot[i];
+		if (cell != NULL) {
+			int mask = m->size - 1;
+			int j = cell_hash(cell->x,cell->y,cell->z) & mask;
+			while (m->slot[j] != NULL) {
+				j = (j+1) & mask;
+			}
+			m->slot[j] = cell;
+		}
+	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_cell*));
+}
+
+static void
+cell_map_insert(aoi_space *aoi,aoi_cell_map *m,aoi_cell *cell) {
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		cell_map_resize(aoi,m,m->size*2);
+	}
+	int mask = m->size - 1;
+	int i = cell_hash(cell->x,cell->y,cell->z) & mask;
+	while (m->slot[i] != NULL) {
+		i = (i+1) & mask;
+	}
+	m->slot[i] = cell;
+	m->number++;
+}
+
+static void
+cell_map_remove(aoi_space *aoi,aoi_cell_map *m,aoi_cell *cell) {
+	int mask = m->size - 1;
+	int i = cell_hash(cell->x,cell->y,cell->z) & mask;
+	while (m->slot[i] != cell) {
+		assert(m->slot[i] != NULL);
+		i = (i+1) & mask;
+	}
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
+	for (;;) {
+		j = (j+1) & mask;
+		aoi_cell *temp = m->slot[j];
+		if (temp == NULL) {
+			break;
+		}
+		int k = cell_hash(temp->x,temp->y,temp->z) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		m->slot[i] = temp;
+		i = j;
+	}
+	m->slot[i] = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		cell_map_resize(aoi,m,m->size/2);
+	}
+}
+
+// cell coordinate of position v on axis i,an axis without view size has one cell
+static inline int
+cell_coord(aoi_space *aoi,int i,float v) {
+	if (aoi->cell_size[i] <= 0) {
+		return 0;
+	}
+	return (int)floorf(v / aoi->cell_size[i]);
+}
+
+static aoi_cell *
+touch_cell(aoi_space *aoi,int x,int y,int z) {
+	aoi_cell *cell = cell_map_get(aoi->cells,x,y,z);
+	if (cell != NULL) {
+		return cell;
+	}
+	if (aoi->free_cells != NULL) {
+		cell = aoi->free_cells;
+		aoi->free_cells = cell->next_free;
+		aoi->free_cell_number--;
+	} else {
+		cell = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*cell));
+		cell->cap = PRE_ALLOC;
+		cell->entry = aoi->alloc(aoi->alloc_ud,NULL,cell->cap * sizeof(aoi_entry));
+	}
+	cell->x = x;
+	cell->y = y;
+	cell->z = z;
+	cell->dense = false;
+	cell->axis = 0;
+	cell->strip_axis = -1;
+	cell->number = 0;
+	cell->next_free = NULL;
+	cell_map_insert(aoi,aoi->cells,cell);
+	return cell;
+}
+
+static void
+delete_cell(aoi_space *aoi,aoi_cell *cell) {
+	aoi->alloc(aoi->alloc_ud,cell->entry,cell->cap * sizeof(aoi_entry));
+	aoi->alloc(aoi->alloc_ud,cell,sizeof(*cell));
+}
+
+static void
+reclaim_cell(aoi_space *aoi,aoi_cell *cell) {
+	assert(cell->number == 0);
+	cell_map_remove(aoi,aoi->cells,cell);
+	if (aoi->free_cell_number < MAX_FREE_CELL && cell->cap <= MAX_FREE_CAP) {
+		cell->next_free = aoi->free_cells;
+		aoi->free_cells = cell;
+		aoi->free_cell_number++;
+	} else {
+		delete_cell(aoi,cell);
+	}
+}
+
+static inline int
+cell_index(aoi_cell *cell,int i) {
+	return i == 0 ? cell->x : (i == 1 ? cell->y : cell->z);
+}
+
+// strip of a dense cell which pos falls in on its strip axis,it never decreases as pos grows
+static inline int
+cell_strip(aoi_space *aoi,aoi_cell *cell,const float pos[3]) {
+	int i = cell->strip_axis;
+	if (i < 0) {
+		return 0;
+	}
+	int s = (int)floorf((pos[i] / aoi->cell_size[i] - cell_index(cell,i)) * STRIP_NUMBER);
+	if (s < 0) {
+		return 0;
+	}
+	return s < STRIP_NUMBER ? s : STRIP_NUMBER - 1;
+}
+
+// first entry of a dense cell in [from,to) >= v on its axis
+static int
+cell_search(aoi_cell *cell,int from,int to,float v) {
+	int lo = from;
+	int hi = to;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cell->entry[mid].pos[cell->axis] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// index of the entry of obj,its position in the entry is obj->pos
+static int
+cell_find(aoi_space *aoi,aoi_cell *cell,aoi_object *obj) {
+	int k = 0;
+	int to = cell->number;
+	if (cell->dense) {
+		int s = cell_strip(aoi,cell,obj->pos);
+		to = cell->strip[s+1];
+		k = cell_search(cell,cell->strip[s],to,obj->pos[cell->axis]);
+	}
+	for (; k<to; k++) {
+		if (cell->entry[k].obj == obj) {
+			return k;
+		}
+	}
+	assert(0);
+	return -1;
+}
+
+// entry k of a dense cell is out of order while others of its strip [from,to) are sorted,
+// sift it into place as one step of insertion sort
+static void
+cell_sift(aoi_cell *cell,int k,int from,int to) {
+	aoi_entry entry = cell->entry[k];
+	int i = cell->axis;
+	int j = k;
+	while (j > from && cell->entry[j-1].pos[i] > entry.pos[i]) {
+		cell->entry[j] = cell->entry[j-1];
+		j--;
+	}
+	while (j+1 < to && cell->entry[j+1].pos[i] < entry.pos[i]) {
+		cell->entry[j] = cell->entry[j+1];
+		j++;
+	}
+	cell->entry[j] = entry;
+}
+
+static inline void
+cell_bound(aoi_cell *cell,const float pos[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		cell->lo[i] = fmin(cell->lo[i],pos[i]);
+		cell->hi[i] = fmax(cell->hi[i],pos[i]);
+	}
+}
+
+// put entry in order into its strip of a dense cell,which has room for it
+static void
+cell_insert(aoi_space *aoi,aoi_cell *cell,const aoi_entry *entry) {
+	int t;
+	cell_bound(cell,entry->pos);
+	int s = cell_strip(aoi,cell,entry->pos);
+	int k = cell_search(cell,cell->strip[s],cell->strip[s+1],entry->pos[cell->axis]);
+	memmove(cell->entry+k+1,cell->entry+k,(cell->number-k) * sizeof(aoi_entry));
+	cell->entry[k] = *entry;
+	cell->number++;
+	for (t=s+1; t<=STRIP_NUMBER; t++) {
+		cell->strip[t]++;
+	}
+}
+
+static void
+cell_erase(aoi_space *aoi,aoi_cell *cell,int k) {
+	int t;
+	int s = cell_strip(aoi,cell,cell->entry[k].pos);
+	cell->number--;
+	memmove(cell->entry+k,cell->entry+k+1,(cell->number-k) * sizeof(aoi_entry));
+	for (t=s+1; t<=STRIP_NUMBER; t++) {
+		cell->strip[t]--;
+	}
+}
+
+// sort entries on the axis they spread most along,within strips cut along the axis
+// they spread second most along
+static void
+cell_sort(aoi_space *aoi,aoi_cell *cell) {
+	int i,k;
+	float spread[3];
+	for (i=0; i<3; i++) {
+		float lo = cell->entry[0].pos[i];
+		float hi = lo;
+		for (k=1; k<cell->number; k++) {
+			lo = fmin(lo,cell->entry[k].pos[i]);
+			hi = fmax(hi,cell->entry[k].pos[i]);
+		}
+		spread[i] = hi - lo;
+		if (i == 0 || spread[i] > spread[cell->axis]) {
+			cell->axis = i;
+		}
+	}
+	// a cell is endless along an axis without view size
+	cell->strip_axis = -1;
+	for (i=0; i<3; i++) {
+		if (i != cell->axis && aoi->cell_size[i] > 0 &&
+			(cell->strip_axis < 0 || spread[i] > spread[cell->strip_axis])) {
+			cell->strip_axis = i;
+		}
+	}
+	// insert entries one by one into the sorted front
+	int number = cell->number;
+	cell->number = 0;
+	memset(cell->strip,0,sizeof(cell->strip));
+	copy_position(cell->lo,cell->entry[0].pos);
+	copy_position(cell->hi,cell->entry[0].pos);
+	for (k=0; k<number; k++) {
+		aoi_entry entry = cell->entry[k];
+		cell_insert(aoi,cell,&entry);
+	}
+	cell->dense = true;
+}
+
+static void
+cell_resize(aoi_space *aoi,aoi_cell *cell,int cap) {
+	aoi_entry *entry = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(aoi_entry));
+	memcpy(entry,cell->entry,cell->number * sizeof(aoi_entry));
+	aoi->alloc(aoi->alloc_ud,cell->entry,cell->cap * sizeof(aoi_entry));
+	cell->entry = entry;
+	cell->cap = cap;
+}
+
+static void
+cell_add(aoi_space *aoi,aoi_object *obj) {
+	int x = cell_coord(aoi,0,obj->pos[0]);
+	int y = cell_coord(aoi,1,obj->pos[1]);
+	int z = cell_coord(aoi,2,obj->pos[2]);
+	aoi_cell *cell = touch_cell(aoi,x,y,z);
+	if (cell->number >= cell->cap) {
+		cell_resize(aoi,cell,cell->cap * 2);
+	}
+	aoi_entry entry;
+	copy_position(entry.pos,obj->pos);
+	entry.obj = obj;
+	obj->cell = cell;
+	if (cell->dense) {
+		cell_insert(aoi,cell,&entry);
+		return;
+	}
+	cell->entry[cell->number++] = entry;
+	if (cell->number > DENSE_NUMBER) {
+		cell_sort(aoi,cell);
+	}
+}
+
+static void
+cell_remove(aoi_space *aoi,aoi_object *obj) {
+	aoi_cell *cell = obj->cell;
+	int k = cell_find(aoi,cell,obj);
+	if (cell->dense) {
+		cell_erase(aoi,cell,k);
+		if (cell->number < SPARSE_NUMBER) {
+			cell->dense = false;
+		}
+	} else {
+		cell->entry[k] = cell->entry[--cell->number];
+	}
+	obj->cell = NULL;
+	if (cell->number == 0) {
+		reclaim_cell(aoi,cell);
+	}
+}
+
+// relink obj for new position pos,which is copied to obj->pos
+static void
+cell_move(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	aoi_cell *cell = obj->cell;
+	if (cell->x == cell_coord(aoi,0,pos[0]) && cell->y == cell_coord(aoi,1,pos[1]) &&
+		cell->z == cell_coord(aoi,2,pos[2])) {
+		int k = cell_find(aoi,cell,obj);
+		int s = cell_strip(aoi,cell,obj->pos);
+		copy_position(obj->pos,pos);
+		if (!cell->dense) {
+			copy_position(cell->entry[k].pos,pos);
+		} else if (cell_strip(aoi,cell,pos) == s) {
+			cell_bound(cell,pos);
+			copy_position(cell->entry[k].pos,pos);
+			cell_sift(cell,k,cell->strip[s],cell->strip[s+1]);
+		} else {
+			aoi_entry entry = cell->entry[k];
+			copy_position(entry.pos,pos);
+			cell_erase(aoi,cell,k);
+			cell_insert(aoi,cell,&entry);
+		}
+		return;
+	}
+	cell_remove(aoi,obj);
+	copy_position(obj->pos,pos);
+	cell_add(aoi,obj);
+}
+
+// pos2 is in the view of pos1
+static inline bool
+in_view(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (pos2[i] < pos1[i] - view_size[i] || pos2[i] > pos1[i] + view_size[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// view window around pos,widened by rounding error of in_view so that
+// it also holds everything whose view of the same size holds pos
+static inline void
+view_window(const float pos[3],const float view_size[3],float lo[3],float hi[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		float slack = 2 * (fabsf(pos[i]) + 2 * view_size[i]) * FLT_EPSILON;
+		lo[i] = pos[i] - view_size[i] - slack;
+		hi[i] = pos[i] + view_size[i] + slack;
+	}
+}
+
+
+static inline bool
+in_window(const float pos[3],const float lo[3],const float hi[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (pos[i] < lo[i] || pos[i] > hi[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline bool
+in_inner(const float pos[3],const float *in_lo,const float *in_hi) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (pos[i] <= in_lo[i] || pos[i] >= in_hi[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// entries of strip s of a dense cell are strictly within [in_lo,in_hi] on the axes
+// other than the sorted one
+static bool
+strip_inner(aoi_space *aoi,aoi_cell *cell,int s,const float in_lo[3],const float in_hi[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (i == cell->axis) {
+			continue;
+		}
+		if (i == cell->strip_axis) {
+			if (cell_strip(aoi,cell,in_lo) >= s || cell_strip(aoi,cell,in_hi) <= s) {
+				return false;
+			}
+		} else if (cell->lo[i] <= in_lo[i] || cell->hi[i] >= in_hi[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// add obj of entry to result when it is within [lo,hi] and not strictly within [in_lo,in_hi],
+// objects already found by the query of aoi->stamp are skipped
+static inline void
+scan_entry(aoi_space *aoi,aoi_entry *entry,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *set,aoi_result *result) {
+	if (!in_window(entry->pos,lo,hi) || (in_lo != NULL && in_inner(entry->pos,in_lo,in_hi))) {
+		return;
+	}
+	aoi_object *obj = entry->obj;
+	if (set == NULL) {
+		// an object is in one cell,so a single scan finds it once
+		result_add(result,obj->id);
+	} else if (obj->stamp != aoi->stamp) {
+		obj->stamp = aoi->stamp;
+		set_add(aoi,set,obj);
+	}
+}
+
+// scan entries of a dense cell from k on,until to or one past v on its axis
+static inline int
+scan_strip(aoi_space *aoi,aoi_cell *cell,int k,int to,float v,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *set,aoi_result *result) {
+	for (; k<to && cell->entry[k].pos[cell->axis] <= v; k++) {
+		scan_entry(aoi,&cell->entry[k],lo,hi,in_lo,in_hi,set,result);
+	}
+	return k;
+}
+
+// add objects within [lo,hi] and not strictly within [in_lo,in_hi](in_lo NULL for none)
+// to result,objects already found by the query of aoi->stamp are skipped
+static inline void
+scan_window(aoi_space *aoi,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *set,aoi_result *result) {
+	int x,y,z,k,s;
+	int x1 = cell_coord(aoi,0,lo[0]);
+	int x2 = cell_coord(aoi,0,hi[0]);
+	int y1 = cell_coord(aoi,1,lo[1]);
+	int y2 = cell_coord(aoi,1,hi[1]);
+	int z1 = cell_coord(aoi,2,lo[2]);
+	int z2 = cell_coord(aoi,2,hi[2]);
+	for (x=x1; x<=x2; x++) {
+		for (y=y1; y<=y2; y++) {
+			for (z=z1; z<=z2; z++) {
+				aoi_cell *cell = cell_map_get(aoi->cells,x,y,z);
+				if (cell == NULL) {
+					continue;
+				}
+				if (!cell->dense) {
+					for (k=0; k<cell->number; k++) {
+						scan_entry(aoi,&cell->entry[k],lo,hi,in_lo,in_hi,set,result);
+					}
+					continue;
+				}
+				// a dense cell only scans strips within [lo,hi],and entries within [lo,hi]
+				// on its axis,inside a strip that is inner on other axes only both ends
+				int a = cell->axis;
+				int s2 = cell_strip(aoi,cell,hi);
+				for (s=cell_strip(aoi,cell,lo); s<=s2; s++) {
+					int to = cell->strip[s+1];
+					k = cell_search(cell,cell->strip[s],to,lo[a]);
+					if (in_lo != NULL && strip_inner(aoi,cell,s,in_lo,in_hi)) {
+						k = scan_strip(aoi,cell,k,to,in_lo[a],lo,hi,in_lo,in_hi,set,result);
+						k = cell_search(cell,k,to,in_hi[a]);
+					}
+					scan_strip(aoi,cell,k,to,hi[a],lo,hi,in_lo,in_hi,set,result);
+				}
+			}
+		}
+	}
+}
+
+static void
+get_window(aoi_space *aoi,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *result) {
+	scan_window(aoi,lo,hi,in_lo,in_hi,result,NULL);
+}
+
+static void
+get_view(aoi_space *aoi,const float pos[3],const float view_size[3],aoi_set *result) {
+	float lo[3],hi[3];
+	view_window(pos,view_size,lo,hi);
+	stamp_next(aoi);
+	result->number = 0;
+	get_window(aoi,lo,hi,NULL,NULL,result);
+}
+
+static void
+event_grow(aoi_space *aoi) {
+	int cap = aoi->event_cap == 0 ? PRE_ALLOC : aoi->event_cap * 2;
+	aoi_event *events = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(aoi_event));
+	if (aoi->events != NULL) {
+		memcpy(events,aoi->events,aoi->event_number * sizeof(aoi_event));
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	aoi->events = events;
+	aoi->event_cap = cap;
+}
+
+static inline void
+event_push(aoi_space *aoi,uint32_t watcher,uint32_t marker,uint32_t type) {
+	if (aoi->event_number >= aoi->event_cap) {
+		event_grow(aoi);
+	}
+	aoi_event *ev = &aoi->events[aoi->event_number++];
+	ev->watcher = watcher;
+	ev->marker = marker;
+	ev->type = type;
+}
+
+static inline void
+emit_enter(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_ENTER);
+	} else {
+		aoi->cb_enterAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+static inline void
+emit_leave(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_LEAVE);
+	} else {
+		aoi->cb_leaveAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+// each side only sees the other one within its own view
+static void
+enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	if ((watcher->mode & MODE_WATCHER) && in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_enter(aoi,watcher->id,marker->id);
+	}
+	if ((marker->mode & MODE_WATCHER) && in_view(aoi,marker->pos,watcher->pos,marker->view_size)) {
+		emit_enter(aoi,marker->id,watcher->id);
+	}
+}
+
+static int
+linger_find(aoi_object *watcher,uint32_t id) {
+	int i;
+	for (i=0; i<watcher->linger_number; i++) {
+		if (watcher->linger[i] == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void
+linger_add(aoi_space *aoi,aoi_object *watcher,uint32_t id) {
+	if (watcher->linger_number >= watcher->linger_cap) {
+		int cap = watcher->linger_cap == 0 ? 4 : watcher->linger_cap * 2;
+		uint32_t *linger = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+		if (watcher->linger != NULL) {
+			memcpy(linger,watcher->linger,watcher->linger_number * sizeof(uint32_t));
+			aoi->alloc(aoi->alloc_ud,watcher->linger,watcher->linger_cap * sizeof(uint32_t));
+		}
+		watcher->linger = linger;
+		watcher->linger_cap = cap;
+	}
+	watcher->linger[watcher->linger_number++] = id;
+}
+
+static inline void
+linger_remove(aoi_object *watcher,int index) {
+	watcher->linger[index] = watcher->linger[--watcher->linger_number];
+}
+
+static void
+linger_stats(void *ud,aoi_object *obj) {
+	aoi_memory *stats = ud;
+	stats->object_bytes += obj->linger_cap * sizeof(uint32_t);
+}
+
+// pos2 is within hysteresis beyond the view of pos1
+static inline bool
+in_margin(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	float margin[3];
+	for (i=0; i<3; i++) {
+		margin[i] = view_size[i] + aoi->hysteresis;
+	}
+	return in_view(aoi,pos1,pos2,margin);
+}
+
+// window holding every object whose seen state may change
+static inline void
+margin_window(aoi_space *aoi,const float view_size[3],float window[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		window[i] = view_size[i] + aoi->hysteresis;
+	}
+}
+
+// one of them leaves the space,a lingering marker is released too
+static void
+leave_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (!(watcher->mode & MODE_WATCHER)) {
+		return;
+	}
+	int index = linger_find(watcher,marker->id);
+	if (index >= 0) {
+		linger_remove(watcher,index);
+		emit_leave(aoi,watcher->id,marker->id);
+	} else if (in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+static void
+leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	leave_notify(aoi,watcher,marker);
+	leave_notify(aoi,marker,watcher);
+}
+
+// marker at pos2 was within the view of watcher at pos1,or is still seen beyond it
+static inline bool
+view_seen(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	return in_view(aoi,pos1,pos2,view_size) || linger_find(watcher,marker->id) >= 0;
+}
+
+// before tells if watcher saw marker,the view is checked again from pos1 to pos2.
+// a seen marker out of the view is kept until it passes the hysteresis
+static void
+view_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,bool before,const float pos1[3],const float pos2[3]) {
+	bool after = in_view(aoi,pos1,pos2,watcher->view_size);
+	if (before && aoi->hysteresis > 0) {
+		int index = linger_find(watcher,marker->id);
+		if (!after && in_margin(aoi,pos1,pos2,watcher->view_size)) {
+			after = true;
+			if (index < 0) {
+				linger_add(aoi,watcher,marker->id);
+			}
+		} else if (index >= 0) {
+			linger_remove(watcher,index);
+		}
+	}
+	if (!before && after) {
+		emit_enter(aoi,watcher->id,marker->id);
+	} else if (before && !after) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+// obj moved from old_pos,check both directions
+static void
+moveAOI(aoi_space *aoi,aoi_object *obj,aoi_object *other,float old_pos[3]) {
+	if (obj->id == other->id) {
+		return;
+	}
+	if (obj->mode & MODE_WATCHER) {
+		view_notify(aoi,obj,other,
+			view_seen(aoi,obj,other,old_pos,other->pos,obj->view_size),
+			obj->pos,other->pos);
+	}
+	if (other->mode & MODE_WATCHER) {
+		view_notify(aoi,other,obj,
+			view_seen(aoi,other,obj,other->pos,old_pos,other->view_size),
+			other->pos,obj->pos);
+	}
+}
+
+
+aoi_space *
+aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	int i;
+	aoi_space *aoi = alloc(alloc_ud,NULL,sizeof(*aoi));
+	aoi->alloc = alloc;
+	aoi->alloc_ud = alloc_ud;
+	aoi->slab = NULL;
+	aoi->free_objects = NULL;
+	memcpy(aoi->map_size,map_size,3*sizeof(float));
+	memcpy(aoi->view_size,view_size,3*sizeof(float));
+	memcpy(aoi->max_view,view_size,3*sizeof(float));
+	for (i=0; i<3; i++) {
+		aoi->cell_size[i] = view_size[i] * CELL_SCALE;
+	}
+	aoi->custom_view_number = 0;
+	aoi->hysteresis = 0;
+	aoi->stamp = 0;
+	aoi->objects = map_new(aoi);
+	aoi->cells = cell_map_new(aoi,PRE_ALLOC);
+	aoi->free_cells = NULL;
+	aoi->free_cell_number = 0;
+	aoi->set1 = set_new(aoi);
+	aoi->set2 = set_new(aoi);
+	aoi->result_set = set_new(aoi);
+	aoi->batch = NULL;
+	aoi->batch_cap = 0;
+	aoi->cb_enterAOI = cb_enterAOI;
+	aoi->cb_leaveAOI = cb_leaveAOI;
+	aoi->cb_ud = cb_ud;
+	assert((cb_enterAOI == NULL) == (cb_leaveAOI == NULL));
+	aoi->events = NULL;
+	aoi->event_number = 0;
+	aoi->event_cap = 0;
+	aoi->buffered = cb_enterAOI == NULL;
+	aoi->defer = false;
+	aoi->pending_ids = NULL;
+	aoi->pending_pos = NULL;
+	aoi->pending_number = 0;
+	aoi->pending_cap = 0;
+	return aoi;
+}
+
+#if defined USE_IN_SKYNET
+	#define MALLOC(sz) skynet_malloc((sz))
+	#define FREE(ptr) skynet_free((ptr))
+#else
+	#define MALLOC(sz) malloc((sz))
+	#define FREE(ptr) free((ptr))
+#endif
+
+static void *
+default_alloc(void *ud,void *ptr,size_t sz) {
+	if (ptr == NULL) {
+		return MALLOC(sz);
+	}
+	FREE(ptr);
+	return NULL;
+}
+
+aoi_space *
+aoi_new(float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	return aoi_create(default_alloc,NULL,map_size,view_size,cb_enterAOI,cb_leaveAOI,cb_ud);
+}
+
+void
+aoi_release(aoi_space *aoi) {
+	int i;
+	set_delete(aoi,aoi->set1);
+	set_delete(aoi,aoi->set2);
+	set_delete(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	map_foreach(aoi->objects,delete_object,aoi);
+	map_delete(aoi,aoi->objects);
+	slab_delete(aoi);
+	for (i=0; i<aoi->cells->size; i++) {
+		if (aoi->cells->slot[i] != NULL) {
+			delete_cell(aoi,aoi->cells->slot[i]);
+		}
+	}
+	cell_map_delete(aoi,aoi->cells);
+	while (aoi->free_cells != NULL) {
+		aoi_cell *cell = aoi->free_cells;
+		aoi->free_cells = cell->next_free;
+		delete_cell(aoi,cell);
+	}
+	if (aoi->events != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	if (aoi->pending_ids != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+	}
+	aoi->alloc(aoi->alloc_ud,aoi,sizeof(*aoi));
+}
+
+aoi_event *
+aoi_poll_events(aoi_space *aoi,int *number) {
+	*number = aoi->event_number;
+	aoi->event_number = 0;
+	return aoi->events;
+}
+
+static bool
+change_mode(aoi_object *obj,const char *modestring) {
+	int i;
+	bool change = false;
+	bool set_watcher = false;
+	bool set_marker = false;
+	for(i=0; modestring[i]; i++) {
+		switch(modestring[i]) {
+			case 'w':
+				set_watcher = true;
+				break;
+			case 'm':
+				set_marker = true;
+				break;
+			default:
+				break;
+		}
+	}
+	if (set_watcher) {
+		if (!(obj->mode & MODE_WATCHER)) {
+			obj->mode |= MODE_WATCHER;
+			change = true;
+		}
+	} else {
+		if (obj->mode & MODE_WATCHER) {
+			obj->mode &= ~MODE_WATCHER;
+			change = true;
+		}
+	}
+	if (set_marker) {
+		if (!(obj->mode & MODE_MARKER)) {
+			obj->mode |= MODE_MARKER;
+			change = true;
+		}
+	} else {
+		if (obj->mode & MODE_MARKER) {
+			obj->mode &= ~MODE_MARKER;
+			change = true;
+		}
+	}
+	return change;
+}
+
+
+static void
+custom_view_remove(aoi_space *aoi) {
+	aoi->custom_view_number--;
+	if (aoi->custom_view_number == 0) {
+		// max view only shrinks when all custom views are gone
+		copy_position(aoi->max_view,aoi->view_size);
+	}
+}
+
+void
+aoi_set_dense_id(aoi_space *aoi,uint32_t max_id) {
+	map_set_dense(aoi,aoi->objects,max_id);
+}
+
+void
+aoi_set_hysteresis(aoi_space *aoi,float margin) {
+	assert(margin >= 0);
+	aoi->hysteresis = margin;
+}
+
+
+void
+aoi_enter(aoi_space *aoi,uint32_t id,float pos[3],const char *modestring) {
+	if (aoi->objects->max_id != 0 && id >= aoi->objects->max_id) {
+		return;
+	}
+	aoi_object *old_obj = get_object(aoi,id);
+	if (old_obj != NULL) {
+		aoi_leave(aoi,id);
+	}
+	int i;
+	aoi_object *obj = new_object(aoi,id);
+	change_mode(obj,modestring);
+	copy_position(obj->pos,pos);
+	copy_position(obj->view_size,aoi->view_size);
+	map_insert(aoi,aoi->objects,obj->id,obj);
+	get_view(aoi,obj->pos,aoi->max_view,aoi->result_set);
+	cell_add(aoi,obj);
+	for(i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		enterAOI(aoi,obj,temp);
+	}
+}
+
+static void
+pending_add(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	if (obj->pending_index < 0) {
+		if (aoi->pending_number >= aoi->pending_cap) {
+			int cap = aoi->pending_cap == 0 ? PRE_ALLOC : aoi->pending_cap * 2;
+			uint32_t *ids = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+			float (*pos)[3] = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(float[3]));
+			if (aoi->pending_ids != NULL) {
+				memcpy(ids,aoi->pending_ids,aoi->pending_number * sizeof(uint32_t));
+				memcpy(pos,aoi->pending_pos,aoi->pending_number * sizeof(float[3]));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+			}
+			aoi->pending_ids = ids;
+			aoi->pending_pos = pos;
+			aoi->pending_cap = cap;
+		}
+		obj->pending_index = aoi->pending_number++;
+		aoi->pending_ids[obj->pending_index] = obj->id;
+	}
+	copy_position(aoi->pending_pos[obj->pending_index],pos);
+}
+
+static void
+pending_remove(aoi_space *aoi,aoi_object *obj) {
+	int index = obj->pending_index;
+	if (index < 0) {
+		return;
+	}
+	int last = --aoi->pending_number;
+	if (index != last) {
+		aoi->pending_ids[index] = aoi->pending_ids[last];
+		copy_position(aoi->pending_pos[index],aoi->pending_pos[last]);
+		get_object(aoi,aoi->pending_ids[index])->pending_index = index;
+	}
+	obj->pending_index = -1;
+}
+
+
+void
+aoi_leave(aoi_space *aoi,uint32_t id) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	pending_remove(aoi,obj);
+	int i;
+	float window[3];
+	cell_remove(aoi,obj);
+	margin_window(aoi,aoi->max_view,window);
+	get_view(aoi,obj->pos,window,aoi->result_set);
+	for(i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		leaveAOI(aoi,obj,temp);
+	}
+	if (obj->custom_view) {
+		custom_view_remove(aoi);
+	}
+	map_remove(aoi,aoi->objects,id);
+	delete_object(aoi,obj);
+}
+
+// with one view size,pairs strictly within [in_lo,in_hi] see each other before and after
+static void
+move_inner(aoi_space *aoi,const float old_pos[3],const float pos[3],float in_lo[3],float in_hi[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		float slack = 2 * (fabsf(old_pos[i]) + fabsf(pos[i]) + 2 * aoi->view_size[i]) * FLT_EPSILON;
+		in_lo[i] = fmax(old_pos[i],pos[i]) - aoi->view_size[i] + slack;
+		in_hi[i] = fmin(old_pos[i],pos[i]) + aoi->view_size[i] - slack;
+	}
+}
+
+static void
+move_object(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	if (memcmp(obj->pos,pos,3*sizeof(float)) == 0) {
+		return;
+	}
+	int i;
+	float old_pos[3];
+	float window[3];
+	float lo1[3],hi1[3],lo2[3],hi2[3],in_lo[3],in_hi[3];
+	bool inner = aoi->custom_view_number == 0;
+	copy_position(old_pos,obj->pos);
+	move_inner(aoi,old_pos,pos,in_lo,in_hi);
+	// others may see obj with a bigger view,scan the hull of old and new
+	// windows at once when they overlap
+	stamp_next(aoi);
+	aoi->set1->number = 0;
+	// a seen marker may be hysteresis beyond the view
+	margin_window(aoi,aoi->max_view,window);
+	view_window(old_pos,window,lo1,hi1);
+	view_window(pos,window,lo2,hi2);
+	for (i=0; i<3; i++) {
+		if (lo2[i] > hi1[i] || hi2[i] < lo1[i]) {
+			break;
+		}
+	}
+	if (i == 3) {
+		for (i=0; i<3; i++) {
+			lo1[i] = fmin(lo1[i],lo2[i]);
+			hi1[i] = fmax(hi1[i],hi2[i]);
+		}
+	} else {
+		get_window(aoi,lo2,hi2,inner ? in_lo : NULL,inner ? in_hi : NULL,aoi->set1);
+	}
+	get_window(aoi,lo1,hi1,inner ? in_lo : NULL,inner ? in_hi : NULL,aoi->set1);
+	cell_move(aoi,obj,pos);
+	for(i=0; i<aoi->set1->number; i++) {
+		aoi_object *temp = aoi->set1->slot[i];
+		moveAOI(aoi,obj,temp,old_pos);
+	}
+}
+
+void
+aoi_move(aoi_space *aoi,uint32_t id,float pos[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	if (aoi->defer) {
+		pending_add(aoi,obj,pos);
+		return;
+	}
+	move_object(aoi,obj,pos);
+}
+
+// moves between the same two cells are adjacent,in batch order
+static int
+batch_compare(const void *a,const void *b) {
+	const aoi_batch_move *m1 = a;
+	const aoi_batch_move *m2 = b;
+	int i;
+	for (i=0; i<3; i++) {
+		if (m1->from[i] != m2->from[i]) {
+			return m1->from[i] < m2->from[i] ? -1 : 1;
+		}
+	}
+	for (i=0; i<3; i++) {
+		if (m1->to[i] != m2->to[i]) {
+			return m1->to[i] < m2->to[i] ? -1 : 1;
+		}
+	}
+	return m1->index - m2->index;
+}
+
+// hull of the old and new windows of a move
+static void
+move_window(aoi_space *aoi,const float old_pos[3],const float pos[3],float lo[3],float hi[3]) {
+	int i;
+	float window[3];
+	float lo2[3],hi2[3];
+	margin_window(aoi,aoi->max_view,window);
+	view_window(old_pos,window,lo,hi);
+	view_window(pos,window,lo2,hi2);
+	for (i=0; i<3; i++) {
+		lo[i] = fmin(lo[i],lo2[i]);
+		hi[i] = fmax(hi[i],hi2[i]);
+	}
+}
+
+// moves of a group share one scan of the hull [lo,hi] of their windows,objects of
+// the group are found at their old positions and stay in it after moving
+static void
+move_group(aoi_space *aoi,aoi_batch_move *group,int number,const float lo[3],const float hi[3]) {
+	int i,j;
+	aoi_set *set = aoi->set2;
+	bool inner = aoi->custom_view_number == 0;
+	stamp_next(aoi);
+	set->number = 0;
+	get_window(aoi,lo,hi,NULL,NULL,set);
+	for (i=0; i<number; i++) {
+		aoi_object *obj = group[i].obj;
+		float old_pos[3],lo1[3],hi1[3],in_lo[3],in_hi[3];
+		move_window(aoi,obj->pos,group[i].pos,lo1,hi1);
+		move_inner(aoi,obj->pos,group[i].pos,in_lo,in_hi);
+		copy_position(old_pos,obj->pos);
+		cell_move(aoi,obj,group[i].pos);
+		for (j=0; j<set->number; j++) {
+			aoi_object *temp = set->slot[j];
+			if (in_window(temp->pos,lo1,hi1) && !(inner && in_inner(temp->pos,in_lo,in_hi))) {
+				moveAOI(aoi,obj,temp,old_pos);
+			}
+		}
+	}
+}
+
+void
+aoi_move_batch(aoi_space *aoi,const uint32_t *ids,const float (*pos)[3],int n) {
+	int i,j,k;
+	int number = 0;
+	float window[3];
+	float lo[3],hi[3],lo1[3],hi1[3];
+	if (n <= 0) {
+		return;
+	}
+	if (aoi->defer) {
+		for (i=0; i<n; i++) {
+			aoi_object *obj = get_object(aoi,ids[i]);
+			if (obj != NULL) {
+				pending_add(aoi,obj,pos[i]);
+			}
+		}
+		return;
+	}
+	if (n > aoi->batch_cap) {
+		if (aoi->batch != NULL) {
+			aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		}
+		aoi->batch_cap = n;
+		aoi->batch = aoi->alloc(aoi->alloc_ud,NULL,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	// the last position of an object wins
+	for (i=0; i<n; i++) {
+		aoi_object *obj = get_object(aoi,ids[i]);
+		if (obj == NULL) {
+			continue;
+		}
+		aoi_batch_move *m;
+		if (obj->batch_index >= 0) {
+			m = &aoi->batch[obj->batch_index];
+		} else {
+			obj->batch_index = number;
+			m = &aoi->batch[number];
+			m->obj = obj;
+			m->index = number++;
+		}
+		copy_position(m->pos,pos[i]);
+	}
+	for (i=0; i<number; i++) {
+		aoi_batch_move *m = &aoi->batch[i];
+		m->obj->batch_index = -1;
+		m->from[0] = m->obj->cell->x;
+		m->from[1] = m->obj->cell->y;
+		m->from[2] = m->obj->cell->z;
+		for (k=0; k<3; k++) {
+			m->to[k] = cell_coord(aoi,k,m->pos[k]);
+		}
+	}
+	qsort(aoi->batch,number,sizeof(aoi_batch_move),batch_compare);
+	margin_window(aoi,aoi->max_view,window);
+	for (i=0; i<number; i=j) {
+		aoi_batch_move *m = &aoi->batch[i];
+		aoi_batch_move *first = m;
+		j = i + 1;
+		if (memcmp(m->obj->pos,m->pos,3*sizeof(float)) == 0) {
+			continue;
+		}
+		// following moves between the same cells join the group while their windows are nearby
+		move_window(aoi,m->obj->pos,m->pos,lo,hi);
+		for (; j<number; j++) {
+			m = &aoi->batch[j];
+			if (memcmp(first->from,m->from,sizeof(m->from)) != 0 || memcmp(first->to,m->to,sizeof(m->to)) != 0) {
+				break;
+			}
+			move_window(aoi,m->obj->pos,m->pos,lo1,hi1);
+			for (k=0; k<3; k++) {
+				if (fmax(hi[k],hi1[k]) - fmin(lo[k],lo1[k]) > 2 * GROUP_SPAN * window[k]) {
+					break;
+				}
+			}
+			if (k < 3) {
+				break;
+			}
+			for (k=0; k<3; k++) {
+				lo[k] = fmin(lo[k],lo1[k]);
+				hi[k] = fmax(hi[k],hi1[k]);
+			}
+		}
+		if (j - i == 1) {
+			move_object(aoi,first->obj,first->pos);
+		} else {
+			move_group(aoi,first,j - i,lo,hi);
+		}
+	}
+}
+
+// while coalescing,type holds the production index above the enter bit
+static int
+event_compare(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->watcher != ev2->watcher) {
+		return ev1->watcher < ev2->watcher ? -1 : 1;
+	}
+	if (ev1->marker != ev2->marker) {
+		return ev1->marker < ev2->marker ? -1 : 1;
+	}
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+event_order(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+// events of a pair alternate,so only the last one of each pair with a net change is kept,
+// the kept events are put back in production order
+static void
+event_coalesce(aoi_space *aoi,int start) {
+	int i,j;
+	int n = 0;
+	aoi_event *events = aoi->events + start;
+	int number = aoi->event_number - start;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		events[i].type = (uint32_t)i << 1 | (events[i].type == AOI_EVENT_ENTER);
+	}
+	qsort(events,number,sizeof(aoi_event),event_compare);
+	for (i=0; i<number; i=j) {
+		int net = 0;
+		for (j=i; j<number && events[j].watcher == events[i].watcher && events[j].marker == events[i].marker; j++) {
+			net += (events[j].type & 1) ? 1 : -1;
+		}
+		assert(net >= -1 && net <= 1);
+		if (net != 0) {
+			assert((events[j-1].type & 1) == (net > 0));
+			events[n++] = events[j-1];
+		}
+	}
+	if (n > 0) {
+		qsort(events,n,sizeof(aoi_event),event_order);
+	}
+	for (i=0; i<n; i++) {
+		events[i].type = (events[i].type & 1) ? AOI_EVENT_ENTER : AOI_EVENT_LEAVE;
+	}
+	aoi->event_number = start + n;
+}
+
+void
+aoi_set_defer(aoi_space *aoi,int defer) {
+	if (!defer) {
+		aoi_update(aoi);
+	}
+	aoi->defer = defer != 0;
+}
+
+void
+aoi_update(aoi_space *aoi) {
+	int i;
+	int number = aoi->pending_number;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		get_object(aoi,aoi->pending_ids[i])->pending_index = -1;
+	}
+	aoi->pending_number = 0;
+	int start = aoi->event_number;
+	bool buffered = aoi->buffered;
+	aoi->buffered = true;
+	aoi->defer = false;
+	aoi_move_batch(aoi,aoi->pending_ids,(const float (*)[3])aoi->pending_pos,number);
+	aoi->defer = true;
+	aoi->buffered = buffered;
+	event_coalesce(aoi,start);
+	if (!buffered) {
+		for (i=start; i<aoi->event_number; i++) {
+			aoi_event *ev = &aoi->events[i];
+			if (ev->type == AOI_EVENT_ENTER) {
+				aoi->cb_enterAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			} else {
+				aoi->cb_leaveAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			}
+		}
+		aoi->event_number = start;
+	}
+}
+
+
+void
+aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	bool is_marker = !(obj->mode & MODE_WATCHER);
+	change_mode(obj,modestring);
+	bool is_watcher = obj->mode & MODE_WATCHER;
+	if (is_marker && is_watcher) {
+		int i;
+		get_view(aoi,obj->pos,obj->view_size,aoi->result_set);
+		for(i=0; i<aoi->result_set->number; i++) {
+			aoi_object *temp = aoi->result_set->slot[i];
+			if (obj->id == temp->id) {
+				continue;
+			}
+			if (in_view(aoi,obj->pos,temp->pos,obj->view_size)) {
+				emit_enter(aoi,obj->id,temp->id);
+			}
+		}
+	} else if (!is_watcher) {
+		obj->linger_number = 0;
+	}
+}
+
+void
+aoi_set_view_range(aoi_space *aoi,uint32_t id,float range[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	int i;
+	float old_view[3];
+	float window[3];
+	copy_position(old_view,obj->view_size);
+	if (range != NULL) {
+		copy_position(obj->view_size,range);
+		if (!obj->custom_view) {
+			obj->custom_view = true;
+			aoi->custom_view_number++;
+		}
+		for (i=0; i<3; i++) {
+			aoi->max_view[i] = fmax(aoi->max_view[i],range[i]);
+		}
+	} else {
+		copy_position(obj->view_size,aoi->view_size);
+		if (obj->custom_view) {
+			obj->custom_view = false;
+			custom_view_remove(aoi);
+		}
+	}
+	if (!(obj->mode & MODE_WATCHER)) {
+		return;
+	}
+	// only the view of obj changes,others still see obj with their own view
+	for (i=0; i<3; i++) {
+		window[i] = fmax(old_view[i],obj->view_size[i]) + aoi->hysteresis;
+	}
+	get_view(aoi,obj->pos,window,aoi->result_set);
+	for (i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		if (obj->id != temp->id) {
+			view_notify(aoi,obj,temp,
+				view_seen(aoi,obj,temp,obj->pos,temp->pos,old_view),
+				obj->pos,temp->pos);
+		}
+	}
+}
+
+void **
+aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
+	int i;
+	float lo[3],hi[3];
+	aoi_set *result = aoi->result_set;
+	float *view_size = aoi->view_size;
+	if (range != NULL) {
+		view_size = range;
+	}
+	// exactly in_view,not widened
+	for (i=0; i<3; i++) {
+		lo[i] = pos[i] - view_size[i];
+		hi[i] = pos[i] + view_size[i];
+	}
+	stamp_next(aoi);
+	aoi->set1->number = 0;
+	get_window(aoi,lo,hi,NULL,NULL,aoi->set1);
+	result->number = 0;
+	for (i=0; i<aoi->set1->number; i++) {
+		aoi_object *obj = aoi->set1->slot[i];
+		set_add(aoi,result,(void*)obj->id);
+	}
+	*number = result->number;
+	return result->slot;
+}
+
+void **
+aoi_get_view(aoi_space *aoi,uint32_t id,float range[3],int *number) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		*number = 0;
+		return NULL;
+	}
+	int i;
+	if (range == NULL) {
+		get_view(aoi,obj->pos,obj->view_size,aoi->set1);
+	} else {
+		get_view(aoi,obj->pos,range,aoi->set1);
+	}
+	aoi->result_set->number = 0;
+	for (i=0; i<aoi->set1->number; i++) {
+		aoi_object *temp = aoi->set1->slot[i];
+		if (temp != obj) {
+			set_add(aoi,aoi->result_set,(void*)temp->id);
+		}
+	}
+	if (range == NULL) {
+		// markers still seen beyond the view
+		for (i=0; i<obj->linger_number; i++) {
+			set_add(aoi,aoi->result_set,(void*)obj->linger[i]);
+		}
+	}
+	*number = aoi->result_set->number;
+	return aoi->result_set->slot;
+}
+
+int
+aoi_query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],uint32_t *ids,int cap) {
+	int i;
+	float lo[3],hi[3];
+	float *view_size = aoi->view_size;
+	if (range != NULL) {
+		view_size = range;
+	}
+	// exactly in_view,not widened
+	for (i=0; i<3; i++) {
+		lo[i] = pos[i] - view_size[i];
+		hi[i] = pos[i] + view_size[i];
+	}
+	aoi_result result = {ids,cap,0,INVALID_ID};
+	scan_window(aoi,lo,hi,NULL,NULL,NULL,&result);
+	return result.number;
+}
+
+int
+aoi_query_view(aoi_space *aoi,uint32_t id,float range[3],uint32_t *ids,int cap) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return 0;
+	}
+	int i;
+	float lo[3],hi[3];
+	view_window(obj->pos,range != NULL ? range : obj->view_size,lo,hi);
+	aoi_result result = {ids,cap,0,obj->id};
+	scan_window(aoi,lo,hi,NULL,NULL,NULL,&result);
+	if (range == NULL) {
+		for (i=0; i<obj->linger_number; i++) {
+			result_add(&result,obj->linger[i]);
+		}
+	}
+	return result.number;
+}
+
+void
+aoi_memory_stats(aoi_space *aoi,aoi_memory *stats) {
+	int i;
+	aoi_slab *slab;
+	aoi_cell *cell;
+	memset(stats,0,sizeof(*stats));
+	stats->object_number = aoi->objects->number;
+	for (slab=aoi->slab; slab != NULL; slab=slab->next) {
+		stats->object_cap += SLAB_OBJECT;
+		stats->object_bytes += sizeof(aoi_slab);
+	}
+	map_stats(aoi->objects,stats);
+	map_foreach(aoi->objects,linger_stats,stats);
+	stats->index_bytes = sizeof(*aoi->cells) + aoi->cells->size * sizeof(aoi_cell*);
+	for (i=0; i<aoi->cells->size; i++) {
+		cell = aoi->cells->slot[i];
+		if (cell != NULL) {
+			stats->index_number++;
+			stats->index_used += cell->number;
+			stats->index_cap += cell->cap;
+			stats->index_bytes += sizeof(*cell) + cell->cap * sizeof(aoi_entry);
+		}
+	}
+	// free cells keep their entries for reuse
+	for (cell=aoi->free_cells; cell != NULL; cell=cell->next_free) {
+		stats->index_cap += cell->cap;
+		stats->index_bytes += sizeof(*cell) + cell->cap * sizeof(aoi_entry);
+	}
+	set_stats(aoi->set1,stats);
+	set_stats(aoi->set2,stats);
+	set_stats(aoi->result_set,stats);
+	stats->buffer_bytes = aoi->event_cap * sizeof(aoi_event)
+		+ aoi->pending_cap * (sizeof(uint32_t) + sizeof(float[3]))
+		+ aoi->batch_cap * sizeof(aoi_batch_move);
+	stats->total = sizeof(*aoi) + stats->object_bytes + stats->map_bytes + stats->index_bytes
+		+ stats->set_bytes + stats->buffer_bytes;
+}
+
+void
+aoi_compact(aoi_space *aoi) {
+	int i;
+	for (i=0; i<aoi->cells->size; i++) {
+		aoi_cell *cell = aoi->cells->slot[i];
+		if (cell != NULL) {
+			int cap = shrink_cap(cell->number,cell->cap);
+			if (cap != cell->cap) {
+				cell_resize(aoi,cell,cap);
+			}
+		}
+	}
+	while (aoi->free_cells != NULL) {
+		aoi_cell *cell = aoi->free_cells;
+		aoi->free_cells = cell->next_free;
+		delete_cell(aoi,cell);
+	}
+	aoi->free_cell_number = 0;
+	// scratch sets are only used within a call
+	aoi->set1->number = 0;
+	aoi->set2->number = 0;
+	aoi->result_set->number = 0;
+	set_shrink(aoi,aoi->set1);
+	set_shrink(aoi,aoi->set2);
+	set_shrink(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		aoi->batch = NULL;
+		aoi->batch_cap = 0;
+	}
+	if (aoi->events != NULL && aoi->event_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+		aoi->events = NULL;
+		aoi->event_cap = 0;
+	}
+	if (aoi->pending_ids != NULL && aoi->pending_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+		aoi->pending_ids = NULL;
+		aoi->pending_pos = NULL;
+		aoi->pending_cap = 0;
+	}
+	slab_compact(aoi);
+}
@@ -0,0 +1,1004 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <math.h>
+#include "aoi.h"
+
+struct alloc_cookie {
+	int count;
+	int max;
+	int current;
+	int total;	// calls to alloc memory
+};
+
+static void *
+my_alloc(void *ud,void *ptr,size_t sz) {
+	struct alloc_cookie *cookie = ud;
+	if (ptr == NULL) {
+		// alloc
+		void *p = malloc(sz);
+		++cookie->count;
+		++cookie->total;
+		cookie->current += sz;
+		if (cookie->current > cookie->max) {
+			cookie->max = cookie->current;
+		}
+		//printf("%p + %lu\n",p,sz);
+		return p;
+	}
+	--cookie->count;
+	cookie->current -= sz;
+	free(ptr);
+	//printf("%p - %lu\n",ptr,sz);
+	return NULL;
+}
+
+typedef struct OBJECT {
+	float pos[3];
+	float v[3];
+	char mode[4];
+} OBJECT;
+
+static struct OBJECT OBJ[7];
+static bool check_leave_aoi = true;
+static float map_size[3] = {100,100,100};
+static float view_size[3] = {4.5,4.5,4.5};
+// 2d
+//static float map_size[3] = {100,100,0};
+//static float view_size[3] = {4.5,4.5,0};
+
+
+static void
+init_obj(uint32_t id,float x,float y,float z,float vx,float vy,float vz,const char *mode) {
+	OBJ[id].pos[0] = x;
+	OBJ[id].pos[1] = y;
+	OBJ[id].pos[2] = z;
+
+	OBJ[id].v[0] = vx;
+	OBJ[id].v[1] = vy;
+	OBJ[id].v[2] = vz;
+	strcpy(OBJ[id].mode,mode);
+}
+
+static void
+update_obj(struct aoi_space *aoi,uint32_t id) {
+	int i;
+	for (i=0; i<3; i++) {
+		OBJ[id].pos[i] += OBJ[id].v[i];
+		if (OBJ[id].pos[i] > map_size[i]) {
+			OBJ[id].pos[i] -= map_size[i];
+		} else if (OBJ[id].pos[i] < 0) {
+			OBJ[id].pos[i] += map_size[i];
+		}
+	}
+	aoi_move(aoi,id,OBJ[id].pos);
+}
+
+static bool
+in_view(float pos1[3],float pos2[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (fabs(pos1[i]-pos2[i]) > view_size[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	printf("op=enterAOI,watcher=[id=%d,pos=(%.1f,%.1f,%.1f)],marker=[id=%d,pos=(%.1f,%.1f,%.1f)]\n",
+			watcher,OBJ[watcher].pos[0],OBJ[watcher].pos[1],OBJ[watcher].pos[2],
+			marker,OBJ[marker].pos[0],OBJ[marker].pos[1],OBJ[marker].pos[2]);
+	assert(in_view(OBJ[watcher].pos,OBJ[marker].pos));
+}
+
+static void
+leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	printf("op=leaveAOI,watcher=[id=%d,pos=(%.1f,%.1f,%.1f)],marker=[id=%d,pos=(%.1f,%.1f,%.1f)]\n",
+			watcher,OBJ[watcher].pos[0],OBJ[watcher].pos[1],OBJ[watcher].pos[2],
+			marker,OBJ[marker].pos[0],OBJ[marker].pos[1],OBJ[marker].pos[2]);
+	if (check_leave_aoi) {
+		// True if event not triggered by aoi_leave
+		assert(!in_view(OBJ[watcher].pos,OBJ[marker].pos));
+	}
+}
+
+static void
+test(struct aoi_space *aoi) {
+	int i,j;
+	check_leave_aoi = true;
+	// w(atcher) m(arker)
+	init_obj(0,40,0,0,0,2,0,"wm");
+	init_obj(1,42,100,0,0,-2,0,"wm");
+	init_obj(2,0,40,0,2,0,0,"w");
+	init_obj(3,100,42,0,-2,0,0,"w");
+	init_obj(4,42,40,1,0,0,2,"wm");
+	init_obj(5,40,42,100,0,0,-2,"w");
+	init_obj(6,40,42,100,0,0,-2,"m");
+	for(i=0; i<7; i++) {
+		aoi_enter(aoi,i,OBJ[i].pos,OBJ[i].mode);
+	}
+	for(i=0; i<100; i++) {
+		if (i < 50) {
+			for(j=0; j<7; j++) {
+				update_obj(aoi,j);
+			}
+		} else if (i == 50) {
+			strcpy(OBJ[6].mode,"wm");
+			aoi_change_mode(aoi,6,OBJ[6].mode);
+		} else {
+			for(j=0; j<7; j++) {
+				update_obj(aoi,j);
+			}
+		}
+	}
+	int number = 0;
+	float range[3] = {4,4,0};
+	float pos[3] = {40,4,0};
+	void **ids = aoi_get_view_by_pos(aoi,pos,range,&number);
+	//ids = aoi_get_view_by_pos(aoi,pos,NULL,&number);
+	if (ids != NULL && number != 0) {
+		printf("op=get_view_by_pos,pos=(%.1f,%.1f,%.1f),range=(%.1f,%.1f,%.1f),ids=",
+				pos[0],pos[1],pos[2],range[0],range[1],range[2]);
+		for(i=0; i<number; i++) {
+			if (i == number -1) {
+				printf("%u",(uint32_t)ids[i]);
+			} else {
+				printf("%u,",(uint32_t)ids[i]);
+			}
+		}
+		printf("\n");
+	}
+	uint32_t id = 5;
+	ids = aoi_get_view(aoi,id,range,&number);
+	//ids = aoi_get_view(aoi,id,NULL,&number);
+	if (ids != NULL && number != 0) {
+		printf("op=get_view,id=%u,pos=(%.1f,%.1f,%.1f),range=(%.1f,%.1f,%.1f),ids=",
+				id,OBJ[id].pos[0],OBJ[id].pos[1],OBJ[id].pos[2],range[0],range[1],range[2]);
+		for(i=0; i<number; i++) {
+			if (i == number -1) {
+				printf("%u",(uint32_t)ids[i]);
+			} else {
+				printf("%u,",(uint32_t)ids[i]);
+			}
+		}
+		printf("\n");
+	}
+	check_leave_aoi = false;
+	for(i=0; i<7; i++) {
+		aoi_leave(aoi,i);
+	}
+}
+
+#define RANDOM_OBJ 64
+
+typedef struct random_ctx {
+	float map_size[3];
+	float view_size[RANDOM_OBJ][3];
+	float pos[RANDOM_OBJ][3];
+	char mode[RANDOM_OBJ][4];
+	bool in_scene[RANDOM_OBJ];
+	bool see[RANDOM_OBJ][RANDOM_OBJ];
+	float hysteresis;
+} random_ctx;
+
+#define RANDOM_POLL 1
+#define RANDOM_DEFER 2
+#define RANDOM_HYSTERESIS 4
+#define RANDOM_DENSE 8
+#define RANDOM_COMPACT 16
+
+static void
+random_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	random_ctx *ctx = ud;
+	assert(watcher != marker);
+	assert(!ctx->see[watcher][marker]);
+	ctx->see[watcher][marker] = true;
+}
+
+static void
+random_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	random_ctx *ctx = ud;
+	assert(ctx->see[watcher][marker]);
+	ctx->see[watcher][marker] = false;
+}
+
+// marker is within the view of watcher widened by extra
+static bool
+random_should_see(random_ctx *ctx,int watcher,int marker,float extra) {
+	int i;
+	if (watcher == marker || !ctx->in_scene[watcher] || !ctx->in_scene[marker]) {
+		return false;
+	}
+	if (strchr(ctx->mode[watcher],'w') == NULL) {
+		return false;
+	}
+	for (i=0; i<3; i++) {
+		if (fabs(ctx->pos[watcher][i] - ctx->pos[marker][i]) > ctx->view_size[watcher][i] + extra) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+random_poll(aoi_space *aoi,random_ctx *ctx) {
+	int i,number;
+	aoi_event *events = aoi_poll_events(aoi,&number);
+	for (i=0; i<number; i++) {
+		if (events[i].type == AOI_EVENT_ENTER) {
+			random_enterAOI(ctx,events[i].watcher,events[i].marker);
+		} else {
+			random_leaveAOI(ctx,events[i].watcher,events[i].marker);
+		}
+	}
+	aoi_poll_events(aoi,&number);
+	assert(number == 0);
+}
+
+// a marker within the hysteresis beyond the view may be still seen
+static void
+random_check(random_ctx *ctx) {
+	int i,j;
+	for (i=0; i<RANDOM_OBJ; i++) {
+		for (j=0; j<RANDOM_OBJ; j++) {
+			if (ctx->see[i][j]) {
+				assert(random_should_see(ctx,i,j,ctx->hysteresis));
+			} else {
+				assert(!random_should_see(ctx,i,j,0));
+			}
+		}
+	}
+}
+
+static void
+random_pos(random_ctx *ctx,int id,float step) {
+	int i;
+	for (i=0; i<3; i++) {
+		float pos = ctx->pos[id][i];
+		if (step > 0) {
+			pos += step * (2.0f * rand() / RAND_MAX - 1.0f);
+		} else {
+			pos = ctx->map_size[i] * rand() / RAND_MAX;
+		}
+		if (pos < 0 || pos >= ctx->map_size[i]) {
+			pos = ctx->map_size[i] / 2;
+		}
+		ctx->pos[id][i] = pos;
+	}
+}
+
+// random enter/leave/move,verify every event against brute force result
+static void
+test_random(float map_size[3],float view_size[3],int round,int flag) {
+	static const char *modes[] = {"w","m","wm"};
+	static random_ctx ctx;
+	int i,j;
+	memset(&ctx,0,sizeof(ctx));
+	memcpy(ctx.map_size,map_size,sizeof(ctx.map_size));
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi;
+	if (flag & RANDOM_POLL) {
+		aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	} else {
+		aoi = aoi_create(my_alloc,&cookie,map_size,view_size,random_enterAOI,random_leaveAOI,&ctx);
+	}
+	aoi_set_defer(aoi,flag & RANDOM_DEFER);
+	if (flag & RANDOM_DENSE) {
+		aoi_set_dense_id(aoi,RANDOM_OBJ);
+	}
+	if (flag & RANDOM_HYSTERESIS) {
+		ctx.hysteresis = view_size[0] / 3;
+		aoi_set_hysteresis(aoi,ctx.hysteresis);
+	}
+	for (i=0; i<round; i++) {
+		int id = rand() % RANDOM_OBJ;
+		int op = rand() % 10;
+		if (!ctx.in_scene[id]) {
+			random_pos(&ctx,id,0);
+			strcpy(ctx.mode[id],modes[rand() % 3]);
+			memcpy(ctx.view_size[id],view_size,sizeof(ctx.view_size[id]));
+			ctx.in_scene[id] = true;
+			aoi_enter(aoi,id,ctx.pos[id],ctx.mode[id]);
+		} else if (op == 0) {
+			ctx.in_scene[id] = false;
+			aoi_leave(aoi,id);
+		} else if (op == 1) {
+			random_pos(&ctx,id,0);
+			aoi_move(aoi,id,ctx.pos[id]);
+		} else if (op == 2) {
+			// per-entity view range,0 means default
+			float scale = (rand() % 4) * 0.5f;
+			if (scale == 0) {
+				memcpy(ctx.view_size[id],view_size,sizeof(ctx.view_size[id]));
+				aoi_set_view_range(aoi,id,NULL);
+			} else {
+				for (j=0; j<3; j++) {
+					ctx.view_size[id][j] = view_size[j] * scale;
+				}
+				aoi_set_view_range(aoi,id,ctx.view_size[id]);
+			}
+		} else if (op == 3) {
+			// batch move,ids may repeat
+			uint32_t ids[16];
+			float pos[16][3];
+			int k,n = 0;
+			for (j=0; j<16; j++) {
+				int other = rand() % RANDOM_OBJ;
+				if (!ctx.in_scene[other]) {
+					continue;
+				}
+				random_pos(&ctx,other,view_size[0]);
+				for (k=0; k<3; k++) {
+					pos[n][k] = ctx.pos[other][k];
+				}
+				ids[n++] = other;
+			}
+			aoi_move_batch(aoi,ids,(const float (*)[3])pos,n);
+		} else {
+			random_pos(&ctx,id,view_size[0]);
+			aoi_move(aoi,id,ctx.pos[id]);
+		}
+		if ((flag & RANDOM_DEFER) && i % 4 != 3) {
+			continue;
+		}
+		aoi_update(aoi);
+		if (flag & RANDOM_POLL) {
+			random_poll(aoi,&ctx);
+		}
+		random_check(&ctx);
+		if ((flag & RANDOM_COMPACT) && i % 64 == 0) {
+			aoi_compact(aoi);
+		}
+	}
+	for (i=0; i<RANDOM_OBJ; i++) {
+		if (ctx.in_scene[i]) {
+			ctx.in_scene[i] = false;
+			aoi_leave(aoi,i);
+		}
+	}
+	if (flag & RANDOM_POLL) {
+		random_poll(aoi,&ctx);
+	}
+	random_check(&ctx);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_random,round=%d,flag=%d,max memory = %d\n",round,flag,cookie.max);
+}
+
+#define DEFER_OBJ 200
+
+// a single deferred move fires the events of aoi_move in the same order
+static void
+test_defer() {
+	static float pos[DEFER_OBJ][3];
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	int i,j,number1,number2;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi1 = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	struct aoi_space *aoi2 = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	for (i=0; i<DEFER_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_enter(aoi1,i,pos[i],"wm");
+		aoi_enter(aoi2,i,pos[i],"wm");
+	}
+	aoi_poll_events(aoi1,&number1);
+	aoi_poll_events(aoi2,&number2);
+	aoi_set_defer(aoi2,true);
+	for (i=0; i<DEFER_OBJ; i++) {
+		uint32_t id = rand() % DEFER_OBJ;
+		for (j=0; j<3; j++) {
+			pos[id][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_move(aoi1,id,pos[id]);
+		aoi_move(aoi2,id,pos[id]);
+		aoi_update(aoi2);
+		aoi_event *events1 = aoi_poll_events(aoi1,&number1);
+		aoi_event *events2 = aoi_poll_events(aoi2,&number2);
+		assert(number1 == number2);
+		assert(number1 == 0 || memcmp(events1,events2,number1 * sizeof(aoi_event)) == 0);
+	}
+	for (i=0; i<DEFER_OBJ; i++) {
+		aoi_leave(aoi1,i);
+		aoi_leave(aoi2,i);
+	}
+	aoi_release(aoi1);
+	aoi_release(aoi2);
+	assert(cookie.current == 0);
+	printf("op=test_defer\n");
+}
+
+static int flap_events = 0;
+
+static void
+flap_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	flap_events++;
+}
+
+static void
+flap_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	flap_events++;
+}
+
+// enters fire at once,leaves wait until the hysteresis is passed
+static void
+test_hysteresis() {
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	float pos0[3] = {50,50,50};
+	float pos1[3] = {60.5,50,50};
+	float range[3] = {0.1f,0.1f,0.1f};
+	uint32_t ids[4];
+	int i,number;
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,flap_enterAOI,flap_leaveAOI,NULL);
+	aoi_set_hysteresis(aoi,2);
+	aoi_enter(aoi,0,pos0,"wm");
+	aoi_enter(aoi,1,pos1,"wm");
+	assert(flap_events == 0);
+	pos1[0] = 59.5;
+	aoi_move(aoi,1,pos1);
+	assert(flap_events == 2);
+	for (i=0; i<10; i++) {
+		pos1[0] = i % 2 == 0 ? 61.5 : 59.5;
+		aoi_move(aoi,1,pos1);
+	}
+	assert(flap_events == 2);
+	// the position is not held back,a marker beyond the view is still seen
+	pos1[0] = 61.5;
+	aoi_move(aoi,1,pos1);
+	assert(aoi_query_view_by_pos(aoi,pos1,range,ids,4) == 1 && ids[0] == 1);
+	aoi_get_view_by_pos(aoi,pos1,range,&number);
+	assert(number == 1);
+	assert(aoi_query_view(aoi,0,NULL,ids,4) == 1 && ids[0] == 1);
+	aoi_get_view(aoi,0,NULL,&number);
+	assert(number == 1);
+	pos1[0] = 62.5;
+	aoi_move(aoi,1,pos1);
+	assert(flap_events == 4);
+	assert(aoi_query_view(aoi,0,NULL,ids,4) == 0);
+	// back within the hysteresis is no enter,back within the view is
+	pos1[0] = 61;
+	aoi_move(aoi,1,pos1);
+	assert(flap_events == 4);
+	pos1[0] = 60;
+	aoi_move(aoi,1,pos1);
+	assert(flap_events == 6);
+	// a lingering marker leaves with its watcher
+	pos1[0] = 61;
+	aoi_move(aoi,1,pos1);
+	aoi_leave(aoi,0);
+	assert(flap_events == 8);
+	aoi_leave(aoi,1);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_hysteresis,events=%d\n",flap_events);
+}
+
+static int boundary_see = 0;
+
+static void
+boundary_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	boundary_see++;
+}
+
+static void
+boundary_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	boundary_see--;
+}
+
+// markers exactly on the view boundary are in view,stepping out of it leaves
+static void
+test_boundary() {
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	float pos0[3] = {50,50,50};
+	float pos1[3] = {60,50,50};
+	float pos2[3] = {40,50,50};
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,boundary_enterAOI,boundary_leaveAOI,NULL);
+	aoi_enter(aoi,1,pos1,"m");
+	aoi_enter(aoi,2,pos2,"m");
+	aoi_enter(aoi,0,pos0,"w");
+	assert(boundary_see == 2);
+	pos1[0] = 60.5;
+	aoi_move(aoi,1,pos1);
+	assert(boundary_see == 1);
+	pos2[0] = 39;
+	aoi_move(aoi,2,pos2);
+	assert(boundary_see == 0);
+	pos1[0] = 60;
+	aoi_move(aoi,1,pos1);
+	assert(boundary_see == 1);
+	// the watcher steps away from marker 1
+	pos0[0] = 49.5;
+	aoi_move(aoi,0,pos0);
+	assert(boundary_see == 0);
+	aoi_leave(aoi,0);
+	aoi_leave(aoi,1);
+	aoi_leave(aoi,2);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_boundary\n");
+}
+
+#define QUERY_OBJ 1000
+
+// compare every query with brute force,positions are spread over spread*spread*spread points
+static void
+test_get_view(int spread) {
+	static float pos[QUERY_OBJ][3];
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	int i,j,k;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	for (i=0; i<QUERY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			// coarse grid,so many entries sit exactly on a window boundary
+			pos[i][j] = rand() % spread * 5;
+		}
+		aoi_enter(aoi,i,pos[i],"m");
+	}
+	for (i=0; i<1000; i++) {
+		int number;
+		int expect = 0;
+		float center[3];
+		float range[3];
+		for (j=0; j<3; j++) {
+			center[j] = rand() % spread * 5;
+			range[j] = rand() % 5 * 5;
+		}
+		for (k=0; k<QUERY_OBJ; k++) {
+			for (j=0; j<3; j++) {
+				if (fabs(pos[k][j] - center[j]) > range[j]) {
+					break;
+				}
+			}
+			if (j == 3) {
+				expect++;
+			}
+		}
+		void **ids = aoi_get_view_by_pos(aoi,center,range,&number);
+		assert(number == expect);
+		for (k=0; k<number; k++) {
+			uint32_t id = (uint32_t)ids[k];
+			for (j=0; j<3; j++) {
+				assert(fabs(pos[id][j] - center[j]) <= range[j]);
+			}
+		}
+	}
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_get_view,spread=%d\n",spread);
+}
+
+#define MAP_OBJ 1000
+
+// ids sharing low bits enter and leave,the object map grows and shrinks back,
+// in dense id mode pages are added and freed
+static void
+test_map(bool dense) {
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	float pos[3] = {50,50,50};
+	int i,number;
+	struct alloc_cookie cookie = {0,0,0};
+	int stride = dense ? 7 : 4096;
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	if (dense) {
+		aoi_set_dense_id(aoi,MAP_OBJ*stride);
+	}
+	aoi_enter(aoi,1,pos,"w");
+	for (i=0; i<MAP_OBJ; i++) {
+		aoi_enter(aoi,i*stride,pos,"m");
+	}
+	if (dense) {
+		// ids past the bound are ignored
+		aoi_enter(aoi,MAP_OBJ*stride,pos,"m");
+		aoi_enter(aoi,UINT32_MAX,pos,"m");
+	}
+	aoi_poll_events(aoi,&number);
+	assert(number == MAP_OBJ);
+	for (i=0; i<MAP_OBJ; i+=2) {
+		aoi_leave(aoi,i*stride);
+	}
+	aoi_poll_events(aoi,&number);
+	assert(number == MAP_OBJ/2);
+	// left ids and ids never entered are not found
+	aoi_leave(aoi,0);
+	aoi_leave(aoi,2);
+	aoi_poll_events(aoi,&number);
+	assert(number == 0);
+	for (i=1; i<MAP_OBJ; i+=2) {
+		aoi_leave(aoi,i*stride);
+	}
+	aoi_poll_events(aoi,&number);
+	assert(number == MAP_OBJ/2);
+	aoi_leave(aoi,1);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_map,dense=%d\n",dense);
+}
+
+#define SLAB_OBJECT 100
+
+// objects leave and enter again at the same place,memory is reused without calling the allocator
+static void
+test_slab() {
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	float pos[3] = {50,50,50};
+	int i,j,number;
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	for (i=0; i<SLAB_OBJECT; i++) {
+		aoi_enter(aoi,i,pos,"wm");
+	}
+	aoi_poll_events(aoi,&number);
+	int total = 0;
+	for (i=0; i<10; i++) {
+		// the first round fills the free lists
+		if (i == 1) {
+			total = cookie.total;
+		}
+		for (j=0; j<SLAB_OBJECT; j++) {
+			aoi_leave(aoi,j);
+			aoi_enter(aoi,j,pos,"wm");
+			aoi_poll_events(aoi,&number);
+			assert(number == 4*(SLAB_OBJECT-1));
+		}
+	}
+	assert(cookie.total == total);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_slab\n");
+}
+
+typedef struct query_ctx {
+	struct aoi_space *aoi;
+	int enter;
+} query_ctx;
+
+static int
+query_compare(const void *a,const void *b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// queries from a callback write to their own buffer,the marker is already in view
+static void
+query_enterAOI(void *ud,uint32_t watcher,uint32_t marker) {
+	query_ctx *ctx = ud;
+	uint32_t ids[QUERY_OBJ];
+	int i;
+	int number = aoi_query_view(ctx->aoi,watcher,NULL,ids,QUERY_OBJ);
+	assert(number <= QUERY_OBJ);
+	for (i=0; i<number && ids[i] != marker; i++) {
+	}
+	assert(i < number);
+	ctx->enter++;
+}
+
+static void
+query_leaveAOI(void *ud,uint32_t watcher,uint32_t marker) {
+}
+
+// ids written to caller buffers,compare with the old api
+static void
+test_query() {
+	static float pos[QUERY_OBJ][3];
+	static uint32_t expect[QUERY_OBJ];
+	static uint32_t ids[QUERY_OBJ+1];
+	float map_size[3] = {50,50,50};
+	float view_size[3] = {10,10,10};
+	int i,j,k;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	query_ctx ctx = {NULL,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,query_enterAOI,query_leaveAOI,&ctx);
+	ctx.aoi = aoi;
+	for (i=0; i<QUERY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_enter(aoi,i,pos[i],"wm");
+	}
+	for (i=0; i<QUERY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+		aoi_move(aoi,i,pos[i]);
+	}
+	assert(ctx.enter > 0);
+	for (i=0; i<1000; i++) {
+		int number,n;
+		float center[3];
+		float range[3];
+		for (j=0; j<3; j++) {
+			center[j] = map_size[j] * rand() / RAND_MAX;
+			range[j] = rand() % 10;
+		}
+		void **result = aoi_get_view_by_pos(aoi,center,i % 4 == 0 ? NULL : range,&number);
+		for (k=0; k<number; k++) {
+			expect[k] = (uint32_t)result[k];
+		}
+		n = aoi_query_view_by_pos(aoi,center,i % 4 == 0 ? NULL : range,ids,QUERY_OBJ);
+		assert(n == number);
+		qsort(ids,n,sizeof(uint32_t),query_compare);
+		qsort(expect,number,sizeof(uint32_t),query_compare);
+		assert(memcmp(ids,expect,n*sizeof(uint32_t)) == 0);
+		// a short buffer keeps the first cap ids and reports the size needed
+		int cap = number / 2;
+		ids[cap] = ~0;
+		n = aoi_query_view_by_pos(aoi,center,range,ids,cap);
+		assert(n == aoi_query_view_by_pos(aoi,center,range,NULL,0));
+		assert(ids[cap] == (uint32_t)~0);
+		for (k=0; k<cap; k++) {
+			assert(bsearch(&ids[k],expect,number,sizeof(uint32_t),query_compare) != NULL);
+		}
+		// queries while iterating a result of the old api leave it untouched
+		uint32_t id = rand() % QUERY_OBJ;
+		result = aoi_get_view(aoi,id,NULL,&number);
+		for (k=0; k<number; k++) {
+			expect[k] = (uint32_t)result[k];
+		}
+		for (k=0; k<number; k++) {
+			aoi_query_view(aoi,(uint32_t)result[k],range,ids,QUERY_OBJ);
+		}
+		for (k=0; k<number; k++) {
+			assert((uint32_t)result[k] == expect[k]);
+		}
+		n = aoi_query_view(aoi,id,NULL,ids,QUERY_OBJ);
+		assert(n == number);
+		qsort(ids,n,sizeof(uint32_t),query_compare);
+		qsort(expect,number,sizeof(uint32_t),query_compare);
+		assert(memcmp(ids,expect,n*sizeof(uint32_t)) == 0);
+	}
+	assert(aoi_query_view(aoi,QUERY_OBJ,NULL,ids,QUERY_OBJ) == 0);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_query\n");
+}
+
+#define BATCH_OBJ 1000
+#define BATCH_VIEW 400
+
+// squads move together in a batch,moves sharing cells are grouped,the views end up
+// the same as aoi_move one by one
+static void
+test_batch() {
+	static float pos[BATCH_OBJ][3];
+	static uint32_t ids[BATCH_OBJ];
+	static uint32_t view1[BATCH_VIEW],view2[BATCH_VIEW];
+	float map_size[3] = {100,100,20};
+	float view_size[3] = {10,10,10};
+	float dir[3];
+	int i,j,k,number1,number2;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi1 = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	struct aoi_space *aoi2 = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	for (i=0; i<BATCH_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = i % 8 == 0 ? map_size[j] * rand() / RAND_MAX : pos[i-1][j];
+		}
+		ids[i] = i;
+		aoi_enter(aoi1,i,pos[i],"wm");
+		aoi_enter(aoi2,i,pos[i],"wm");
+	}
+	for (k=0; k<20; k++) {
+		for (i=0; i<BATCH_OBJ; i++) {
+			for (j=0; j<3; j++) {
+				if (i % 8 == 0) {
+					dir[j] = view_size[j] * (2.0f * rand() / RAND_MAX - 1.0f);
+				}
+				float v = pos[i][j] + dir[j];
+				if (v >= 0 && v < map_size[j]) {
+					pos[i][j] = v;
+				}
+			}
+			aoi_move(aoi1,i,pos[i]);
+		}
+		aoi_move_batch(aoi2,ids,(const float (*)[3])pos,BATCH_OBJ);
+		aoi_poll_events(aoi1,&number1);
+		aoi_poll_events(aoi2,&number2);
+		for (i=0; i<BATCH_OBJ; i++) {
+			number1 = aoi_query_view(aoi1,i,NULL,view1,BATCH_VIEW);
+			number2 = aoi_query_view(aoi2,i,NULL,view2,BATCH_VIEW);
+			assert(number1 == number2 && number1 <= BATCH_VIEW);
+			qsort(view1,number1,sizeof(uint32_t),query_compare);
+			qsort(view2,number2,sizeof(uint32_t),query_compare);
+			assert(memcmp(view1,view2,number1 * sizeof(uint32_t)) == 0);
+		}
+	}
+	for (i=0; i<BATCH_OBJ; i++) {
+		aoi_leave(aoi1,i);
+		aoi_leave(aoi2,i);
+	}
+	aoi_release(aoi1);
+	aoi_release(aoi2);
+	assert(cookie.current == 0);
+	printf("op=test_batch\n");
+}
+
+#define MEMORY_OBJ 2000
+
+static void
+memory_check(struct aoi_space *aoi,struct alloc_cookie *cookie,int number) {
+	aoi_memory stats;
+	aoi_memory_stats(aoi,&stats);
+	assert(stats.total == cookie->current);
+	assert(stats.object_number == number && stats.map_number == number);
+	assert(stats.object_number <= stats.object_cap);
+	assert(stats.map_number <= stats.map_cap);
+	assert(stats.index_used <= stats.index_cap);
+	assert(stats.set_used <= stats.set_cap);
+}
+
+// every byte from the allocator shows up in the stats
+static void
+test_memory(bool dense) {
+	static float pos[MEMORY_OBJ][3];
+	static uint32_t ids[MEMORY_OBJ];
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	int i,j,number;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	if (dense) {
+		aoi_set_dense_id(aoi,0);
+	}
+	memory_check(aoi,&cookie,0);
+	for (i=0; i<MEMORY_OBJ; i++) {
+		// a crowd around the center
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] / 2 + 20.0f * rand() / RAND_MAX;
+		}
+		ids[i] = i;
+		aoi_enter(aoi,i,pos[i],i % 3 == 0 ? "m" : "wm");
+	}
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	for (i=0; i<MEMORY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+	}
+	aoi_move_batch(aoi,ids,(const float (*)[3])pos,MEMORY_OBJ);
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	// an empty batch does nothing
+	aoi_move_batch(aoi,NULL,NULL,0);
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	aoi_set_defer(aoi,true);
+	for (i=0; i<MEMORY_OBJ; i+=2) {
+		aoi_move(aoi,i,pos[(i+1) % MEMORY_OBJ]);
+	}
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	aoi_update(aoi);
+	aoi_set_defer(aoi,false);
+	aoi_get_view_by_pos(aoi,pos[0],map_size,&number);
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	aoi_poll_events(aoi,&number);
+	for (i=0; i<MEMORY_OBJ; i+=2) {
+		aoi_leave(aoi,i);
+	}
+	memory_check(aoi,&cookie,MEMORY_OBJ/2);
+	for (i=1; i<MEMORY_OBJ; i+=2) {
+		aoi_leave(aoi,i);
+	}
+	memory_check(aoi,&cookie,0);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_memory,dense=%d\n",dense);
+}
+
+// a crowd gathers and disperses,compact returns what it left behind
+static void
+test_compact() {
+	static float pos[MEMORY_OBJ][3];
+	static uint32_t ids[MEMORY_OBJ];
+	float map_size[3] = {100,100,100};
+	float view_size[3] = {10,10,10};
+	int i,j,number;
+	aoi_memory before,after;
+	srand(1);
+	struct alloc_cookie cookie = {0,0,0};
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,NULL,NULL,NULL);
+	for (i=0; i<MEMORY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] / 2 + 5.0f * rand() / RAND_MAX;
+		}
+		ids[i] = i;
+		aoi_enter(aoi,i,pos[i],"wm");
+	}
+	for (i=0; i<MEMORY_OBJ; i++) {
+		for (j=0; j<3; j++) {
+			pos[i][j] = map_size[j] * rand() / RAND_MAX;
+		}
+	}
+	aoi_move_batch(aoi,ids,(const float (*)[3])pos,MEMORY_OBJ);
+	aoi_get_view_by_pos(aoi,pos[0],map_size,&number);
+	aoi_poll_events(aoi,&number);
+	for (i=MEMORY_OBJ/10; i<MEMORY_OBJ; i++) {
+		aoi_leave(aoi,i);
+	}
+	aoi_poll_events(aoi,&number);
+	aoi_memory_stats(aoi,&before);
+	aoi_compact(aoi);
+	memory_check(aoi,&cookie,MEMORY_OBJ/10);
+	aoi_memory_stats(aoi,&after);
+	assert(after.total < before.total);
+	assert(after.object_cap < before.object_cap);
+	assert(after.index_cap < before.index_cap);
+	assert(after.set_cap < before.set_cap);
+	assert(after.buffer_bytes == 0);
+	// nothing left to return
+	aoi_compact(aoi);
+	aoi_memory_stats(aoi,&before);
+	assert(before.total == after.total);
+	// the space still works after compact
+	for (i=MEMORY_OBJ/10; i<MEMORY_OBJ; i++) {
+		aoi_enter(aoi,i,pos[i],"wm");
+	}
+	aoi_move_batch(aoi,ids,(const float (*)[3])pos,MEMORY_OBJ);
+	memory_check(aoi,&cookie,MEMORY_OBJ);
+	aoi_release(aoi);
+	assert(cookie.current == 0);
+	printf("op=test_compact\n");
+}
+
+int
+main() {
+	struct alloc_cookie cookie = {0,0,0};
+
+	struct aoi_space *aoi = aoi_create(my_alloc,&cookie,map_size,view_size,enterAOI,leaveAOI,NULL);
+	test(aoi);
+	aoi_release(aoi);
+	printf("max memory = %d,current memory = %d\n",cookie.max,cookie.current);
+	float random_map_size[3] = {30,30,30};
+	test_random(random_map_size,view_size,20000,0);
+	// crowded
+	float crowd_map_size[3] = {9,9,9};
+	test_random(crowd_map_size,view_size,20000,0);
+	// events polled from buffer instead of callbacks
+	test_random(random_map_size,view_size,20000,RANDOM_POLL);
+	// moves applied once per 4 ops,cancelling events are dropped
+	test_random(random_map_size,view_size,20000,RANDOM_DEFER);
+	test_random(crowd_map_size,view_size,20000,RANDOM_DEFER|RANDOM_POLL);
+	// leaves delayed by hysteresis
+	test_random(random_map_size,view_size,20000,RANDOM_HYSTERESIS);
+	test_random(random_map_size,view_size,20000,RANDOM_HYSTERESIS|RANDOM_DEFER);
+	test_random(crowd_map_size,view_size,20000,RANDOM_HYSTERESIS|RANDOM_POLL);
+	// objects indexed by id
+	test_random(random_map_size,view_size,20000,RANDOM_DENSE);
+	// memory returned now and then
+	test_random(random_map_size,view_size,20000,RANDOM_COMPACT);
+	test_random(crowd_map_size,view_size,20000,RANDOM_COMPACT|RANDOM_DEFER|RANDOM_POLL);
+	test_hysteresis();
+	test_defer();
+	test_boundary();
+	test_get_view(21);
+	// objects crowd in a few cells,which keep them sorted
+	test_get_view(9);
+	test_map(false);
+	test_map(true);
+	test_slab();
+	test_query();
+	test_batch();
+	test_memory(false);
+	test_memory(true);
+	test_compact();
+	return 0;
+}
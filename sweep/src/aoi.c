@@ -0,0 +1,1786 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "aoi.h"
+
+#define INVALID_ID (~0)
+#define PRE_ALLOC 16
+#define MAP_PAGE 256	// ids of a page in dense id mode
+#define SLAB_OBJECT 64	// objects carved from a slab
+//#define PRE_ALLOC 32
+#define MODE_WATCHER 1
+#define MODE_MARKER 2
+// pairs checked by pair_move
+#define PAIR_ALL 0
+#define PAIR_BEFORE 1	// within view plus hysteresis before the move,found in the old window
+#define PAIR_AFTER 2	// the others,found in the new window
+
+typedef struct aoi_object {
+	uint32_t id;
+	int mode;
+	bool custom_view;
+	float pos[3];
+	float view_size[3];
+	uint32_t index;	// slot in aoi->slot,entries at the same position are ordered by it
+	int batch_index;	// index in aoi->batch during aoi_move_batch
+	int pending_index;	// index in aoi->pending_ids when move is deferred
+	uint32_t *linger;	// markers still seen beyond the view,until they pass the hysteresis
+	int linger_number;
+	int linger_cap;
+	struct aoi_object *next_free;	// next object of aoi->free_objects
+} aoi_object;
+
+// objects are carved from slabs,left ones wait in aoi->free_objects for the next enter
+typedef struct aoi_slab {
+	struct aoi_slab *next;
+	aoi_object obj[SLAB_OBJECT];
+} aoi_slab;
+
+// open addressing with linear probing,an empty slot has no obj
+typedef struct aoi_map_slot {
+	uint32_t id;
+	aoi_object * obj;
+} aoi_map_slot;
+
+// a page of objects indexed by id in dense id mode
+typedef struct aoi_map_page {
+	int number;
+	aoi_object *obj[MAP_PAGE];
+} aoi_map_page;
+
+typedef struct aoi_map {
+	int size;
+	int number;
+	aoi_map_slot * slot;
+	aoi_map_page **page;	// pages of dense id mode,NULL when ids are hashed
+	int page_number;
+	uint32_t max_id;	// ids of dense id mode are below it,0 means no bound
+} aoi_map;
+
+typedef struct aoi_set {
+	int cap;
+	int number;
+	void **slot;
+} aoi_set;
+
+// ids written to a caller buffer,number counts all matches even past cap
+typedef struct aoi_result {
+	uint32_t *ids;
+	int cap;
+	int number;
+	uint32_t skip;	// id left out,INVALID_ID for none
+} aoi_result;
+
+// entries of all objects sorted by position on one axis,positions on the other
+// axes are kept alongside,so a range of entries is filtered without touching objects
+typedef struct aoi_axis {
+	float *pos[3];	// pos[i][k]: position on axis i of the k-th entry
+	uint32_t *index;	// slot of the object of the k-th entry
+} aoi_axis;
+
+typedef struct aoi_batch_move {
+	aoi_object *obj;
+	float old_pos[3];
+	float pos[3];
+} aoi_batch_move;
+
+typedef struct aoi_space {
+	aoi_map *objects;
+	aoi_object **slot;	// objects by index,NULL when the slot is free
+	uint32_t *free_slot;	// stack of free slots
+	int free_number;
+	int slot_number;	// slots ever used
+	int cap;	// capacity of slots and entries
+	aoi_axis axis[3];	// entries sorted on x,y,z
+	int entry_number;	// entries of each axis
+	float map_size[3];
+	float view_size[3];
+	float max_view[3];	// max view size of all objects
+	int custom_view_number;
+	float hysteresis;	// a seen marker leaves only when it is this distance beyond the view
+	aoi_Alloc alloc;
+	void *alloc_ud;
+	enterAOI_Callback cb_enterAOI;
+	leaveAOI_Callback cb_leaveAOI;
+	void *cb_ud;
+	aoi_event *events;	// buffered events when no callback
+	int event_number;
+	int event_cap;
+	bool buffered;	// events go to aoi->events
+	bool defer;	// moves are applied in aoi_update
+	uint32_t *pending_ids;
+	float (*pending_pos)[3];
+	int pending_number;
+	int pending_cap;
+	aoi_set *set1;
+	aoi_set *result_set;
+	aoi_batch_move *batch;
+	int batch_cap;
+	aoi_slab *slab;
+	aoi_object *free_objects;
+} aoi_space;
+
+static void *
+array_resize(aoi_space *aoi,void *ptr,int old_cap,int cap,size_t sz) {
+	void *new_ptr = aoi->alloc(aoi->alloc_ud,NULL,cap * sz);
+	if (ptr != NULL) {
+		memcpy(new_ptr,ptr,(old_cap < cap ? old_cap : cap) * sz);
+		aoi->alloc(aoi->alloc_ud,ptr,old_cap * sz);
+	}
+	return new_ptr;
+}
+
+// slots and entries of every axis share one capacity
+static void
+slot_resize(aoi_space *aoi,int cap) {
+	int i,j;
+	aoi->slot = array_resize(aoi,aoi->slot,aoi->cap,cap,sizeof(aoi_object*));
+	aoi->free_slot = array_resize(aoi,aoi->free_slot,aoi->cap,cap,sizeof(uint32_t));
+	for (i=0; i<3; i++) {
+		aoi_axis *axis = &aoi->axis[i];
+		for (j=0; j<3; j++) {
+			axis->pos[j] = array_resize(aoi,axis->pos[j],aoi->cap,cap,sizeof(float));
+		}
+		axis->index = array_resize(aoi,axis->index,aoi->cap,cap,sizeof(uint32_t));
+	}
+	aoi->cap = cap;
+}
+
+static void
+slot_free_all(aoi_space *aoi) {
+	int i,j;
+	if (aoi->cap == 0) {
+		return;
+	}
+	aoi->alloc(aoi->alloc_ud,aoi->slot,aoi->cap * sizeof(aoi_object*));
+	aoi->alloc(aoi->alloc_ud,aoi->free_slot,aoi->cap * sizeof(uint32_t));
+	for (i=0; i<3; i++) {
+		aoi_axis *axis = &aoi->axis[i];
+		for (j=0; j<3; j++) {
+			aoi->alloc(aoi->alloc_ud,axis->pos[j],aoi->cap * sizeof(float));
+		}
+		aoi->alloc(aoi->alloc_ud,axis->index,aoi->cap * sizeof(uint32_t));
+	}
+}
+
+static aoi_object *
+object_alloc(aoi_space *aoi) {
+	if (aoi->free_objects == NULL) {
+		int i;
+		aoi_slab *slab = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_slab));
+		slab->next = aoi->slab;
+		aoi->slab = slab;
+		// objects entering one after another are adjacent
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			slab->obj[i].next_free = aoi->free_objects;
+			aoi->free_objects = &slab->obj[i];
+		}
+	}
+	aoi_object *obj = aoi->free_objects;
+	aoi->free_objects = obj->next_free;
+	return obj;
+}
+
+static void
+object_free(aoi_space *aoi,aoi_object *obj) {
+	obj->next_free = aoi->free_objects;
+	aoi->free_objects = obj;
+}
+
+static void
+slab_delete(aoi_space *aoi) {
+	while (aoi->slab != NULL) {
+		aoi_slab *slab = aoi->slab;
+		aoi->slab = slab->next;
+		aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+	}
+	aoi->free_objects = NULL;
+}
+
+// slabs with all objects free go back to the allocator,free objects are marked by mode -1
+static void
+slab_compact(aoi_space *aoi) {
+	int i;
+	aoi_object *obj;
+	aoi_slab **p = &aoi->slab;
+	for (obj=aoi->free_objects; obj != NULL; obj=obj->next_free) {
+		obj->mode = -1;
+	}
+	aoi->free_objects = NULL;
+	while (*p != NULL) {
+		aoi_slab *slab = *p;
+		int number = 0;
+		for (i=0; i<SLAB_OBJECT; i++) {
+			if (slab->obj[i].mode < 0) {
+				number++;
+			}
+		}
+		if (number == SLAB_OBJECT) {
+			*p = slab->next;
+			aoi->alloc(aoi->alloc_ud,slab,sizeof(aoi_slab));
+			continue;
+		}
+		for (i=SLAB_OBJECT-1; i>=0; i--) {
+			if (slab->obj[i].mode < 0) {
+				object_free(aoi,&slab->obj[i]);
+			}
+		}
+		p = &slab->next;
+	}
+}
+
+static aoi_object *
+new_object(aoi_space *aoi,uint32_t id) {
+	aoi_object *obj = object_alloc(aoi);
+	memset(obj,0,sizeof(*obj));
+	obj->id = id;
+	obj->batch_index = -1;
+	obj->pending_index = -1;
+	// slots are reused,so indexes stay dense
+	if (aoi->free_number > 0) {
+		obj->index = aoi->free_slot[--aoi->free_number];
+	} else {
+		if (aoi->slot_number >= aoi->cap) {
+			slot_resize(aoi,aoi->cap == 0 ? PRE_ALLOC : aoi->cap * 2);
+		}
+		obj->index = aoi->slot_number++;
+	}
+	aoi->slot[obj->index] = obj;
+	return obj;
+}
+
+static void
+delete_object(void *ud,aoi_object *obj) {
+	aoi_space *aoi = ud;
+	aoi->slot[obj->index] = NULL;
+	aoi->free_slot[aoi->free_number++] = obj->index;
+	if (obj->linger != NULL) {
+		aoi->alloc(aoi->alloc_ud,obj->linger,obj->linger_cap * sizeof(uint32_t));
+	}
+	object_free(aoi,obj);
+}
+
+static aoi_object * map_get(aoi_map *m,uint32_t id);
+
+static aoi_object *
+get_object(aoi_space *aoi,uint32_t id) {
+	return map_get(aoi->objects,id);
+}
+
+static inline uint32_t
+map_hash(uint32_t id) {
+	uint32_t h = id * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static void
+map_resize(aoi_space *aoi,aoi_map *m,int size) {
+	aoi_map_slot *old_slot = m->slot;
+	int old_size = m->size;
+	int i;
+	m->size = size;
+	m->slot = aoi->alloc(aoi->alloc_ud,NULL,m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	for (i=0; i<old_size; i++) {
+		aoi_map_slot *s = &old_slot[i];
+		if (s->obj != NULL) {
+			int mask = m->size - 1;
+			int j = map_hash(s->id) & mask;
+			while (m->slot[j].obj != NULL) {
+				j = (j+1) & mask;
+			}
+			m->slot[j] = *s;
+		}
+	}
+	aoi->alloc(aoi->alloc_ud,old_slot,old_size * sizeof(aoi_map_slot));
+}
+
+static void
+page_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	assert(m->max_id == 0 || id < m->max_id);
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number) {
+		int number = m->page_number;
+		while (k >= number) {
+			number *= 2;
+		}
+		aoi_map_page **page = aoi->alloc(aoi->alloc_ud,NULL,number * sizeof(aoi_map_page*));
+		memset(page,0,number * sizeof(aoi_map_page*));
+		memcpy(page,m->page,m->page_number * sizeof(aoi_map_page*));
+		aoi->alloc(aoi->alloc_ud,m->page,m->page_number * sizeof(aoi_map_page*));
+		m->page = page;
+		m->page_number = number;
+	}
+	aoi_map_page *page = m->page[k];
+	if (page == NULL) {
+		page = aoi->alloc(aoi->alloc_ud,NULL,sizeof(aoi_map_page));
+		memset(page,0,sizeof(aoi_map_page));
+		m->page[k] = page;
+	}
+	page->obj[id % MAP_PAGE] = obj;
+	page->number++;
+	m->number++;
+}
+
+static inline aoi_object *
+page_get(aoi_map *m,uint32_t id) {
+	uint32_t k = id / MAP_PAGE;
+	if (k >= m->page_number || m->page[k] == NULL) {
+		return NULL;
+	}
+	return m->page[k]->obj[id % MAP_PAGE];
+}
+
+// empty pages are freed
+static aoi_object *
+page_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	aoi_object *obj = page_get(m,id);
+	if (obj == NULL) {
+		return NULL;
+	}
+	aoi_map_page *page = m->page[id / MAP_PAGE];
+	page->obj[id % MAP_PAGE] = NULL;
+	m->number--;
+	if (--page->number == 0) {
+		aoi->alloc(aoi->alloc_ud,page,sizeof(aoi_map_page));
+		m->page[id / MAP_PAGE] = NULL;
+	}
+	return obj;
+}
+
+// switch an empty map to pages indexed by id
+static void
+map_set_dense(aoi_space *aoi,aoi_map *m,uint32_t max_id) {
+	assert(m->number == 0 && m->page == NULL);
+	aoi->alloc(aoi->alloc_ud,m->slot,m->size * sizeof(aoi_map_slot));
+	m->slot = NULL;
+	m->size = 0;
+	m->max_id = max_id;
+	m->page_number = max_id > 0 ? max_id / MAP_PAGE + (max_id % MAP_PAGE != 0) : PRE_ALLOC;
+	m->page = aoi->alloc(aoi->alloc_ud,NULL,m->page_number * sizeof(aoi_map_page*));
+	memset(m->page,0,m->page_number * sizeof(aoi_map_page*));
+}
+
+// id is not in the map
+static void
+map_insert(aoi_space *aoi,aoi_map *m,uint32_t id,aoi_object *obj) {
+	if (m->page != NULL) {
+		page_insert(aoi,m,id,obj);
+		return;
+	}
+	// keep load factor <= 1/2
+	if ((m->number+1)*2 > m->size) {
+		map_resize(aoi,m,m->size*2);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].obj != NULL) {
+		i = (i+1) & mask;
+	}
+	m->slot[i].id = id;
+	m->slot[i].obj = obj;
+	m->number++;
+}
+
+// ids live in slots,so a probe never touches objects
+static aoi_object *
+map_get(aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_get(m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	for (;;) {
+		aoi_map_slot *s = &m->slot[i];
+		if (s->obj == NULL || s->id == id) {
+			return s->obj;
+		}
+		i = (i+1) & mask;
+	}
+}
+
+static void
+map_foreach(aoi_map * m , void (*func)(void *ud, aoi_object *obj), void *ud) {
+	int i,j;
+	for (i=0; i<m->page_number; i++) {
+		aoi_map_page *page = m->page[i];
+		for (j=0; page != NULL && j<MAP_PAGE; j++) {
+			if (page->obj[j]) {
+				func(ud, page->obj[j]);
+			}
+		}
+	}
+	for (i=0;i<m->size;i++) {
+		if (m->slot[i].obj) {
+			func(ud, m->slot[i].obj);
+		}
+	}
+}
+
+static aoi_object *
+map_remove(aoi_space *aoi,aoi_map *m,uint32_t id) {
+	if (m->page != NULL) {
+		return page_remove(aoi,m,id);
+	}
+	int mask = m->size - 1;
+	int i = map_hash(id) & mask;
+	while (m->slot[i].id != id || m->slot[i].obj == NULL) {
+		if (m->slot[i].obj == NULL) {
+			return NULL;
+		}
+		i = (i+1) & mask;
+	}
+	aoi_object *obj = m->slot[i].obj;
+	// backward shift deletion,so no tombstone is needed
+	int j = i;
+	for (;;) {
+		j = (j+1) & mask;
+		aoi_map_slot *temp = &m->slot[j];
+		if (temp->obj == NULL) {
+			break;
+		}
+		int k = map_hash(temp->id) & mask;
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		m->slot[i] = *temp;
+		i = j;
+	}
+	m->slot[i].obj = NULL;
+	m->number--;
+	if (m->size > PRE_ALLOC && m->number*8 < m->size) {
+		map_resize(aoi,m,m->size/2);
+	}
+	return obj;
+}
+
+static void
+map_delete(aoi_space *aoi, aoi_map * m) {
+	int i;
+	for (i=0; i<m->page_number; i++) {
+		if (m->page[i] != NULL) {
+			aoi->alloc(aoi->alloc_ud, m->page[i], sizeof(aoi_map_page));
+		}
+	}
+	if (m->page != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->page, m->page_number * sizeof(aoi_map_page*));
+	}
+	if (m->slot != NULL) {
+		aoi->alloc(aoi->alloc_ud, m->slot, m->size * sizeof(aoi_map_slot));
+	}
+	aoi->alloc(aoi->alloc_ud, m , sizeof(*m));
+}
+
+static aoi_map *
+map_new(aoi_space *aoi) {
+	aoi_map * m = aoi->alloc(aoi->alloc_ud, NULL, sizeof(*m));
+	m->size = PRE_ALLOC;
+	m->number = 0;
+	m->slot = aoi->alloc(aoi->alloc_ud, NULL, m->size * sizeof(aoi_map_slot));
+	memset(m->slot,0,m->size * sizeof(aoi_map_slot));
+	m->page = NULL;
+	m->page_number = 0;
+	m->max_id = 0;
+	return m;
+}
+
+static void
+map_stats(aoi_map *m,aoi_memory *stats) {
+	int i;
+	stats->map_number = m->number;
+	stats->map_cap = m->size;
+	stats->map_bytes = sizeof(*m) + m->size * sizeof(aoi_map_slot);
+	if (m->page != NULL) {
+		stats->map_bytes += m->page_number * sizeof(aoi_map_page*);
+		for (i=0; i<m->page_number; i++) {
+			if (m->page[i] != NULL) {
+				stats->map_cap += MAP_PAGE;
+				stats->map_bytes += sizeof(aoi_map_page);
+			}
+		}
+	}
+}
+
+static aoi_set *
+set_new(aoi_space *aoi) {
+	aoi_set *set = aoi->alloc(aoi->alloc_ud,NULL,sizeof(*set));
+	set->cap = PRE_ALLOC;
+	set->number = 0;
+	set->slot = aoi->alloc(aoi->alloc_ud,NULL,set->cap * sizeof(void*));
+	return set;
+}
+
+static void
+set_delete(aoi_space *aoi,aoi_set *set) {
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set,sizeof(*set));
+}
+
+static inline size_t
+set_bytes(aoi_set *set) {
+	return sizeof(*set) + set->cap * sizeof(void*);
+}
+
+static void
+set_stats(aoi_set *set,aoi_memory *stats) {
+	stats->set_used += set->number;
+	stats->set_cap += set->cap;
+	stats->set_bytes += set_bytes(set);
+}
+
+// halve while at most a quarter is used,so at least twice the number is left
+static inline int
+shrink_cap(int number,int cap) {
+	while (cap > PRE_ALLOC && number * 4 <= cap) {
+		cap /= 2;
+	}
+	return cap;
+}
+
+static void
+set_shrink(aoi_space *aoi,aoi_set *set) {
+	int cap = shrink_cap(set->number,set->cap);
+	if (cap == set->cap) {
+		return;
+	}
+	void **slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+	memcpy(slot,set->slot,set->number*sizeof(void*));
+	aoi->alloc(aoi->alloc_ud,set->slot,set->cap*sizeof(void*));
+	set->slot = slot;
+	set->cap = cap;
+}
+
+// slots above the last used one are dropped,entries keep their order
+static void
+slot_compact(aoi_space *aoi) {
+	int i;
+	int number = aoi->slot_number;
+	while (number > 0 && aoi->slot[number-1] == NULL) {
+		number--;
+	}
+	aoi->slot_number = number;
+	aoi->free_number = 0;
+	// low slots are reused first
+	for (i=number-1; i>=0; i--) {
+		if (aoi->slot[i] == NULL) {
+			aoi->free_slot[aoi->free_number++] = i;
+		}
+	}
+	int cap = shrink_cap(number,aoi->cap);
+	if (cap != aoi->cap) {
+		slot_resize(aoi,cap);
+	}
+}
+
+/*
+static bool
+set_find(aoi_set *set,void *elem) {
+	int i;
+	for (i=0; i<set->number; i++) {
+		if (set->slot[i] == elem) {
+			break;
+		}
+	}
+	return i != set->number;
+}
+*/
+
+static void
+set_add(aoi_space *aoi,aoi_set *set,void *elem) {
+	// no need to check the same,because all element is difference!
+	// bool found = set_find(set,elem);
+	bool found = false;
+	if (!found) {
+		if (set->number >= set->cap) {
+			int cap = set->cap * 2;
+			void *tmp = set->slot;
+			set->slot = aoi->alloc(aoi->alloc_ud,NULL,cap*sizeof(void*));
+			memcpy(set->slot,tmp,set->cap*sizeof(void*));
+			aoi->alloc(aoi->alloc_ud,tmp,set->cap*sizeof(void*));
+			set->cap = cap;
+		}
+		set->slot[set->number++] = elem;
+	}
+}
+
+static inline void
+result_add(aoi_result *result,uint32_t id) {
+	if (id == result->skip) {
+		return;
+	}
+	if (result->number < result->cap) {
+		result->ids[result->number] = id;
+	}
+	result->number++;
+}
+
+// a window scan writes objects to set,or their ids to result when set is NULL
+static inline void
+window_add(aoi_space *aoi,aoi_set *set,aoi_result *result,aoi_object *obj) {
+	if (set != NULL) {
+		set_add(aoi,set,obj);
+	} else {
+		result_add(result,obj->id);
+	}
+}
+
+/*
+static void*
+set_remove(aoi_space *aoi,aoi_set *set,void *elem) {
+	int i;
+	for (i=0; i<set->number; i++) {
+		if (set->slot[i] == elem) {
+			int nelem = set->number - i - 1;
+			memcpy(set->slot+i,set->slot+i+1,nelem * sizeof(void*));
+			set->number--;
+			return elem;
+		}
+	}
+	return NULL;
+}
+*/
+
+inline static void 
+copy_position(float des[3], const float src[3]) {
+	des[0] = src[0];
+	des[1] = src[1];
+	des[2] = src[2];
+}
+
+
+// entry k of axis i is ordered before position v of slot index
+static inline bool
+entry_before(aoi_axis *axis,int i,int k,float v,uint32_t index) {
+	float pos = axis->pos[i][k];
+	return pos < v || (pos == v && axis->index[k] < index);
+}
+
+// first entry of axis i within [lo,hi) not ordered before position v of slot index(hi if none)
+static int
+entry_search(aoi_axis *axis,int i,int lo,int hi,float v,uint32_t index) {
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (entry_before(axis,i,mid,v,index)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// index 0 gives the first entry >= v,INVALID_ID the first entry > v
+static inline int
+axis_search(aoi_space *aoi,int i,float v,uint32_t index) {
+	return entry_search(&aoi->axis[i],i,0,aoi->entry_number,v,index);
+}
+
+static inline void
+entry_set(aoi_axis *axis,int k,const float pos[3],uint32_t index) {
+	axis->pos[0][k] = pos[0];
+	axis->pos[1][k] = pos[1];
+	axis->pos[2][k] = pos[2];
+	axis->index[k] = index;
+}
+
+// move n entries from `from` to `to`
+static void
+entry_shift(aoi_axis *axis,int to,int from,int n) {
+	int j;
+	for (j=0; j<3; j++) {
+		memmove(axis->pos[j]+to,axis->pos[j]+from,n * sizeof(float));
+	}
+	memmove(axis->index+to,axis->index+from,n * sizeof(uint32_t));
+}
+
+static void
+entry_insert(aoi_space *aoi,aoi_object *obj) {
+	int i;
+	for (i=0; i<3; i++) {
+		aoi_axis *axis = &aoi->axis[i];
+		int k = axis_search(aoi,i,obj->pos[i],obj->index);
+		entry_shift(axis,k+1,k,aoi->entry_number-k);
+		entry_set(axis,k,obj->pos,obj->index);
+	}
+	aoi->entry_number++;
+}
+
+static void
+entry_remove(aoi_space *aoi,aoi_object *obj) {
+	int i;
+	for (i=0; i<3; i++) {
+		aoi_axis *axis = &aoi->axis[i];
+		int k = axis_search(aoi,i,obj->pos[i],obj->index);
+		assert(k < aoi->entry_number && axis->index[k] == obj->index);
+		entry_shift(axis,k,k+1,aoi->entry_number-k-1);
+	}
+	aoi->entry_number--;
+}
+
+// entry k of axis i is out of order while others are sorted,sift it into place
+// as one step of insertion sort. the place is found by galloping from k,so short
+// moves cost few compares,and entries passed are shifted at once
+static void
+axis_sift(aoi_space *aoi,int i,int k) {
+	aoi_axis *axis = &aoi->axis[i];
+	float pos[3];
+	uint32_t index = axis->index[k];
+	int lo,hi,j;
+	int step = 1;
+	pos[0] = axis->pos[0][k];
+	pos[1] = axis->pos[1][k];
+	pos[2] = axis->pos[2][k];
+	if (k > 0 && !entry_before(axis,i,k-1,pos[i],index)) {
+		// entries of [hi,k) are after the entry
+		hi = k - 1;
+		for (;;) {
+			lo = hi - step;
+			if (lo < 0) {
+				lo = -1;
+				break;
+			}
+			if (entry_before(axis,i,lo,pos[i],index)) {
+				break;
+			}
+			hi = lo;
+			step *= 2;
+		}
+		j = entry_search(axis,i,lo+1,hi,pos[i],index);
+		entry_shift(axis,j+1,j,k-j);
+	} else if (k+1 < aoi->entry_number && entry_before(axis,i,k+1,pos[i],index)) {
+		// entries of (k,lo] are before the entry
+		lo = k + 1;
+		for (;;) {
+			hi = lo + step;
+			if (hi >= aoi->entry_number) {
+				hi = aoi->entry_number;
+				break;
+			}
+			if (!entry_before(axis,i,hi,pos[i],index)) {
+				break;
+			}
+			lo = hi;
+			step *= 2;
+		}
+		j = entry_search(axis,i,lo+1,hi,pos[i],index) - 1;
+		entry_shift(axis,k,k+1,j-k);
+	} else {
+		return;
+	}
+	entry_set(axis,j,pos,index);
+}
+
+// pos2 is in the view of pos1
+static inline bool
+in_view(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		if (pos2[i] < pos1[i] - view_size[i] || pos2[i] > pos1[i] + view_size[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// view window around pos,widened by rounding error of in_view so that
+// it also holds everything whose view of the same size holds pos
+static inline void
+view_window(const float pos[3],const float view_size[3],float lo[3],float hi[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		float slack = 2 * (fabsf(pos[i]) + 2 * view_size[i]) * FLT_EPSILON;
+		lo[i] = pos[i] - view_size[i] - slack;
+		hi[i] = pos[i] + view_size[i] + slack;
+	}
+}
+
+// objects within [lo,hi] and not strictly within [in_lo,in_hi] on all axes(in_lo NULL for none),
+// found by a linear scan of the entries within [lo,hi] on the axis holding fewest of them
+static inline void
+scan_window(aoi_space *aoi,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *set,aoi_result *result) {
+	static const float none_lo[3] = {FLT_MAX,FLT_MAX,FLT_MAX};
+	static const float none_hi[3] = {-FLT_MAX,-FLT_MAX,-FLT_MAX};
+	int i,k;
+	int best = 0;
+	int start = 0;
+	int end = 0;
+	if (in_lo == NULL) {
+		in_lo = none_lo;
+		in_hi = none_hi;
+	}
+	for (i=0; i<3; i++) {
+		int s = axis_search(aoi,i,lo[i],0);
+		int e = axis_search(aoi,i,hi[i],INVALID_ID);
+		if (i == 0 || e - s < end - start) {
+			best = i;
+			start = s;
+			end = e;
+		}
+	}
+	aoi_axis *axis = &aoi->axis[best];
+	int i1 = (best + 1) % 3;
+	int i2 = (best + 2) % 3;
+	const float *pos0 = axis->pos[best];
+	const float *pos1 = axis->pos[i1];
+	const float *pos2 = axis->pos[i2];
+	k = start;
+#if defined(__SSE__)
+	// 4 entries a time,bits of mask are entries to add
+	__m128 lo1 = _mm_set1_ps(lo[i1]);
+	__m128 hi1 = _mm_set1_ps(hi[i1]);
+	__m128 lo2 = _mm_set1_ps(lo[i2]);
+	__m128 hi2 = _mm_set1_ps(hi[i2]);
+	__m128 in_lo0 = _mm_set1_ps(in_lo[best]);
+	__m128 in_hi0 = _mm_set1_ps(in_hi[best]);
+	__m128 in_lo1 = _mm_set1_ps(in_lo[i1]);
+	__m128 in_hi1 = _mm_set1_ps(in_hi[i1]);
+	__m128 in_lo2 = _mm_set1_ps(in_lo[i2]);
+	__m128 in_hi2 = _mm_set1_ps(in_hi[i2]);
+	for (; k+4 <= end; k+=4) {
+		__m128 v0 = _mm_loadu_ps(pos0+k);
+		__m128 v1 = _mm_loadu_ps(pos1+k);
+		__m128 v2 = _mm_loadu_ps(pos2+k);
+		__m128 out = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(v1,lo1),_mm_cmple_ps(v1,hi1)),
+			_mm_and_ps(_mm_cmpge_ps(v2,lo2),_mm_cmple_ps(v2,hi2)));
+		__m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(v0,in_lo0),_mm_cmplt_ps(v0,in_hi0)),
+			_mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(v1,in_lo1),_mm_cmplt_ps(v1,in_hi1)),
+				_mm_and_ps(_mm_cmpgt_ps(v2,in_lo2),_mm_cmplt_ps(v2,in_hi2))));
+		int mask = _mm_movemask_ps(_mm_andnot_ps(in,out));
+		while (mask != 0) {
+			window_add(aoi,set,result,aoi->slot[axis->index[k+__builtin_ctz(mask)]]);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; k<end; k++) {
+		if (pos1[k] < lo[i1] || pos1[k] > hi[i1] || pos2[k] < lo[i2] || pos2[k] > hi[i2]) {
+			continue;
+		}
+		if (pos0[k] > in_lo[best] && pos0[k] < in_hi[best] && pos1[k] > in_lo[i1] && pos1[k] < in_hi[i1]
+			&& pos2[k] > in_lo[i2] && pos2[k] < in_hi[i2]) {
+			continue;
+		}
+		window_add(aoi,set,result,aoi->slot[axis->index[k]]);
+	}
+}
+
+static void
+get_window(aoi_space *aoi,const float lo[3],const float hi[3],const float *in_lo,const float *in_hi,aoi_set *result) {
+	result->number = 0;
+	scan_window(aoi,lo,hi,in_lo,in_hi,result,NULL);
+}
+
+static void
+get_view(aoi_space *aoi,const float pos[3],const float view_size[3],aoi_set *result) {
+	float lo[3],hi[3];
+	view_window(pos,view_size,lo,hi);
+	get_window(aoi,lo,hi,NULL,NULL,result);
+}
+
+static void
+event_grow(aoi_space *aoi) {
+	int cap = aoi->event_cap == 0 ? PRE_ALLOC : aoi->event_cap * 2;
+	aoi_event *events = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(aoi_event));
+	if (aoi->events != NULL) {
+		memcpy(events,aoi->events,aoi->event_number * sizeof(aoi_event));
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	aoi->events = events;
+	aoi->event_cap = cap;
+}
+
+static inline void
+event_push(aoi_space *aoi,uint32_t watcher,uint32_t marker,uint32_t type) {
+	if (aoi->event_number >= aoi->event_cap) {
+		event_grow(aoi);
+	}
+	aoi_event *ev = &aoi->events[aoi->event_number++];
+	ev->watcher = watcher;
+	ev->marker = marker;
+	ev->type = type;
+}
+
+static inline void
+emit_enter(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_ENTER);
+	} else {
+		aoi->cb_enterAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+static inline void
+emit_leave(aoi_space *aoi,uint32_t watcher,uint32_t marker) {
+	if (aoi->buffered) {
+		event_push(aoi,watcher,marker,AOI_EVENT_LEAVE);
+	} else {
+		aoi->cb_leaveAOI(aoi->cb_ud,watcher,marker);
+	}
+}
+
+// each side only sees the other one within its own view
+static void
+enterAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	if ((watcher->mode & MODE_WATCHER) && in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_enter(aoi,watcher->id,marker->id);
+	}
+	if ((marker->mode & MODE_WATCHER) && in_view(aoi,marker->pos,watcher->pos,marker->view_size)) {
+		emit_enter(aoi,marker->id,watcher->id);
+	}
+}
+
+static int
+linger_find(aoi_object *watcher,uint32_t id) {
+	int i;
+	for (i=0; i<watcher->linger_number; i++) {
+		if (watcher->linger[i] == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void
+linger_add(aoi_space *aoi,aoi_object *watcher,uint32_t id) {
+	if (watcher->linger_number >= watcher->linger_cap) {
+		int cap = watcher->linger_cap == 0 ? 4 : watcher->linger_cap * 2;
+		uint32_t *linger = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+		if (watcher->linger != NULL) {
+			memcpy(linger,watcher->linger,watcher->linger_number * sizeof(uint32_t));
+			aoi->alloc(aoi->alloc_ud,watcher->linger,watcher->linger_cap * sizeof(uint32_t));
+		}
+		watcher->linger = linger;
+		watcher->linger_cap = cap;
+	}
+	watcher->linger[watcher->linger_number++] = id;
+}
+
+static inline void
+linger_remove(aoi_object *watcher,int index) {
+	watcher->linger[index] = watcher->linger[--watcher->linger_number];
+}
+
+static void
+linger_stats(void *ud,aoi_object *obj) {
+	aoi_memory *stats = ud;
+	stats->object_bytes += obj->linger_cap * sizeof(uint32_t);
+}
+
+// pos2 is within hysteresis beyond the view of pos1
+static inline bool
+in_margin(aoi_space *aoi,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	int i;
+	float margin[3];
+	for (i=0; i<3; i++) {
+		margin[i] = view_size[i] + aoi->hysteresis;
+	}
+	return in_view(aoi,pos1,pos2,margin);
+}
+
+// window holding every object whose seen state may change
+static inline void
+margin_window(aoi_space *aoi,const float view_size[3],float window[3]) {
+	int i;
+	for (i=0; i<3; i++) {
+		window[i] = view_size[i] + aoi->hysteresis;
+	}
+}
+
+// one of them leaves the space,a lingering marker is released too
+static void
+leave_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (!(watcher->mode & MODE_WATCHER)) {
+		return;
+	}
+	int index = linger_find(watcher,marker->id);
+	if (index >= 0) {
+		linger_remove(watcher,index);
+		emit_leave(aoi,watcher->id,marker->id);
+	} else if (in_view(aoi,watcher->pos,marker->pos,watcher->view_size)) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+static void
+leaveAOI(aoi_space *aoi,aoi_object *watcher,aoi_object *marker) {
+	if (watcher->id == marker->id) {
+		return;
+	}
+	leave_notify(aoi,watcher,marker);
+	leave_notify(aoi,marker,watcher);
+}
+
+// marker at pos2 was within the view of watcher at pos1,or is still seen beyond it
+static inline bool
+view_seen(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,const float pos1[3],const float pos2[3],const float view_size[3]) {
+	return in_view(aoi,pos1,pos2,view_size) || linger_find(watcher,marker->id) >= 0;
+}
+
+// before tells if watcher saw marker,the view is checked again from pos1 to pos2.
+// a seen marker out of the view is kept until it passes the hysteresis
+static void
+view_notify(aoi_space *aoi,aoi_object *watcher,aoi_object *marker,bool before,const float pos1[3],const float pos2[3]) {
+	bool after = in_view(aoi,pos1,pos2,watcher->view_size);
+	if (before && aoi->hysteresis > 0) {
+		int index = linger_find(watcher,marker->id);
+		if (!after && in_margin(aoi,pos1,pos2,watcher->view_size)) {
+			after = true;
+			if (index < 0) {
+				linger_add(aoi,watcher,marker->id);
+			}
+		} else if (index >= 0) {
+			linger_remove(watcher,index);
+		}
+	}
+	if (!before && after) {
+		emit_enter(aoi,watcher->id,marker->id);
+	} else if (before && !after) {
+		emit_leave(aoi,watcher->id,marker->id);
+	}
+}
+
+// check both directions between other and obj moved by m,
+// which tells pairs checked when the old and new windows are scanned apart
+static void
+pair_move(aoi_space *aoi,aoi_batch_move *m,aoi_object *other,int which) {
+	aoi_object *obj = m->obj;
+	if (obj == other) {
+		return;
+	}
+	// a seen pair may be hysteresis beyond the view,the phases split pairs by
+	// positions only since view_notify changes lingering markers
+	bool near1 = (obj->mode & MODE_WATCHER) && in_margin(aoi,m->old_pos,other->pos,obj->view_size);
+	bool near2 = (other->mode & MODE_WATCHER) && in_margin(aoi,other->pos,m->old_pos,other->view_size);
+	if ((which == PAIR_BEFORE && !near1 && !near2) || (which == PAIR_AFTER && (near1 || near2))) {
+		return;
+	}
+	if (obj->mode & MODE_WATCHER) {
+		view_notify(aoi,obj,other,near1 && view_seen(aoi,obj,other,m->old_pos,other->pos,obj->view_size),m->pos,other->pos);
+	}
+	if (other->mode & MODE_WATCHER) {
+		view_notify(aoi,other,obj,near2 && view_seen(aoi,other,obj,other->pos,m->old_pos,other->view_size),other->pos,m->pos);
+	}
+}
+
+aoi_space *
+aoi_create(aoi_Alloc alloc,void *alloc_ud,float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	int i;
+	aoi_space *aoi = alloc(alloc_ud,NULL,sizeof(*aoi));
+	aoi->alloc = alloc;
+	aoi->alloc_ud = alloc_ud;
+	aoi->slab = NULL;
+	aoi->free_objects = NULL;
+	memcpy(aoi->map_size,map_size,3*sizeof(float));
+	memcpy(aoi->view_size,view_size,3*sizeof(float));
+	memcpy(aoi->max_view,view_size,3*sizeof(float));
+	aoi->custom_view_number = 0;
+	aoi->hysteresis = 0;
+	aoi->objects = map_new(aoi);
+	aoi->slot = NULL;
+	aoi->free_slot = NULL;
+	aoi->free_number = 0;
+	aoi->slot_number = 0;
+	aoi->cap = 0;
+	for (i=0; i<3; i++) {
+		memset(&aoi->axis[i],0,sizeof(aoi_axis));
+	}
+	aoi->entry_number = 0;
+	aoi->set1 = set_new(aoi);
+	aoi->result_set = set_new(aoi);
+	aoi->batch = NULL;
+	aoi->batch_cap = 0;
+	aoi->cb_enterAOI = cb_enterAOI;
+	aoi->cb_leaveAOI = cb_leaveAOI;
+	aoi->cb_ud = cb_ud;
+	assert((cb_enterAOI == NULL) == (cb_leaveAOI == NULL));
+	aoi->events = NULL;
+	aoi->event_number = 0;
+	aoi->event_cap = 0;
+	aoi->buffered = cb_enterAOI == NULL;
+	aoi->defer = false;
+	aoi->pending_ids = NULL;
+	aoi->pending_pos = NULL;
+	aoi->pending_number = 0;
+	aoi->pending_cap = 0;
+	return aoi;
+}
+
+#if defined USE_IN_SKYNET
+	#define MALLOC(sz) skynet_malloc((sz))
+	#define FREE(ptr) skynet_free((ptr))
+#else
+	#define MALLOC(sz) malloc((sz))
+	#define FREE(ptr) free((ptr))
+#endif
+
+static void *
+default_alloc(void *ud,void *ptr,size_t sz) {
+	if (ptr == NULL) {
+		return MALLOC(sz);
+	}
+	FREE(ptr);
+	return NULL;
+}
+
+aoi_space *
+aoi_new(float map_size[3],float view_size[3],enterAOI_Callback cb_enterAOI,leaveAOI_Callback cb_leaveAOI,void *cb_ud) {
+	return aoi_create(default_alloc,NULL,map_size,view_size,cb_enterAOI,cb_leaveAOI,cb_ud);
+}
+
+void
+aoi_release(aoi_space *aoi) {
+	set_delete(aoi,aoi->set1);
+	set_delete(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+	map_foreach(aoi->objects,delete_object,aoi);
+	map_delete(aoi,aoi->objects);
+	slab_delete(aoi);
+	slot_free_all(aoi);
+	if (aoi->events != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+	}
+	if (aoi->pending_ids != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+	}
+	aoi->alloc(aoi->alloc_ud,aoi,sizeof(*aoi));
+}
+
+aoi_event *
+aoi_poll_events(aoi_space *aoi,int *number) {
+	*number = aoi->event_number;
+	aoi->event_number = 0;
+	return aoi->events;
+}
+
+static bool
+change_mode(aoi_object *obj,const char *modestring) {
+	int i;
+	bool change = false;
+	bool set_watcher = false;
+	bool set_marker = false;
+	for(i=0; modestring[i]; i++) {
+		switch(modestring[i]) {
+			case 'w':
+				set_watcher = true;
+				break;
+			case 'm':
+				set_marker = true;
+				break;
+			default:
+				break;
+		}
+	}
+	if (set_watcher) {
+		if (!(obj->mode & MODE_WATCHER)) {
+			obj->mode |= MODE_WATCHER;
+			change = true;
+		}
+	} else {
+		if (obj->mode & MODE_WATCHER) {
+			obj->mode &= ~MODE_WATCHER;
+			change = true;
+		}
+	}
+	if (set_marker) {
+		if (!(obj->mode & MODE_MARKER)) {
+			obj->mode |= MODE_MARKER;
+			change = true;
+		}
+	} else {
+		if (obj->mode & MODE_MARKER) {
+			obj->mode &= ~MODE_MARKER;
+			change = true;
+		}
+	}
+	return change;
+}
+
+
+static void
+custom_view_remove(aoi_space *aoi) {
+	aoi->custom_view_number--;
+	if (aoi->custom_view_number == 0) {
+		// max view only shrinks when all custom views are gone
+		copy_position(aoi->max_view,aoi->view_size);
+	}
+}
+
+void
+aoi_set_dense_id(aoi_space *aoi,uint32_t max_id) {
+	map_set_dense(aoi,aoi->objects,max_id);
+}
+
+void
+aoi_set_hysteresis(aoi_space *aoi,float margin) {
+	assert(margin >= 0);
+	aoi->hysteresis = margin;
+}
+
+
+void
+aoi_enter(aoi_space *aoi,uint32_t id,float pos[3],const char *modestring) {
+	if (aoi->objects->max_id != 0 && id >= aoi->objects->max_id) {
+		return;
+	}
+	aoi_object *old_obj = get_object(aoi,id);
+	if (old_obj != NULL) {
+		aoi_leave(aoi,id);
+	}
+	int i;
+	aoi_object *obj = new_object(aoi,id);
+	change_mode(obj,modestring);
+	copy_position(obj->pos,pos);
+	copy_position(obj->view_size,aoi->view_size);
+	map_insert(aoi,aoi->objects,obj->id,obj);
+	get_view(aoi,obj->pos,aoi->max_view,aoi->result_set);
+	entry_insert(aoi,obj);
+	for(i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		enterAOI(aoi,obj,temp);
+	}
+}
+
+static void
+pending_add(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	if (obj->pending_index < 0) {
+		if (aoi->pending_number >= aoi->pending_cap) {
+			int cap = aoi->pending_cap == 0 ? PRE_ALLOC : aoi->pending_cap * 2;
+			uint32_t *ids = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(uint32_t));
+			float (*pos)[3] = aoi->alloc(aoi->alloc_ud,NULL,cap * sizeof(float[3]));
+			if (aoi->pending_ids != NULL) {
+				memcpy(ids,aoi->pending_ids,aoi->pending_number * sizeof(uint32_t));
+				memcpy(pos,aoi->pending_pos,aoi->pending_number * sizeof(float[3]));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+				aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+			}
+			aoi->pending_ids = ids;
+			aoi->pending_pos = pos;
+			aoi->pending_cap = cap;
+		}
+		obj->pending_index = aoi->pending_number++;
+		aoi->pending_ids[obj->pending_index] = obj->id;
+	}
+	copy_position(aoi->pending_pos[obj->pending_index],pos);
+}
+
+static void
+pending_remove(aoi_space *aoi,aoi_object *obj) {
+	int index = obj->pending_index;
+	if (index < 0) {
+		return;
+	}
+	int last = --aoi->pending_number;
+	if (index != last) {
+		aoi->pending_ids[index] = aoi->pending_ids[last];
+		copy_position(aoi->pending_pos[index],aoi->pending_pos[last]);
+		get_object(aoi,aoi->pending_ids[index])->pending_index = index;
+	}
+	obj->pending_index = -1;
+}
+
+
+void
+aoi_leave(aoi_space *aoi,uint32_t id) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	pending_remove(aoi,obj);
+	int i;
+	float window[3];
+	entry_remove(aoi,obj);
+	margin_window(aoi,aoi->max_view,window);
+	get_view(aoi,obj->pos,window,aoi->result_set);
+	for(i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		leaveAOI(aoi,obj,temp);
+	}
+	if (obj->custom_view) {
+		custom_view_remove(aoi);
+	}
+	map_remove(aoi,aoi->objects,id);
+	delete_object(aoi,obj);
+}
+
+static void
+batch_reserve(aoi_space *aoi,int n) {
+	if (n > aoi->batch_cap) {
+		if (aoi->batch != NULL) {
+			aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		}
+		aoi->batch_cap = n;
+		aoi->batch = aoi->alloc(aoi->alloc_ud,NULL,aoi->batch_cap * sizeof(aoi_batch_move));
+	}
+}
+
+static inline bool
+move_changed(aoi_space *aoi,aoi_object *obj,const float pos[3]) {
+	return memcmp(obj->pos,pos,3*sizeof(float)) != 0;
+}
+
+// write the new position into the entries of each axis,one step of insertion sort
+static void
+entry_move(aoi_space *aoi,aoi_batch_move *m) {
+	int i;
+	for (i=0; i<3; i++) {
+		int k = axis_search(aoi,i,m->old_pos[i],m->obj->index);
+		entry_set(&aoi->axis[i],k,m->pos,m->obj->index);
+		axis_sift(aoi,i,k);
+	}
+	copy_position(m->obj->pos,m->pos);
+}
+
+// old and new windows are apart: a view changes only between obj and objects
+// in one of them. a seen pair may be hysteresis beyond the view before
+static void
+move_apart(aoi_space *aoi,aoi_batch_move *m) {
+	int i;
+	float window[3];
+	aoi_set *set = aoi->set1;
+	margin_window(aoi,aoi->max_view,window);
+	get_view(aoi,m->old_pos,window,set);
+	for (i=0; i<set->number; i++) {
+		pair_move(aoi,m,set->slot[i],PAIR_BEFORE);
+	}
+	entry_move(aoi,m);
+	get_view(aoi,m->pos,aoi->max_view,set);
+	for (i=0; i<set->number; i++) {
+		pair_move(aoi,m,set->slot[i],PAIR_AFTER);
+	}
+}
+
+// others stay during a single move,so one scan over the hull of old and new
+// windows finds every pair when they overlap
+static void
+move_object(aoi_space *aoi,aoi_batch_move *m) {
+	int i;
+	float window[3];
+	float lo1[3],hi1[3],lo2[3],hi2[3];
+	float in_lo[3],in_hi[3];
+	aoi_set *set = aoi->set1;
+	margin_window(aoi,aoi->max_view,window);
+	view_window(m->old_pos,window,lo1,hi1);
+	view_window(m->pos,window,lo2,hi2);
+	for (i=0; i<3; i++) {
+		if (lo2[i] > hi1[i] || hi2[i] < lo1[i]) {
+			move_apart(aoi,m);
+			return;
+		}
+		lo1[i] = fmin(lo1[i],lo2[i]);
+		hi1[i] = fmax(hi1[i],hi2[i]);
+		// with one view size,pairs deep inside both windows see each other before and after
+		float slack = 2 * (fabsf(m->old_pos[i]) + fabsf(m->pos[i]) + 2 * aoi->view_size[i]) * FLT_EPSILON;
+		in_lo[i] = fmax(m->old_pos[i],m->pos[i]) - aoi->view_size[i] + slack;
+		in_hi[i] = fmin(m->old_pos[i],m->pos[i]) + aoi->view_size[i] - slack;
+	}
+	if (aoi->custom_view_number == 0) {
+		get_window(aoi,lo1,hi1,in_lo,in_hi,set);
+	} else {
+		get_window(aoi,lo1,hi1,NULL,NULL,set);
+	}
+	entry_move(aoi,m);
+	for (i=0; i<set->number; i++) {
+		pair_move(aoi,m,set->slot[i],PAIR_ALL);
+	}
+}
+
+void
+aoi_move(aoi_space *aoi,uint32_t id,float pos[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	if (aoi->defer) {
+		pending_add(aoi,obj,pos);
+		return;
+	}
+	if (!move_changed(aoi,obj,pos)) {
+		return;
+	}
+	aoi_batch_move m;
+	m.obj = obj;
+	copy_position(m.old_pos,obj->pos);
+	copy_position(m.pos,pos);
+	move_object(aoi,&m);
+}
+
+void
+aoi_move_batch(aoi_space *aoi,const uint32_t *ids,const float (*pos)[3],int n) {
+	int i;
+	int number = 0;
+	if (n <= 0) {
+		return;
+	}
+	if (aoi->defer) {
+		for (i=0; i<n; i++) {
+			aoi_object *obj = get_object(aoi,ids[i]);
+			if (obj != NULL) {
+				pending_add(aoi,obj,pos[i]);
+			}
+		}
+		return;
+	}
+	batch_reserve(aoi,n);
+	// the last position of an object wins
+	for (i=0; i<n; i++) {
+		aoi_object *obj = get_object(aoi,ids[i]);
+		if (obj == NULL) {
+			continue;
+		}
+		aoi_batch_move *m;
+		if (obj->batch_index >= 0) {
+			m = &aoi->batch[obj->batch_index];
+		} else {
+			obj->batch_index = number;
+			m = &aoi->batch[number++];
+			m->obj = obj;
+			copy_position(m->old_pos,obj->pos);
+		}
+		copy_position(m->pos,pos[i]);
+	}
+	// drop moves changing nothing
+	n = number;
+	number = 0;
+	for (i=0; i<n; i++) {
+		aoi_batch_move *m = &aoi->batch[i];
+		m->obj->batch_index = -1;
+		if (!move_changed(aoi,m->obj,m->pos)) {
+			continue;
+		}
+		aoi->batch[number++] = *m;
+	}
+	// moves are applied one by one in order,so events are the same as aoi_move
+	for (i=0; i<number; i++) {
+		move_object(aoi,&aoi->batch[i]);
+	}
+}
+
+// while coalescing,type holds the production index above the enter bit
+static int
+event_compare(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->watcher != ev2->watcher) {
+		return ev1->watcher < ev2->watcher ? -1 : 1;
+	}
+	if (ev1->marker != ev2->marker) {
+		return ev1->marker < ev2->marker ? -1 : 1;
+	}
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+static int
+event_order(const void *a,const void *b) {
+	const aoi_event *ev1 = a;
+	const aoi_event *ev2 = b;
+	if (ev1->type != ev2->type) {
+		return ev1->type < ev2->type ? -1 : 1;
+	}
+	return 0;
+}
+
+// events of a pair alternate,so only the last one of each pair with a net change is kept,
+// the kept events are put back in production order
+static void
+event_coalesce(aoi_space *aoi,int start) {
+	int i,j;
+	int n = 0;
+	aoi_event *events = aoi->events + start;
+	int number = aoi->event_number - start;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		events[i].type = (uint32_t)i << 1 | (events[i].type == AOI_EVENT_ENTER);
+	}
+	qsort(events,number,sizeof(aoi_event),event_compare);
+	for (i=0; i<number; i=j) {
+		int net = 0;
+		for (j=i; j<number && events[j].watcher == events[i].watcher && events[j].marker == events[i].marker; j++) {
+			net += (events[j].type & 1) ? 1 : -1;
+		}
+		assert(net >= -1 && net <= 1);
+		if (net != 0) {
+			assert((events[j-1].type & 1) == (net > 0));
+			events[n++] = events[j-1];
+		}
+	}
+	if (n > 0) {
+		qsort(events,n,sizeof(aoi_event),event_order);
+	}
+	for (i=0; i<n; i++) {
+		events[i].type = (events[i].type & 1) ? AOI_EVENT_ENTER : AOI_EVENT_LEAVE;
+	}
+	aoi->event_number = start + n;
+}
+
+void
+aoi_set_defer(aoi_space *aoi,int defer) {
+	if (!defer) {
+		aoi_update(aoi);
+	}
+	aoi->defer = defer != 0;
+}
+
+void
+aoi_update(aoi_space *aoi) {
+	int i;
+	int number = aoi->pending_number;
+	if (number == 0) {
+		return;
+	}
+	for (i=0; i<number; i++) {
+		get_object(aoi,aoi->pending_ids[i])->pending_index = -1;
+	}
+	aoi->pending_number = 0;
+	int start = aoi->event_number;
+	bool buffered = aoi->buffered;
+	aoi->buffered = true;
+	aoi->defer = false;
+	aoi_move_batch(aoi,aoi->pending_ids,(const float (*)[3])aoi->pending_pos,number);
+	aoi->defer = true;
+	aoi->buffered = buffered;
+	event_coalesce(aoi,start);
+	if (!buffered) {
+		for (i=start; i<aoi->event_number; i++) {
+			aoi_event *ev = &aoi->events[i];
+			if (ev->type == AOI_EVENT_ENTER) {
+				aoi->cb_enterAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			} else {
+				aoi->cb_leaveAOI(aoi->cb_ud,ev->watcher,ev->marker);
+			}
+		}
+		aoi->event_number = start;
+	}
+}
+
+
+void
+aoi_change_mode(aoi_space *aoi,uint32_t id,const char *modestring) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	bool is_marker = !(obj->mode & MODE_WATCHER);
+	change_mode(obj,modestring);
+	bool is_watcher = obj->mode & MODE_WATCHER;
+	if (is_marker && is_watcher) {
+		int i;
+		get_view(aoi,obj->pos,obj->view_size,aoi->result_set);
+		for(i=0; i<aoi->result_set->number; i++) {
+			aoi_object *temp = aoi->result_set->slot[i];
+			if (obj->id == temp->id) {
+				continue;
+			}
+			if (in_view(aoi,obj->pos,temp->pos,obj->view_size)) {
+				emit_enter(aoi,obj->id,temp->id);
+			}
+		}
+	} else if (!is_watcher) {
+		obj->linger_number = 0;
+	}
+}
+
+void
+aoi_set_view_range(aoi_space *aoi,uint32_t id,float range[3]) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return;
+	}
+	int i;
+	float old_view[3];
+	float window[3];
+	copy_position(old_view,obj->view_size);
+	if (range != NULL) {
+		copy_position(obj->view_size,range);
+		if (!obj->custom_view) {
+			obj->custom_view = true;
+			aoi->custom_view_number++;
+		}
+		for (i=0; i<3; i++) {
+			aoi->max_view[i] = fmax(aoi->max_view[i],range[i]);
+		}
+	} else {
+		copy_position(obj->view_size,aoi->view_size);
+		if (obj->custom_view) {
+			obj->custom_view = false;
+			custom_view_remove(aoi);
+		}
+	}
+	if (!(obj->mode & MODE_WATCHER)) {
+		return;
+	}
+	// only the view of obj changes,others still see obj with their own view
+	for (i=0; i<3; i++) {
+		window[i] = fmax(old_view[i],obj->view_size[i]) + aoi->hysteresis;
+	}
+	get_view(aoi,obj->pos,window,aoi->result_set);
+	for (i=0; i<aoi->result_set->number; i++) {
+		aoi_object *temp = aoi->result_set->slot[i];
+		if (obj->id != temp->id) {
+			view_notify(aoi,obj,temp,
+				view_seen(aoi,obj,temp,obj->pos,temp->pos,old_view),
+				obj->pos,temp->pos);
+		}
+	}
+}
+
+void **
+aoi_get_view_by_pos(aoi_space *aoi,float pos[3],float range[3],int *number) {
+	int i;
+	float lo[3],hi[3];
+	aoi_set *result = aoi->result_set;
+	float *view_size = aoi->view_size;
+	if (range != NULL) {
+		view_size = range;
+	}
+	// exactly in_view,not widened
+	for (i=0; i<3; i++) {
+		lo[i] = pos[i] - view_size[i];
+		hi[i] = pos[i] + view_size[i];
+	}
+	get_window(aoi,lo,hi,NULL,NULL,aoi->set1);
+	result->number = 0;
+	for (i=0; i<aoi->set1->number; i++) {
+		aoi_object *obj = aoi->set1->slot[i];
+		set_add(aoi,result,(void*)obj->id);
+	}
+	*number = result->number;
+	return result->slot;
+}
+
+void **
+aoi_get_view(aoi_space *aoi,uint32_t id,float range[3],int *number) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		*number = 0;
+		return NULL;
+	}
+	int i;
+	if (range == NULL) {
+		get_view(aoi,obj->pos,obj->view_size,aoi->set1);
+	} else {
+		get_view(aoi,obj->pos,range,aoi->set1);
+	}
+	aoi->result_set->number = 0;
+	for (i=0; i<aoi->set1->number; i++) {
+		aoi_object *temp = aoi->set1->slot[i];
+		if (temp != obj) {
+			set_add(aoi,aoi->result_set,(void*)temp->id);
+		}
+	}
+	if (range == NULL) {
+		// markers still seen beyond the view
+		for (i=0; i<obj->linger_number; i++) {
+			set_add(aoi,aoi->result_set,(void*)obj->linger[i]);
+		}
+	}
+	*number = aoi->result_set->number;
+	return aoi->result_set->slot;
+}
+
+int
+aoi_query_view_by_pos(aoi_space *aoi,float pos[3],float range[3],uint32_t *ids,int cap) {
+	int i;
+	float lo[3],hi[3];
+	float *view_size = aoi->view_size;
+	if (range != NULL) {
+		view_size = range;
+	}
+	// exactly in_view,not widened
+	for (i=0; i<3; i++) {
+		lo[i] = pos[i] - view_size[i];
+		hi[i] = pos[i] + view_size[i];
+	}
+	aoi_result result = {ids,cap,0,INVALID_ID};
+	scan_window(aoi,lo,hi,NULL,NULL,NULL,&result);
+	return result.number;
+}
+
+int
+aoi_query_view(aoi_space *aoi,uint32_t id,float range[3],uint32_t *ids,int cap) {
+	aoi_object *obj = get_object(aoi,id);
+	if (obj == NULL) {
+		return 0;
+	}
+	int i;
+	float lo[3],hi[3];
+	view_window(obj->pos,range != NULL ? range : obj->view_size,lo,hi);
+	aoi_result result = {ids,cap,0,obj->id};
+	scan_window(aoi,lo,hi,NULL,NULL,NULL,&result);
+	if (range == NULL) {
+		for (i=0; i<obj->linger_number; i++) {
+			result_add(&result,obj->linger[i]);
+		}
+	}
+	return result.number;
+}
+
+void
+aoi_memory_stats(aoi_space *aoi,aoi_memory *stats) {
+	aoi_slab *slab;
+	memset(stats,0,sizeof(*stats));
+	stats->object_number = aoi->objects->number;
+	for (slab=aoi->slab; slab != NULL; slab=slab->next) {
+		stats->object_cap += SLAB_OBJECT;
+		stats->object_bytes += sizeof(aoi_slab);
+	}
+	map_stats(aoi->objects,stats);
+	map_foreach(aoi->objects,linger_stats,stats);
+	// slots and every axis share one capacity
+	stats->index_number = 3;
+	stats->index_used = aoi->entry_number;
+	stats->index_cap = aoi->cap;
+	stats->index_bytes = aoi->cap * (sizeof(aoi_object*) + sizeof(uint32_t)
+		+ 3 * (3 * sizeof(float) + sizeof(uint32_t)));
+	set_stats(aoi->set1,stats);
+	set_stats(aoi->result_set,stats);
+	stats->buffer_bytes = aoi->event_cap * sizeof(aoi_event)
+		+ aoi->pending_cap * (sizeof(uint32_t) + sizeof(float[3]))
+		+ aoi->batch_cap * sizeof(aoi_batch_move);
+	stats->total = sizeof(*aoi) + stats->object_bytes + stats->map_bytes + stats->index_bytes
+		+ stats->set_bytes + stats->buffer_bytes;
+}
+
+void
+aoi_compact(aoi_space *aoi) {
+	slot_compact(aoi);
+	// scratch sets are only used within a call
+	aoi->set1->number = 0;
+	aoi->result_set->number = 0;
+	set_shrink(aoi,aoi->set1);
+	set_shrink(aoi,aoi->result_set);
+	if (aoi->batch != NULL) {
+		aoi->alloc(aoi->alloc_ud,aoi->batch,aoi->batch_cap * sizeof(aoi_batch_move));
+		aoi->batch = NULL;
+		aoi->batch_cap = 0;
+	}
+	if (aoi->events != NULL && aoi->event_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->events,aoi->event_cap * sizeof(aoi_event));
+		aoi->events = NULL;
+		aoi->event_cap = 0;
+	}
+	if (aoi->pending_ids != NULL && aoi->pending_number == 0) {
+		aoi->alloc(aoi->alloc_ud,aoi->pending_ids,aoi->pending_cap * sizeof(uint32_t));
+		aoi->alloc(aoi->alloc_ud,aoi->pending_pos,aoi->pending_cap * sizeof(float[3]));
+		aoi->pending_ids = NULL;
+		aoi->pending_pos = NULL;
+		aoi->pending_cap = 0;
+	}
+	slab_compact(aoi);
+}